@@ -0,0 +1,582 @@
+// Benchmarks for traffic generation, each mitigation stage and whole steps.
+//
+//   g++ -std=c++17 -O2 -pthread bench/bench.cpp -o ddos_bench
+//   ./ddos_bench --nodes 50,1000 --intensity 2,20 --csv baseline.csv
+//   ./ddos_bench --nodes 50,1000 --intensity 2,20 --baseline baseline.csv
+//
+// Every benchmark runs at each point of the parameter sweep (the cross
+// product of the listed values) and reports packets per second, nanoseconds
+// per packet and heap allocations per step. Results can be saved as CSV or
+// JSON; given a CSV baseline from an earlier run, any benchmark whose
+// ns/packet grew by more than the tolerance is reported and the exit
+// status is 1. --max-allocs 0 likewise fails the run if any measured step
+// touches the heap.
+//
+// sharded/ benchmarks run the network split across --shards processes and
+// scale it with them: every shard brings the sweep point's nodes and
+// attackers and a target of its own, and the time is that of the slowest
+// shard. Allocations made in the shard processes are not counted.
+//
+// Built with -DDDOS_INSTRUMENTATION=1 it also prints the time and packets
+// spent in each phase and stage, and --trace / --folded write the spans as
+// a Chrome trace or as folded stacks for flamegraph.pl.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/distributed.h"
+#include "../src/simulator.h"
+
+// Count every heap allocation made by the process. The replacements below
+// pair malloc with free, which GCC cannot see through.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void* p = std::aligned_alloc(align, (size + align - 1) / align * align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+using Clock = std::chrono::steady_clock;
+
+enum MitigationFlags : unsigned {
+    kRateLimiting = 1 << 0,
+    kIPFiltering = 1 << 1,
+    kDeepPacketInspection = 1 << 2,
+    kTrafficPatternAnalysis = 1 << 3,
+    kAllMitigations = kRateLimiting | kIPFiltering | kDeepPacketInspection | kTrafficPatternAnalysis,
+};
+
+// Part of a step that a benchmark times. Replay processes a step of a
+// pre-recorded shared trace; Pipelined times whole steps with generation
+// running ahead on generator threads; Sharded times whole steps of a run
+// split across processes.
+enum class Phase { Generate, Process, Step, Replay, Pipelined, Sharded };
+
+// Simulation modes a benchmark turns on besides its mitigations
+enum ModeFlags : unsigned {
+    kAggregate = 1 << 0,
+    kRouted = 1 << 1,       // Multi-hop routing with event-scheduled delivery
+    kQueued = 1 << 2,       // Fair-queueing ingress queues
+    kBlocklist = 1 << 3,    // IP filtering through the cuckoo-filter blocklist
+};
+
+struct Benchmark {
+    std::string name;
+    Phase phase;
+    unsigned mitigations;
+    unsigned modes;
+};
+
+const std::vector<Benchmark> kBenchmarks = {
+    {"generate", Phase::Generate, 0, 0},
+    {"process/none", Phase::Process, 0, 0},
+    {"process/rate_limiting", Phase::Process, kRateLimiting, 0},
+    {"process/ip_filtering", Phase::Process, kIPFiltering, 0},
+    {"process/ip_blocklist", Phase::Process, kIPFiltering, kBlocklist},
+    {"process/deep_packet_inspection", Phase::Process, kDeepPacketInspection, 0},
+    {"process/traffic_pattern_analysis", Phase::Process, kTrafficPatternAnalysis, 0},
+    {"process/all", Phase::Process, kAllMitigations, 0},
+    {"step/all", Phase::Step, kAllMitigations, 0},
+    {"step/all_aggregate", Phase::Step, kAllMitigations, kAggregate},
+    {"step/all_routed", Phase::Step, kAllMitigations, kRouted},
+    {"step/all_queued", Phase::Step, kAllMitigations, kQueued},
+    {"replay/all", Phase::Replay, kAllMitigations, 0},
+    {"pipeline/all", Phase::Pipelined, kAllMitigations, 0},
+    {"sharded/all", Phase::Sharded, kAllMitigations, 0},
+};
+
+struct SweepPoint {
+    int numNodes;
+    int numAttackers;
+    double attackIntensity;
+    int legitimateTraffic;
+};
+
+struct Options {
+    std::vector<int> numNodes = {50, 1000};
+    std::vector<int> numAttackers = {10};
+    std::vector<double> attackIntensity = {2.0, 20.0};
+    std::vector<int> legitimateTraffic = {100};
+    int steps = 10;
+    int warmupSteps = 2;
+    int threads = 1;
+    int generators = 1;         // Generator threads of pipelined benchmarks
+    size_t batchPackets = PipelineOptions().batchPackets;
+    std::vector<int> shards = {1, 2, 4};     // Process counts of sharded benchmarks
+    uint64_t seed = 1;
+    std::string filter;         // Only run benchmarks whose name contains this
+    std::string csvPath;
+    std::string jsonPath;
+    std::string baselinePath;
+    double tolerance = 0.10;    // Allowed ns/packet growth over the baseline
+    std::string tracePath;      // Instrumented builds only
+    std::string foldedPath;
+    double maxAllocations = -1;     // Fail if any benchmark allocates more per step; < 0 disables
+};
+
+struct Result {
+    std::string benchmark;
+    SweepPoint point;
+    int steps;
+    uint64_t packets;       // Packets generated or processed over the measured steps
+    double seconds;
+    uint64_t allocations;
+
+    double packetsPerStep() const { return double(packets) / steps; }
+    double packetsPerSecond() const { return seconds > 0 ? packets / seconds : 0; }
+    double nsPerPacket() const { return packets > 0 ? seconds * 1e9 / packets : 0; }
+    double allocationsPerStep() const { return double(allocations) / steps; }
+
+    // Identifies the benchmark and sweep point when comparing runs
+    std::string key() const {
+        std::ostringstream out;
+        out << benchmark << "," << point.numNodes << "," << point.numAttackers << ","
+            << point.attackIntensity << "," << point.legitimateTraffic;
+        return out.str();
+    }
+};
+
+Result runBenchmark(const Benchmark& benchmark, const SweepPoint& point, const Options& options) {
+    const int targetNodeId = 0;
+    NetworkSimulator sim(point.numNodes, targetNodeId, point.numAttackers, options.seed);
+    sim.enableConsoleOutput(false);
+    sim.setWorkerThreads(options.threads);
+    sim.enableAggregateMode(benchmark.modes & kAggregate);
+    sim.enableRouting(benchmark.modes & kRouted);
+    sim.enableEventScheduling(benchmark.modes & kRouted);
+    if (benchmark.modes & kQueued) {
+        IngressQueueConfig queues;
+        queues.discipline = QueueDiscipline::Fair;
+        sim.configureIngressQueues(queues);
+        sim.enableIngressQueueing(true);
+    }
+    if (benchmark.modes & kBlocklist) {
+        IPFilterConfig filter;
+        filter.blocklist = true;
+        sim.configureIPFilter(filter);
+    }
+    sim.enableRateLimiting(benchmark.mitigations & kRateLimiting);
+    sim.enableIPFiltering(benchmark.mitigations & kIPFiltering);
+    sim.enableDeepPacketInspection(benchmark.mitigations & kDeepPacketInspection);
+    sim.enableTrafficPatternAnalysis(benchmark.mitigations & kTrafficPatternAnalysis);
+
+    auto generate = [&]() {
+        if ((benchmark.modes & kAggregate)) {
+            sim.generateFlows(targetNodeId, point.attackIntensity, point.legitimateTraffic);
+        } else {
+            sim.generateTraffic(targetNodeId, point.attackIntensity, point.legitimateTraffic);
+        }
+    };
+
+    // Replays read traffic recorded up front by a second simulator
+    std::shared_ptr<const TrafficTrace> trace;
+    if (benchmark.phase == Phase::Replay) {
+        NetworkSimulator generator(point.numNodes, targetNodeId, point.numAttackers, options.seed);
+        trace = generator.recordTrace(options.warmupSteps + options.steps, targetNodeId, point.attackIntensity,
+                                      point.legitimateTraffic);
+    }
+    auto process = [&](int step) {
+        if (trace) {
+            sim.processTraffic(trace->steps[step]);
+        } else {
+            sim.processTraffic();
+        }
+    };
+
+    // A pipelined run is timed as a whole; every step has the same packets
+    if (benchmark.phase == Phase::Pipelined) {
+        PipelineOptions pipeline;
+        pipeline.batchPackets = options.batchPackets;
+        sim.setPipelinedGeneration(options.generators, pipeline);
+        sim.runSimulation(options.warmupSteps, targetNodeId, point.attackIntensity, point.legitimateTraffic);
+        Result result{benchmark.name, point, options.steps, 0, 0.0, 0};
+        uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        Clock::time_point start = Clock::now();
+        sim.runSimulation(options.steps, targetNodeId, point.attackIntensity, point.legitimateTraffic);
+        result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        result.allocations = allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+        const StepStats& stats = sim.lastStepStats();
+        result.packets = uint64_t(stats.packetsProcessed + stats.packetsDropped) * options.steps;
+        return result;
+    }
+
+    // Warm-up steps grow the buffers to their steady-state size
+    for (int s = 0; s < options.warmupSteps; s++) {
+        if (!trace) generate();
+        process(s);
+    }
+
+    Result result{benchmark.name, point, options.steps, 0, 0.0, 0};
+    Clock::duration elapsed{};
+    for (int s = 0; s < options.steps; s++) {
+        uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        Clock::time_point start = Clock::now();
+        if (!trace) generate();
+        Clock::time_point generated = Clock::now();
+        uint64_t allocationsGenerated = allocationCount.load(std::memory_order_relaxed);
+        process(options.warmupSteps + s);
+        Clock::time_point processed = Clock::now();
+        uint64_t allocationsProcessed = allocationCount.load(std::memory_order_relaxed);
+
+        switch (benchmark.phase) {
+            case Phase::Generate:
+                elapsed += generated - start;
+                result.allocations += allocationsGenerated - allocationsBefore;
+                break;
+            case Phase::Process:
+            case Phase::Replay:
+                elapsed += processed - generated;
+                result.allocations += allocationsProcessed - allocationsGenerated;
+                break;
+            case Phase::Step:
+            case Phase::Pipelined:
+            case Phase::Sharded:
+                elapsed += processed - start;
+                result.allocations += allocationsProcessed - allocationsBefore;
+                break;
+        }
+        const StepStats& stats = sim.lastStepStats();
+        result.packets += stats.packetsProcessed + stats.packetsDropped;
+    }
+    result.seconds = std::chrono::duration<double>(elapsed).count();
+    return result;
+}
+
+// A sharded benchmark with numShards processes, each simulating the sweep
+// point's nodes and attackers and one target, so the work grows with the
+// shards. Each attacker's traffic is split evenly over the targets.
+Result runShardedBenchmark(const Benchmark& benchmark, const SweepPoint& point, const Options& options,
+                           int numShards) {
+    ShardedRun run;
+    run.params.numNodes = point.numNodes * numShards;
+    run.params.numAttackers = point.numAttackers * numShards;
+    run.params.steps = options.warmupSteps + options.steps;
+    run.params.attackIntensity = point.attackIntensity / numShards;
+    run.params.legitimateTraffic = point.legitimateTraffic * numShards;
+    for (int shard = 0; shard < numShards; shard++) {
+        // The first node after the attackers that the shard owns
+        int target = run.params.numAttackers;
+        while (target % numShards != shard) target++;
+        run.targets.push_back(target);
+    }
+    run.params.targetNodeId = run.targets[0];
+    run.mitigations = MitigationSet::fromBits(benchmark.mitigations);
+    int threads = options.threads;
+    run.configure = [threads](NetworkSimulator& sim) { sim.setWorkerThreads(threads); };
+    run.seed = options.seed;
+    run.numShards = numShards;
+    ShardedResult sharded = runSharded(run);
+
+    Result result{benchmark.name + "_x" + std::to_string(numShards), point, options.steps, 0, 0.0, 0};
+    for (int s = options.warmupSteps; s < run.params.steps; s++) {
+        result.packets += sharded.steps[s].packetsProcessed + sharded.steps[s].packetsDropped;
+    }
+    for (const auto& shard : sharded.shards) {
+        double seconds = 0;
+        for (int s = options.warmupSteps; s < run.params.steps; s++) seconds += shard.stepSeconds[s];
+        result.seconds = std::max(result.seconds, seconds);
+    }
+    return result;
+}
+
+void printResult(const Result& r) {
+    std::cout << std::left << std::setw(34) << r.benchmark << std::right << std::setw(7) << r.point.numNodes
+              << std::setw(10) << r.point.numAttackers << std::setw(10) << r.point.attackIntensity
+              << std::setw(7) << r.point.legitimateTraffic
+              << std::fixed << std::setprecision(0) << std::setw(14) << r.packetsPerStep()
+              << std::setw(14) << r.packetsPerSecond() << std::setprecision(2) << std::setw(10)
+              << r.nsPerPacket() << std::setprecision(1) << std::setw(12) << r.allocationsPerStep()
+              << std::defaultfloat << std::setprecision(6) << "\n";
+}
+
+// Weak-scaling efficiency of the last count results, one per shard count:
+// packets per second per shard relative to the first of them
+void printWeakScaling(const std::vector<Result>& results, size_t count) {
+    if (count < 2 || results.size() < count) return;
+    auto shardsOf = [](const Result& r) { return std::stoi(r.benchmark.substr(r.benchmark.rfind("_x") + 2)); };
+    const Result& reference = results[results.size() - count];
+    double perShard = reference.packetsPerSecond() / shardsOf(reference);
+    std::cout << "  weak scaling:";
+    for (size_t i = results.size() - count; i < results.size(); i++) {
+        double efficiency = perShard > 0 ? results[i].packetsPerSecond() / shardsOf(results[i]) / perShard : 0;
+        std::cout << " x" << shardsOf(results[i]) << " " << std::fixed << std::setprecision(0)
+                  << efficiency * 100 << "%" << std::defaultfloat << std::setprecision(6);
+    }
+    std::cout << "\n";
+}
+
+void writeCsv(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "benchmark,num_nodes,num_attackers,attack_intensity,legitimate_traffic,"
+           "packets_per_step,packets_per_sec,ns_per_packet,allocations_per_step\n";
+    for (const auto& r : results) {
+        out << r.key() << "," << r.packetsPerStep() << "," << r.packetsPerSecond() << ","
+            << r.nsPerPacket() << "," << r.allocationsPerStep() << "\n";
+    }
+}
+
+void writeJson(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "  {\"benchmark\": \"" << r.benchmark << "\""
+            << ", \"num_nodes\": " << r.point.numNodes
+            << ", \"num_attackers\": " << r.point.numAttackers
+            << ", \"attack_intensity\": " << r.point.attackIntensity
+            << ", \"legitimate_traffic\": " << r.point.legitimateTraffic
+            << ", \"packets_per_step\": " << r.packetsPerStep()
+            << ", \"packets_per_sec\": " << r.packetsPerSecond()
+            << ", \"ns_per_packet\": " << r.nsPerPacket()
+            << ", \"allocations_per_step\": " << r.allocationsPerStep() << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// ns/packet of every benchmark in a CSV written by writeCsv(), by key
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open baseline " + path);
+    }
+    std::map<std::string, double> baseline;
+    std::string line;
+    std::getline(in, line);     // Header
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream row(line);
+        for (std::string field; std::getline(row, field, ',');) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 9) continue;
+        baseline[fields[0] + "," + fields[1] + "," + fields[2] + "," + fields[3] + "," + fields[4]] =
+            std::stod(fields[7]);
+    }
+    return baseline;
+}
+
+// Report the results slower than the baseline by more than the tolerance
+// and return how many there were
+int compareWithBaseline(const std::vector<Result>& results, const std::map<std::string, double>& baseline,
+                        double tolerance) {
+    int regressions = 0;
+    for (const auto& r : results) {
+        auto it = baseline.find(r.key());
+        if (it == baseline.end() || it->second <= 0) continue;
+        double change = r.nsPerPacket() / it->second - 1.0;
+        if (change > tolerance) {
+            std::cout << "REGRESSION " << r.key() << ": " << std::fixed << std::setprecision(2)
+                      << it->second << " -> " << r.nsPerPacket() << " ns/packet (+"
+                      << std::setprecision(1) << change * 100 << "%)\n";
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+template <typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream in(text);
+    for (std::string item; std::getline(in, item, ',');) {
+        std::stringstream value(item);
+        T parsed;
+        if (!(value >> parsed)) {
+            throw std::invalid_argument("Bad list value: " + item);
+        }
+        values.push_back(parsed);
+    }
+    return values;
+}
+
+void printUsage() {
+    std::cout << "Usage: ddos_bench [options]\n"
+                 "  --nodes LIST        numNodes values (default 50,1000)\n"
+                 "  --attackers LIST    numAttackers values (default 10)\n"
+                 "  --intensity LIST    attackIntensity values (default 2,20)\n"
+                 "  --legit LIST        legitimateTraffic values (default 100)\n"
+                 "  --steps N           measured steps per benchmark (default 10)\n"
+                 "  --warmup N          unmeasured steps first (default 2)\n"
+                 "  --threads N         worker threads (default 1)\n"
+                 "  --generators N      generator threads for pipeline/ benchmarks (default 1)\n"
+                 "  --batch N           packets per generation batch when pipelined (default 65536)\n"
+                 "  --shards LIST       process counts of sharded/ benchmarks (default 1,2,4)\n"
+                 "  --seed N            traffic seed (default 1)\n"
+                 "  --filter TEXT       only benchmarks whose name contains TEXT\n"
+                 "  --csv PATH          save results as CSV\n"
+                 "  --json PATH         save results as JSON\n"
+                 "  --baseline PATH     compare ns/packet with an earlier CSV\n"
+                 "  --tolerance X       allowed slowdown over the baseline (default 0.10)\n"
+                 "  --trace PATH        save instrumentation spans as a Chrome trace\n"
+                 "  --folded PATH       save instrumentation as folded stacks\n"
+                 "  --max-allocs X      fail if any benchmark exceeds X allocations per step\n";
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--nodes") options.numNodes = parseList<int>(value);
+        else if (arg == "--attackers") options.numAttackers = parseList<int>(value);
+        else if (arg == "--intensity") options.attackIntensity = parseList<double>(value);
+        else if (arg == "--legit") options.legitimateTraffic = parseList<int>(value);
+        else if (arg == "--steps") options.steps = std::max(1, std::stoi(value));
+        else if (arg == "--warmup") options.warmupSteps = std::max(0, std::stoi(value));
+        else if (arg == "--threads") options.threads = std::stoi(value);
+        else if (arg == "--generators") options.generators = std::max(1, std::stoi(value));
+        else if (arg == "--batch") options.batchPackets = std::stoul(value);
+        else if (arg == "--shards") options.shards = parseList<int>(value);
+        else if (arg == "--seed") options.seed = std::stoull(value);
+        else if (arg == "--filter") options.filter = value;
+        else if (arg == "--csv") options.csvPath = value;
+        else if (arg == "--json") options.jsonPath = value;
+        else if (arg == "--baseline") options.baselinePath = value;
+        else if (arg == "--tolerance") options.tolerance = std::stod(value);
+        else if (arg == "--trace") options.tracePath = value;
+        else if (arg == "--folded") options.foldedPath = value;
+        else if (arg == "--max-allocs") options.maxAllocations = std::stod(value);
+        else throw std::invalid_argument("Unknown option " + arg);
+    }
+    return options;
+}
+
+// Print where the time went over every benchmark and write the requested
+// trace files
+void reportInstrumentation(const Options& options) {
+#if DDOS_INSTRUMENTATION
+    Instrumentation::Report report = Instrumentation::total();
+    std::cout << "\n" << std::left << std::setw(28) << "probe" << std::right << std::setw(12) << "calls"
+              << std::setw(16) << "ticks" << std::setw(12) << "ticks/call" << std::setw(14) << "hits"
+              << std::setw(14) << "drops" << "\n";
+    for (int p = 0; p < kNumProbes; p++) {
+        const Instrumentation::ProbeTotals& probe = report.probes[p];
+        if (probe.calls == 0 && probe.drops == 0) continue;
+        std::cout << std::left << std::setw(28) << Instrumentation::probeName(p) << std::right
+                  << std::setw(12) << probe.calls << std::setw(16) << probe.ticks << std::setw(12)
+                  << (probe.calls ? probe.ticks / probe.calls : 0) << std::setw(14) << probe.hits
+                  << std::setw(14) << probe.drops << "\n";
+    }
+    for (int g = 0; g < kNumGauges; g++) {
+        std::cout << "max " << Instrumentation::gaugeName(g) << ": " << report.highWater[g] << "\n";
+    }
+    if (!options.tracePath.empty() && !Instrumentation::writeChromeTrace(options.tracePath)) {
+        std::cerr << "Cannot write " << options.tracePath << "\n";
+    }
+    if (!options.foldedPath.empty() && !Instrumentation::writeFoldedStacks(options.foldedPath)) {
+        std::cerr << "Cannot write " << options.foldedPath << "\n";
+    }
+#else
+    if (!options.tracePath.empty() || !options.foldedPath.empty()) {
+        std::cerr << "--trace and --folded need a build with -DDDOS_INSTRUMENTATION=1\n";
+    }
+#endif
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        printUsage();
+        return 2;
+    }
+
+    std::vector<SweepPoint> sweep;
+    for (int numNodes : options.numNodes)
+        for (int numAttackers : options.numAttackers)
+            for (double attackIntensity : options.attackIntensity)
+                for (int legitimateTraffic : options.legitimateTraffic)
+                    if (numAttackers < numNodes)
+                        sweep.push_back(SweepPoint{numNodes, numAttackers, attackIntensity, legitimateTraffic});
+
+    std::cout << std::left << std::setw(34) << "benchmark" << std::right << std::setw(7) << "nodes"
+              << std::setw(10) << "attackers" << std::setw(10) << "intensity" << std::setw(7) << "legit"
+              << std::setw(14) << "packets/step" << std::setw(14) << "packets/s" << std::setw(10) << "ns/packet"
+              << std::setw(12) << "allocs/step" << "\n";
+    std::vector<Result> results;
+    for (const auto& point : sweep) {
+        for (const auto& benchmark : kBenchmarks) {
+            if (benchmark.name.find(options.filter) == std::string::npos) continue;
+            if (benchmark.phase == Phase::Sharded) {
+                for (int numShards : options.shards) {
+                    results.push_back(runShardedBenchmark(benchmark, point, options, std::max(1, numShards)));
+                    printResult(results.back());
+                }
+                printWeakScaling(results, options.shards.size());
+                continue;
+            }
+            results.push_back(runBenchmark(benchmark, point, options));
+            printResult(results.back());
+        }
+    }
+
+    reportInstrumentation(options);
+    if (!options.csvPath.empty()) writeCsv(options.csvPath, results);
+    if (!options.jsonPath.empty()) writeJson(options.jsonPath, results);
+    int status = 0;
+    if (options.maxAllocations >= 0) {
+        int overBudget = 0;
+        for (const auto& r : results) {
+            if (r.allocationsPerStep() > options.maxAllocations) {
+                std::cout << "ALLOCATIONS " << r.key() << ": " << r.allocationsPerStep() << " per step\n";
+                overBudget++;
+            }
+        }
+        if (overBudget > 0) {
+            std::cout << overBudget << " benchmark(s) over " << options.maxAllocations << " allocations per step\n";
+            status = 1;
+        }
+    }
+    if (!options.baselinePath.empty()) {
+        try {
+            int regressions = compareWithBaseline(results, readBaseline(options.baselinePath), options.tolerance);
+            std::cout << regressions << " regression(s) against " << options.baselinePath << "\n";
+            if (regressions > 0) status = 1;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 2;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include "partition.h"
+
+// Counter stores for per-source and per-signature tracking.
+// Node and signature ids are dense, so the common case is a flat array
+// indexed by key. OpenAddressCounter covers sparse key spaces (e.g. raw IPv4
+// addresses). DenseCounterStore and SparseCounterStore build on them, aging
+// their counts lazily as a CounterDecay says.
+
+constexpr size_t kCacheLineSize = 64;
+
+// Allocator that places storage on cache-line boundaries
+template <typename T>
+struct CacheAlignedAllocator {
+    using value_type = T;
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(kCacheLineSize)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(kCacheLineSize));
+    }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+// How counters age, so that thresholds follow recent rates instead of
+// lifetime totals. Every epochSteps steps each count is halved shift
+// times: a shift of 0 never decays and kForget or more starts every epoch
+// from zero.
+struct CounterDecay {
+    static constexpr int kForget = 31;
+
+    int epochSteps = 10;
+    int shift = 0;
+};
+
+// A count and the epoch it was last brought up to date in. Counts only age
+// when they are touched, so advancing time costs nothing per key.
+struct DecayingCount {
+    int count = 0;
+    uint32_t epoch = 0;
+
+    // The count as of epoch now
+    int at(uint32_t now, int shift) const {
+        uint64_t halvings = uint64_t(now - epoch) * uint64_t(shift);
+        return halvings >= uint64_t(CounterDecay::kForget) ? 0 : count >> halvings;
+    }
+
+    int add(uint32_t now, int shift, int amount) {
+        count = at(now, shift) + amount;
+        epoch = now;
+        return count;
+    }
+};
+
+// Linear-probing hash table of decaying counts for sparse keys
+class OpenAddressCounter {
+public:
+    static constexpr uint64_t kEmptyKey = UINT64_MAX;
+
+    explicit OpenAddressCounter(size_t expectedKeys = 16) { reserve(expectedKeys); }
+
+    // Make room for n keys without rehashing
+    void reserve(size_t n) {
+        size_t capacity = capacityFor(n);
+        if (capacity > slots.size()) {
+            rehash(capacity);
+        }
+    }
+
+    int increment(uint64_t key, uint32_t epoch, int shift, int amount = 1) {
+        if ((used + 1) * kMaxLoadDen > slots.size() * kMaxLoadNum) {
+            rehash(slots.size() * 2);
+        }
+        size_t i = probe(key);
+        if (slots[i].key == kEmptyKey) {
+            slots[i].key = key;
+            used++;
+        }
+        return slots[i].value.add(epoch, shift, amount);
+    }
+
+    int get(uint64_t key, uint32_t epoch, int shift) const {
+        size_t i = probe(key);
+        return slots[i].key == kEmptyKey ? 0 : slots[i].value.at(epoch, shift);
+    }
+
+    // Drop the keys whose count has decayed to zero and shrink the table
+    // to fit the rest
+    void compact(uint32_t epoch, int shift) {
+        size_t live = 0;
+        for (const auto& slot : slots) {
+            live += slot.key != kEmptyKey && slot.value.at(epoch, shift) > 0;
+        }
+        std::vector<Slot, CacheAlignedAllocator<Slot>> old(capacityFor(live));
+        old.swap(slots);
+        used = 0;
+        for (const auto& slot : old) {
+            if (slot.key != kEmptyKey && slot.value.at(epoch, shift) > 0) {
+                slots[probe(slot.key)] = slot;
+                used++;
+            }
+        }
+    }
+
+    void clear() {
+        for (auto& slot : slots) {
+            slot = Slot();
+        }
+        used = 0;
+    }
+
+    size_t size() const { return used; }
+    size_t memoryBytes() const { return slots.size() * sizeof(Slot); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(slots, used); }
+
+private:
+    struct Slot {
+        uint64_t key = kEmptyKey;
+        DecayingCount value;
+    };
+
+    // Grow once the table is 70% full
+    static constexpr size_t kMaxLoadNum = 7;
+    static constexpr size_t kMaxLoadDen = 10;
+
+    static size_t capacityFor(size_t n) {
+        size_t capacity = 16;
+        while (capacity * kMaxLoadNum < n * kMaxLoadDen) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static uint64_t hash(uint64_t key) {
+        // Fibonacci hashing spreads sequential ids across the table
+        return key * 0x9E3779B97F4A7C15ull;
+    }
+
+    // Slot holding key, or the empty slot where it would be inserted
+    size_t probe(uint64_t key) const {
+        size_t mask = slots.size() - 1;
+        size_t i = (hash(key) >> 32) & mask;
+        while (slots[i].key != kEmptyKey && slots[i].key != key) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot, CacheAlignedAllocator<Slot>> old(capacity);
+        old.swap(slots);
+        for (const auto& slot : old) {
+            if (slot.key != kEmptyKey) {
+                slots[probe(slot.key)] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot, CacheAlignedAllocator<Slot>> slots;
+    size_t used = 0;
+};
+
+// Steps and epochs behind a counter store's aging
+struct CounterClock {
+    CounterDecay decay;
+    uint64_t steps = 0;
+    uint32_t epoch = 0;
+
+    void setDecay(const CounterDecay& newDecay) {
+        decay = newDecay;
+        decay.epochSteps = std::max(1, decay.epochSteps);
+        decay.shift = std::max(0, decay.shift);
+        reset();
+    }
+
+    // One step has passed; true if it began an epoch
+    bool advance() {
+        steps++;
+        if (steps % uint64_t(decay.epochSteps) != 0) return false;
+        epoch++;
+        return true;
+    }
+
+    void reset() {
+        steps = 0;
+        epoch = 0;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(decay, steps, epoch); }
+};
+
+// Counter storage chosen for the stages of a simulator. Automatic takes
+// the dense array when the key space fits in kDenseKeyLimit keys.
+enum class CounterStorage { Automatic, Dense, Sparse };
+
+// Key spaces up to this size fit a flat array (128 MB of counts)
+constexpr uint64_t kDenseKeyLimit = uint64_t(1) << 24;
+
+inline bool usesDenseCounters(CounterStorage storage, uint64_t keySpace) {
+    return storage == CounterStorage::Automatic ? keySpace <= kDenseKeyLimit : storage == CounterStorage::Dense;
+}
+
+// The two counter stores below share an interface, so a stage takes one as
+// a template parameter and its packet loop calls the storage directly.
+// advance() moves time on by a step. Nothing is walked then: a count is
+// aged when it is next read or incremented.
+
+// Decaying counters in a flat array indexed by key, for compact key spaces
+class DenseCounterStore {
+public:
+    explicit DenseCounterStore(uint64_t keySpace = 0, const CounterDecay& decay = CounterDecay()) {
+        resize(keySpace);
+        setDecay(decay);
+    }
+
+    // Grow or shrink the key space, padded to whole cache lines
+    void resize(uint64_t keySpace) {
+        size_t perLine = kCacheLineSize / sizeof(DecayingCount);
+        counts.resize((keySpace + perLine - 1) / perLine * perLine);
+        keys = keySpace;
+    }
+
+    // Change how counts age; every count starts over
+    void setDecay(const CounterDecay& decay) {
+        clock.setDecay(decay);
+        clear();
+    }
+
+    const CounterDecay& decaySettings() const { return clock.decay; }
+
+    // One step has passed
+    void advance() { clock.advance(); }
+
+    int increment(uint64_t key, int amount = 1) { return counts[key].add(clock.epoch, clock.decay.shift, amount); }
+    int get(uint64_t key) const { return counts[key].at(clock.epoch, clock.decay.shift); }
+
+    void clear() {
+        std::fill(counts.begin(), counts.end(), DecayingCount());
+        clock.reset();
+    }
+
+    uint64_t keySpace() const { return keys; }
+    size_t memoryBytes() const { return counts.size() * sizeof(DecayingCount); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(counts, keys, clock); }
+
+private:
+    std::vector<DecayingCount, CacheAlignedAllocator<DecayingCount>> counts;
+    uint64_t keys = 0;
+    CounterClock clock;
+};
+
+// Decaying counters in open addressing tables, for sparse key spaces. Keys
+// whose count has decayed to zero are compacted away every
+// kCompactionEpochs epochs, so the tables hold the keys seen recently
+// rather than every key ever seen. The keys are split into one table per
+// partition, so the parallel processing path can count from every
+// partition at once.
+class SparseCounterStore {
+public:
+    static constexpr uint32_t kCompactionEpochs = 4;
+
+    explicit SparseCounterStore(uint64_t keySpace = 0, const CounterDecay& decay = CounterDecay()) :
+        tables(kNumPartitions), keys(keySpace) {
+        setDecay(decay);
+    }
+
+    // Tables grow with the keys seen, so only the bound is kept
+    void resize(uint64_t keySpace) { keys = keySpace; }
+
+    // Change how counts age; every count starts over
+    void setDecay(const CounterDecay& decay) {
+        clock.setDecay(decay);
+        clear();
+    }
+
+    const CounterDecay& decaySettings() const { return clock.decay; }
+
+    // One step has passed
+    void advance() {
+        if (clock.advance() && clock.decay.shift > 0 && clock.epoch % kCompactionEpochs == 0) {
+            for (auto& table : tables) table.compact(clock.epoch, clock.decay.shift);
+        }
+    }
+
+    int increment(uint64_t key, int amount = 1) {
+        return tables[partitionOf(key)].increment(key, clock.epoch, clock.decay.shift, amount);
+    }
+
+    int get(uint64_t key) const { return tables[partitionOf(key)].get(key, clock.epoch, clock.decay.shift); }
+
+    void clear() {
+        for (auto& table : tables) table.clear();
+        clock.reset();
+    }
+
+    uint64_t keySpace() const { return keys; }
+
+    // Keys held by the tables
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& table : tables) total += table.size();
+        return total;
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (const auto& table : tables) bytes += table.memoryBytes();
+        return bytes;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(tables, keys, clock); }
+
+private:
+    std::vector<OpenAddressCounter> tables;     // One per partition
+    uint64_t keys = 0;
+    CounterClock clock;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "counters.h"
+#include "partition.h"
+
+// Approximate set of 64-bit keys with deletes, after Fan et al., "Cuckoo
+// Filter: Practically Better Than Bloom".
+//
+// A key is stored as a 16-bit fingerprint in one of two buckets of four
+// slots, so a lookup reads two 8-byte buckets, at most two cache misses,
+// and a key that was never inserted is reported present with probability
+// about 8 / 65536 at full load. The second bucket is derived from the first
+// and the fingerprint alone, which lets entries move between their buckets
+// on insert and be removed again without knowing their key. At the 90%
+// load it is sized for the filter takes about 2.8 bytes per key, some 28 MB
+// for ten million keys.
+//
+// Every entry also carries a 4-bit tag, kept apart from the fingerprints
+// so lookups never read it; eraseTag() drops every entry with a given tag
+// in one sweep, which is how a blocklist expires whole epochs of entries
+// without remembering their keys.
+//
+// As with CountMinSketch the buckets are cut into one slice per partition
+// and a key only lives in the slice of partitionOf(key), so the parallel
+// processing path can insert from every partition at once.
+class CuckooFilter {
+public:
+    static constexpr size_t kSlotsPerBucket = 4;
+    static constexpr uint32_t kNumTags = 16;
+    static constexpr double kTargetLoad = 0.9;     // Load the filter is sized for
+    static constexpr int kMaxKicks = 500;          // Displacements before an insert gives up
+
+    explicit CuckooFilter(size_t capacity = 0) { resize(capacity); }
+
+    // Empty the filter and size it for capacity keys
+    void resize(size_t capacity) {
+        double buckets = double(capacity) / (kSlotsPerBucket * kTargetLoad * kNumPartitions);
+        sliceBuckets = std::max<size_t>(1, size_t(std::ceil(buckets)));
+        fingerprints.assign(sliceBuckets * kNumPartitions * kSlotsPerBucket, 0);
+        tags.assign(sliceBuckets * kNumPartitions, 0);
+        slices.assign(kNumPartitions, Slice());
+    }
+
+    bool contains(uint64_t key) const {
+        Location at = locate(key);
+        const Slice& slice = slices[at.slice];
+        return bucketHolds(at.first, at.fingerprint) || bucketHolds(at.second, at.fingerprint) ||
+               (slice.stashed && slice.stash.fingerprint == at.fingerprint &&
+                (slice.stash.bucket == at.first || slice.stash.bucket == at.second));
+    }
+
+    // Add key with tag, which must be below kNumTags. Returns false if its
+    // slice is too full to take it, leaving the filter unchanged. Inserting
+    // a key that is already present stores it twice.
+    bool insert(uint64_t key, uint32_t tag = 0) {
+        Location at = locate(key);
+        Slice& slice = slices[at.slice];
+        if (slice.stashed) return false;
+        if (place(at.first, at.fingerprint, tag) || place(at.second, at.fingerprint, tag)) {
+            slice.size++;
+            return true;
+        }
+
+        // Evict entries to their other bucket until one finds room; the
+        // last one evicted waits in the slice's stash
+        Entry moving{at.fingerprint, uint8_t(tag), (slice.kicks & 1) ? at.second : at.first};
+        for (int kick = 0; kick < kMaxKicks; kick++) {
+            size_t slot = moving.bucket * kSlotsPerBucket + slice.kicks++ % kSlotsPerBucket;
+            uint32_t displacedTag = tagAt(slot);
+            std::swap(moving.fingerprint, fingerprints[slot]);
+            setTag(slot, moving.tag);
+            moving.tag = uint8_t(displacedTag);
+            moving.bucket = alternate(at.slice, moving.bucket, moving.fingerprint);
+            if (place(moving.bucket, moving.fingerprint, moving.tag)) {
+                slice.size++;
+                return true;
+            }
+        }
+        slice.stash = moving;
+        slice.stashed = true;
+        slice.size++;
+        return true;
+    }
+
+    // Remove one copy of key. Only erase keys that were inserted: a false
+    // positive would take another key's entry with it.
+    bool erase(uint64_t key) {
+        Location at = locate(key);
+        Slice& slice = slices[at.slice];
+        if (slice.stashed && slice.stash.fingerprint == at.fingerprint &&
+            (slice.stash.bucket == at.first || slice.stash.bucket == at.second)) {
+            slice.stashed = false;
+            slice.size--;
+            return true;
+        }
+        if (!clearSlot(at.first, at.fingerprint) && !clearSlot(at.second, at.fingerprint)) return false;
+        slice.size--;
+        unstash(at.slice);
+        return true;
+    }
+
+    // Remove every entry inserted with tag; returns how many went
+    size_t eraseTag(uint32_t tag) {
+        size_t erased = 0;
+        for (size_t s = 0; s < kNumPartitions; s++) {
+            Slice& slice = slices[s];
+            size_t before = slice.size;
+            size_t end = (s + 1) * sliceBuckets * kSlotsPerBucket;
+            for (size_t slot = s * sliceBuckets * kSlotsPerBucket; slot < end; slot++) {
+                if (fingerprints[slot] != 0 && tagAt(slot) == tag) {
+                    fingerprints[slot] = 0;
+                    slice.size--;
+                }
+            }
+            if (slice.stashed && slice.stash.tag == tag) {
+                slice.stashed = false;
+                slice.size--;
+            }
+            unstash(s);
+            erased += before - slice.size;
+        }
+        return erased;
+    }
+
+    void clear() {
+        std::fill(fingerprints.begin(), fingerprints.end(), 0);
+        std::fill(tags.begin(), tags.end(), 0);
+        slices.assign(kNumPartitions, Slice());
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& slice : slices) total += slice.size;
+        return total;
+    }
+
+    size_t slots() const { return fingerprints.size(); }
+    double load() const { return slots() ? double(size()) / double(slots()) : 0.0; }
+
+    // Chance that a key never inserted is reported present at the current load
+    double falsePositiveRate() const {
+        return 1.0 - std::pow(1.0 - 1.0 / 65535.0, 2.0 * kSlotsPerBucket * load());
+    }
+
+    size_t memoryBytes() const {
+        return fingerprints.size() * sizeof(uint16_t) + tags.size() * sizeof(uint16_t) + slices.size() * sizeof(Slice);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(sliceBuckets, fingerprints, tags, slices); }
+
+private:
+    struct Entry {
+        uint16_t fingerprint = 0;
+        uint8_t tag = 0;
+        size_t bucket = 0;      // One of the entry's two buckets
+    };
+
+    // Slice bookkeeping, on its own cache line per partition
+    struct alignas(kCacheLineSize) Slice {
+        size_t size = 0;
+        uint32_t kicks = 0;     // Drives the choice of victims, so inserts are deterministic
+        bool stashed = false;
+        Entry stash;
+    };
+
+    struct Location {
+        size_t slice;
+        size_t first;           // Global bucket indices
+        size_t second;
+        uint16_t fingerprint;
+    };
+
+    static constexpr uint64_t kLanes = 0x0001000100010001ull;
+
+    // Bucket index within a slice of sliceBuckets from 32 hash bits
+    size_t reduce(uint32_t hash) const { return size_t((uint64_t(hash) * sliceBuckets) >> 32); }
+
+    // The other bucket of a fingerprint in bucket, (h(fingerprint) - i) mod n
+    // within the slice, which maps each of the two buckets to the other
+    size_t alternate(size_t slice, size_t bucket, uint16_t fingerprint) const {
+        size_t base = slice * sliceBuckets;
+        size_t offset = reduce(uint32_t(fingerprint) * 0x5BD1E995u);
+        return base + (offset + sliceBuckets - (bucket - base)) % sliceBuckets;
+    }
+
+    Location locate(uint64_t key) const {
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 32;
+        Location at;
+        at.slice = partitionOf(key);
+        at.fingerprint = uint16_t(h >> 48);
+        at.fingerprint += at.fingerprint == 0;      // 0 marks an empty slot
+        at.first = at.slice * sliceBuckets + reduce(uint32_t(h));
+        at.second = alternate(at.slice, at.first, at.fingerprint);
+        return at;
+    }
+
+    // Whether any of the bucket's four 16-bit lanes equals fingerprint
+    bool bucketHolds(size_t bucket, uint16_t fingerprint) const {
+        uint64_t lanes;
+        std::memcpy(&lanes, &fingerprints[bucket * kSlotsPerBucket], sizeof(lanes));
+        uint64_t x = lanes ^ (uint64_t(fingerprint) * kLanes);
+        return ((x - kLanes) & ~x & (kLanes << 15)) != 0;
+    }
+
+    uint32_t tagAt(size_t slot) const {
+        return (tags[slot / kSlotsPerBucket] >> (4 * (slot % kSlotsPerBucket))) & 15;
+    }
+
+    void setTag(size_t slot, uint32_t tag) {
+        uint16_t& bucketTags = tags[slot / kSlotsPerBucket];
+        int shift = 4 * (slot % kSlotsPerBucket);
+        bucketTags = uint16_t((bucketTags & ~(15u << shift)) | ((tag & 15) << shift));
+    }
+
+    bool place(size_t bucket, uint16_t fingerprint, uint32_t tag) {
+        for (size_t slot = bucket * kSlotsPerBucket; slot < (bucket + 1) * kSlotsPerBucket; slot++) {
+            if (fingerprints[slot] == 0) {
+                fingerprints[slot] = fingerprint;
+                setTag(slot, tag);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool clearSlot(size_t bucket, uint16_t fingerprint) {
+        for (size_t slot = bucket * kSlotsPerBucket; slot < (bucket + 1) * kSlotsPerBucket; slot++) {
+            if (fingerprints[slot] == fingerprint) {
+                fingerprints[slot] = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Move a stashed entry back into the table once either bucket has room
+    void unstash(size_t s) {
+        Slice& slice = slices[s];
+        if (!slice.stashed) return;
+        const Entry& entry = slice.stash;
+        if (place(entry.bucket, entry.fingerprint, entry.tag) ||
+            place(alternate(s, entry.bucket, entry.fingerprint), entry.fingerprint, entry.tag)) {
+            slice.stashed = false;
+        }
+    }
+
+    size_t sliceBuckets = 1;
+    std::vector<uint16_t, CacheAlignedAllocator<uint16_t>> fingerprints;   // kSlotsPerBucket per bucket, 0 if empty
+    std::vector<uint16_t> tags;     // Four 4-bit tags per bucket
+    std::vector<Slice> slices;
+};
@@ -0,0 +1,803 @@
+#pragma once
+
+#if defined(_WIN32)
+#error "Sharded runs need fork() and Unix domain sockets"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "scenario.h"
+#include "simulator.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Shard batches are sent as in-memory columns and assume a little-endian host"
+#endif
+
+// Sharded runs: one network simulated by several processes.
+//
+// Nodes are dealt round robin to numShards worker processes forked from
+// the caller, and each shard's simulator holds only its own nodes (see
+// NodeShard). Every step each shard draws the packets its own nodes send:
+// every attacker's flood and its share of the legitimate traffic, in
+// proportion to its legitimate sources, drawn from those sources only. It
+// sends the ones bound for another shard's node to that shard: one batch
+// per peer per step, empty or not. Receiving every peer's batch is the
+// step's barrier, so the shards move through the steps in lock step. A
+// shard then puts the packets for its nodes in the order of the whole
+// step and processes them with its simulator, through the same mitigation
+// pipeline as any other step. At the end the parent sums every shard's
+// statistics.
+//
+// Generation and per-node state cost each shard its part of the network,
+// so adding shards scales to more nodes and attackers. Shards draw
+// independently, so a run matches a single process in distribution and
+// matches it exactly with one shard. State keyed by a source or a
+// signature is kept per shard, like separate edge boxes: a source flooding
+// targets on two shards is counted by each of them on its own, and every
+// shard keeps such state for all the network's sources. Routing is not
+// supported, since a packet's intermediate hops belong to other shards.
+//
+// A batch is a header, the magic "DSHB", uint32 time step and uint64
+// packet count, followed by the packets as columns: uint64 orders in the
+// step, int32 source ids and destination ids local to the receiving
+// shard, uint32 signature ids, int64 send and arrival times and the
+// legitimacy words. Shards exchange batches over a mesh of Unix domain
+// socket pairs; the framing carries over to TCP between hosts unchanged.
+//
+// forkScenarios() uses the same process machinery for what-if branches:
+// each branch is a child forked from one warmed-up simulator, running on
+// its own copy-on-write image of it.
+
+// Limits of the packet orders that shards exchange
+constexpr int kMaxShards = 1 << 15;
+constexpr size_t kMaxShardedTargets = 1 << 16;
+
+// A sharded run: the traffic of every step is what generateTraffic() for
+// each of targets in turn would generate in one simulator
+struct ShardedRun {
+    ScenarioParams params;          // targetNodeId is the node built with the target's capacity
+    std::vector<int> targets;       // Nodes attacked every step; empty attacks params.targetNodeId
+    MitigationSet mitigations;
+    std::function<void(NetworkSimulator&)> configure;  // Extra setup in every shard; may be empty
+    uint64_t seed = 1;
+    int numShards = 2;
+};
+
+// What one shard did
+struct ShardReport {
+    int shard = 0;
+    uint64_t packetsGenerated = 0;  // Packets its nodes sent
+    uint64_t packetsSent = 0;       // Of those, packets for other shards' nodes
+    uint64_t packetsReceived = 0;   // Packets from other shards for its nodes
+    uint64_t bytesSent = 0;
+    double generateSeconds = 0;
+    double exchangeSeconds = 0;     // Sending and waiting for the peers' batches
+    double processSeconds = 0;
+    std::vector<double> stepSeconds;    // Wall time of every step
+};
+
+struct ShardedResult {
+    std::vector<StepStats> steps;   // Every step, summed over the shards
+    StepStats totals;
+    LatencyByClass latency;         // Delivery latency over every step and shard
+    std::vector<ShardReport> shards;
+    double seconds = 0;             // Wall time of the run, forking included
+};
+
+// Packets one shard sends another in a step, with their order in the
+// whole step. The first size() entries of the columns hold the batch; the storage
+// only ever grows, so batches of a steady size reuse it without touching
+// the allocator or clearing it again.
+struct ShardBatch {
+    PacketBuffer packets;
+    std::vector<uint64_t> orders;
+
+    size_t size() const { return count; }
+
+    void clear() { count = 0; }
+
+    // Make the batch n packets long, to be filled in place
+    void setSize(size_t n) {
+        reserve(n);
+        count = n;
+    }
+
+    void push(uint64_t order, int sourceId, int destinationId, bool isLegitimate, int64_t sendTime,
+              uint32_t signatureId) {
+        if (count == orders.size()) reserve(std::max<size_t>(1024, 2 * count));
+        if (count % 64 == 0) packets.legitimateBits[count / 64] = 0;
+        packets.set(count, sourceId, destinationId, isLegitimate, sendTime, sendTime, signatureId);
+        orders[count] = order;
+        count++;
+    }
+
+private:
+    void reserve(size_t n) {
+        if (n <= orders.size()) return;
+        n = (n + 63) / 64 * 64;
+        packets.resize(n);
+        orders.resize(n);
+    }
+
+    size_t count = 0;
+};
+
+namespace detail {
+
+static_assert(sizeof(int) == 4, "Shard batches send node ids as 32-bit integers");
+static_assert(std::is_trivially_copyable<StepStats>::value && std::is_trivially_copyable<LatencyByClass>::value,
+              "Shard results are sent as raw bytes between copies of one program");
+
+constexpr char kShardBatchMagic[4] = {'D', 'S', 'H', 'B'};
+
+struct ShardBatchHeader {
+    char magic[4];
+    uint32_t timeStep;
+    uint64_t count;
+};
+
+inline std::runtime_error shardError(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// Scatter/gather list consumed from the front as bytes go through
+class IoCursor {
+public:
+    void clear() {
+        vectors.clear();
+        first = 0;
+    }
+
+    void add(const void* data, size_t bytes) {
+        if (bytes > 0) vectors.push_back(iovec{const_cast<void*>(data), bytes});
+    }
+
+    bool done() const { return first == vectors.size(); }
+    iovec* begin() { return vectors.data() + first; }
+    int count() const { return static_cast<int>(std::min<size_t>(vectors.size() - first, IOV_MAX)); }
+
+    void advance(size_t bytes) {
+        while (bytes > 0) {
+            iovec& vector = vectors[first];
+            size_t taken = std::min(bytes, vector.iov_len);
+            vector.iov_base = static_cast<char*>(vector.iov_base) + taken;
+            vector.iov_len -= taken;
+            bytes -= taken;
+            if (vector.iov_len == 0) first++;
+        }
+    }
+
+private:
+    std::vector<iovec> vectors;
+    size_t first = 0;
+};
+
+template <typename Vector>
+void addColumn(IoCursor& cursor, Vector& column, size_t count) {
+    cursor.add(column.data(), count * sizeof(typename Vector::value_type));
+}
+
+inline void addColumns(IoCursor& cursor, ShardBatch& batch) {
+    size_t n = batch.size();
+    addColumn(cursor, batch.orders, n);
+    addColumn(cursor, batch.packets.sourceIds, n);
+    addColumn(cursor, batch.packets.destinationIds, n);
+    addColumn(cursor, batch.packets.signatureIds, n);
+    addColumn(cursor, batch.packets.timestamps, n);
+    addColumn(cursor, batch.packets.arrivalTimes, n);
+    addColumn(cursor, batch.packets.legitimateBits, (n + 63) / 64);
+}
+
+// One shard's sockets to its peers. exchange() sends a batch to every
+// peer and receives one from each, interleaving both with poll() so that
+// full socket buffers can never deadlock two shards writing to each other.
+class ShardMesh {
+public:
+    ShardMesh(int shard, std::vector<int> peerSockets) :
+        self(shard), sockets(std::move(peerSockets)), links(sockets.size()) {}
+
+    ~ShardMesh() {
+        for (int fd : sockets) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    ShardMesh(const ShardMesh&) = delete;
+    ShardMesh& operator=(const ShardMesh&) = delete;
+
+    // Send outboxes[p] to every peer p and fill inboxes[p] with its batch;
+    // the shard's own slots are left alone. Returns the bytes sent.
+    uint64_t exchange(uint32_t timeStep, std::vector<ShardBatch>& outboxes, std::vector<ShardBatch>& inboxes) {
+        uint64_t bytesSent = 0;
+        for (size_t p = 0; p < links.size(); p++) {
+            if (int(p) == self) continue;
+            Link& link = links[p];
+            std::memcpy(link.outHeader.magic, kShardBatchMagic, sizeof(kShardBatchMagic));
+            link.outHeader.timeStep = timeStep;
+            link.outHeader.count = outboxes[p].size();
+            link.sending.clear();
+            link.sending.add(&link.outHeader, sizeof(link.outHeader));
+            addColumns(link.sending, outboxes[p]);
+            link.receiving.clear();
+            link.receiving.add(&link.inHeader, sizeof(link.inHeader));
+            link.headerReceived = false;
+            bytesSent += sizeof(ShardBatchHeader) + batchBytes(outboxes[p].size());
+        }
+
+        std::vector<pollfd> waiting;
+        std::vector<size_t> peers;
+        for (;;) {
+            waiting.clear();
+            peers.clear();
+            for (size_t p = 0; p < links.size(); p++) {
+                if (int(p) == self) continue;
+                short events = (links[p].sending.done() ? 0 : POLLOUT) | (links[p].receiving.done() ? 0 : POLLIN);
+                if (events == 0) continue;
+                waiting.push_back(pollfd{sockets[p], events, 0});
+                peers.push_back(p);
+            }
+            if (waiting.empty()) return bytesSent;
+            if (::poll(waiting.data(), waiting.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                throw shardError("poll failed");
+            }
+            for (size_t w = 0; w < waiting.size(); w++) {
+                Link& link = links[peers[w]];
+                if (waiting[w].revents & POLLOUT) send(peers[w], link);
+                if (waiting[w].revents & (POLLIN | POLLHUP | POLLERR)) receive(peers[w], link, timeStep, inboxes);
+            }
+        }
+    }
+
+private:
+    struct Link {
+        ShardBatchHeader outHeader{};
+        ShardBatchHeader inHeader{};
+        bool headerReceived = false;
+        IoCursor sending;
+        IoCursor receiving;
+    };
+
+    static size_t batchBytes(size_t n) {
+        return n * (sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(int) + 2 * sizeof(int64_t)) +
+               (n + 63) / 64 * sizeof(uint64_t);
+    }
+
+    void send(size_t peer, Link& link) {
+        msghdr message{};
+        message.msg_iov = link.sending.begin();
+        message.msg_iovlen = link.sending.count();
+        ssize_t sent = ::sendmsg(sockets[peer], &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            throw shardError("Cannot send to shard " + std::to_string(peer));
+        }
+        link.sending.advance(size_t(sent));
+    }
+
+    void receive(size_t peer, Link& link, uint32_t timeStep, std::vector<ShardBatch>& inboxes) {
+        msghdr message{};
+        message.msg_iov = link.receiving.begin();
+        message.msg_iovlen = link.receiving.count();
+        ssize_t received = ::recvmsg(sockets[peer], &message, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+            throw shardError("Cannot receive from shard " + std::to_string(peer));
+        }
+        if (received == 0) {
+            throw std::runtime_error("Shard " + std::to_string(peer) + " closed its connection");
+        }
+        link.receiving.advance(size_t(received));
+        if (link.receiving.done() && !link.headerReceived) {
+            // The header says how large the columns are
+            const ShardBatchHeader& header = link.inHeader;
+            if (std::memcmp(header.magic, kShardBatchMagic, sizeof(kShardBatchMagic)) != 0 ||
+                header.timeStep != timeStep) {
+                throw std::runtime_error("Bad batch from shard " + std::to_string(peer));
+            }
+            link.headerReceived = true;
+            ShardBatch& inbox = inboxes[peer];
+            inbox.setSize(header.count);
+            link.receiving.clear();
+            addColumns(link.receiving, inbox);
+        }
+    }
+
+    int self;
+    std::vector<int> sockets;   // Per peer; -1 for the shard itself
+    std::vector<Link> links;
+};
+
+// Copy packets [begin, end) of from to out, starting at packet at
+inline void copyRun(const PacketBuffer& from, size_t begin, size_t end, PacketBuffer& out, size_t at) {
+    std::copy(from.sourceIds.begin() + begin, from.sourceIds.begin() + end, out.sourceIds.begin() + at);
+    std::copy(from.destinationIds.begin() + begin, from.destinationIds.begin() + end,
+              out.destinationIds.begin() + at);
+    std::copy(from.timestamps.begin() + begin, from.timestamps.begin() + end, out.timestamps.begin() + at);
+    std::copy(from.arrivalTimes.begin() + begin, from.arrivalTimes.begin() + end, out.arrivalTimes.begin() + at);
+    std::copy(from.signatureIds.begin() + begin, from.signatureIds.begin() + end, out.signatureIds.begin() + at);
+    // Legitimacy bits 64 at a time, into a cleared destination
+    const std::vector<uint64_t>& bits = from.legitimateBits;
+    for (size_t i = begin; i < end; i += 64, at += 64) {
+        size_t n = std::min<size_t>(64, end - i);
+        uint64_t word = bits[i / 64] >> (i % 64);
+        if (i % 64 != 0 && i / 64 + 1 < bits.size()) word |= bits[i / 64 + 1] << (64 - i % 64);
+        if (n < 64) word &= (uint64_t(1) << n) - 1;
+        out.legitimateBits[at / 64] |= word << (at % 64);
+        if (at % 64 != 0 && at / 64 + 1 < out.legitimateBits.size()) {
+            out.legitimateBits[at / 64 + 1] |= word >> (64 - at % 64);
+        }
+    }
+}
+
+// Replace out with the packets of the batches, each sorted by order, in
+// order. A shard's packets arrive as long runs from one batch, so the runs
+// are copied a column at a time.
+inline void mergeByOrder(const std::vector<const ShardBatch*>& batches, PacketBuffer& out) {
+    size_t total = 0;
+    for (const ShardBatch* batch : batches) total += batch->size();
+    out.resize(total);
+    std::fill(out.legitimateBits.begin(), out.legitimateBits.end(), 0);
+    std::vector<size_t> next(batches.size(), 0);
+    size_t at = 0;
+    for (;;) {
+        size_t from = batches.size();
+        uint64_t lowest = UINT64_MAX;
+        uint64_t second = UINT64_MAX;   // Lowest head of the other batches
+        for (size_t b = 0; b < batches.size(); b++) {
+            if (next[b] == batches[b]->size()) continue;
+            uint64_t head = batches[b]->orders[next[b]];
+            if (head < lowest) {
+                second = lowest;
+                lowest = head;
+                from = b;
+            } else if (head < second) {
+                second = head;
+            }
+        }
+        if (from == batches.size()) return;
+        const ShardBatch& batch = *batches[from];
+        size_t begin = next[from];
+        auto orders = batch.orders.begin();
+        size_t end = std::lower_bound(orders + begin, orders + batch.size(), second) - orders;
+        copyRun(batch.packets, begin, end, out, at);
+        at += end - begin;
+        next[from] = end;
+    }
+}
+
+// Byte buffer for a shard's result, read back by the parent
+class ResultWriter {
+public:
+    template <typename T>
+    void put(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain values are written");
+        const char* data = reinterpret_cast<const char*>(&value);
+        bytes.insert(bytes.end(), data, data + sizeof(T));
+    }
+
+    void putString(const std::string& text) {
+        put(uint32_t(text.size()));
+        bytes.insert(bytes.end(), text.begin(), text.end());
+    }
+
+    // Write everything to fd, blocking; false if the parent went away
+    bool writeTo(int fd) const {
+        size_t offset = 0;
+        while (offset < bytes.size()) {
+            ssize_t written = ::send(fd, bytes.data() + offset, bytes.size() - offset, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            offset += size_t(written);
+        }
+        return true;
+    }
+
+private:
+    std::vector<char> bytes;
+};
+
+// Read from the result link of a child process named process, e.g. "Shard 2"
+inline void readExactly(int fd, void* data, size_t size, const std::string& process) {
+    char* out = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = ::recv(fd, out, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) {
+            throw std::runtime_error(process + " exited without a result");
+        }
+        out += received;
+        size -= size_t(received);
+    }
+}
+
+template <typename T>
+T readValue(int fd, const std::string& process) {
+    T value;
+    readExactly(fd, &value, sizeof(T), process);
+    return value;
+}
+
+// Read the error a child reports instead of its result, if any, and throw it
+inline void readStatus(int fd, const std::string& process) {
+    if (readValue<uint32_t>(fd, process) != 0) {
+        std::string what(readValue<uint32_t>(fd, process), '\0');
+        readExactly(fd, &what[0], what.size(), process);
+        throw std::runtime_error(process + ": " + what);
+    }
+}
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Body of one shard process: simulate every step and write the result
+inline void runShard(const ShardedRun& run, const std::vector<int>& targets, int shard, ShardMesh& mesh,
+                     ResultWriter& result) {
+    using Clock = std::chrono::steady_clock;
+    const ScenarioParams& params = run.params;
+    int numShards = run.numShards;
+    NetworkConfig config;
+    config.shard = NodeShard{shard, numShards};
+    NetworkSimulator simulator(params.numNodes, params.targetNodeId, params.numAttackers, run.seed, config);
+    simulator.enableConsoleOutput(false);
+    run.mitigations.applyTo(simulator);
+    if (run.configure) run.configure(simulator);
+
+    ShardReport report;
+    report.shard = shard;
+    std::vector<StepStats> steps;
+    std::vector<ShardBatch> outboxes(numShards);
+    std::vector<ShardBatch> inboxes(numShards);
+    std::vector<const ShardBatch*> arrived;
+    PacketBuffer stepTraffic;
+    for (int step = 0; step < params.steps; step++) {
+        Clock::time_point start = Clock::now();
+        for (auto& outbox : outboxes) outbox.clear();
+        simulator.generateShardTraffic(targets, params.attackIntensity, params.legitimateTraffic,
+            [&](uint64_t order, int sourceId, int destinationId, bool isLegitimate, int64_t sendTime,
+                uint32_t signatureId) {
+                outboxes[destinationId % numShards].push(order, sourceId, destinationId / numShards, isLegitimate,
+                                                         sendTime, signatureId);
+            });
+        Clock::time_point generated = Clock::now();
+
+        report.bytesSent += mesh.exchange(static_cast<uint32_t>(step), outboxes, inboxes);
+        Clock::time_point exchanged = Clock::now();
+
+        arrived.clear();
+        for (int p = 0; p < numShards; p++) {
+            const ShardBatch& batch = p == shard ? outboxes[p] : inboxes[p];
+            arrived.push_back(&batch);
+            report.packetsGenerated += outboxes[p].size();
+            if (p != shard) {
+                report.packetsSent += outboxes[p].size();
+                report.packetsReceived += inboxes[p].size();
+            }
+        }
+        mergeByOrder(arrived, stepTraffic);
+        simulator.processTraffic(stepTraffic);
+        steps.push_back(simulator.lastStepStats());
+        Clock::time_point processed = Clock::now();
+
+        report.generateSeconds += std::chrono::duration<double>(generated - start).count();
+        report.exchangeSeconds += std::chrono::duration<double>(exchanged - generated).count();
+        report.processSeconds += std::chrono::duration<double>(processed - exchanged).count();
+        report.stepSeconds.push_back(std::chrono::duration<double>(processed - start).count());
+    }
+
+    LatencyByClass latency;
+    for (int c = 0; c < kNumTrafficClasses; c++) {
+        latency[c] = simulator.totalLatency(static_cast<TrafficClass>(c));
+    }
+    result.put(uint32_t(0));
+    result.put(uint32_t(steps.size()));
+    for (const auto& stats : steps) result.put(stats);
+    result.put(latency);
+    result.put(report.packetsGenerated);
+    result.put(report.packetsSent);
+    result.put(report.packetsReceived);
+    result.put(report.bytesSent);
+    result.put(report.generateSeconds);
+    result.put(report.exchangeSeconds);
+    result.put(report.processSeconds);
+    for (double seconds : report.stepSeconds) result.put(seconds);
+}
+
+// Read a shard's result into result; throws with the shard's error if it failed
+inline void readShardResult(int fd, int shard, ShardedResult& result) {
+    std::string process = "Shard " + std::to_string(shard);
+    readStatus(fd, process);
+    uint32_t numSteps = readValue<uint32_t>(fd, process);
+    result.steps.resize(std::max<size_t>(result.steps.size(), numSteps));
+    for (uint32_t s = 0; s < numSteps; s++) {
+        result.steps[s].merge(readValue<StepStats>(fd, process));
+    }
+    result.latency.merge(readValue<LatencyByClass>(fd, process));
+    ShardReport report;
+    report.shard = shard;
+    report.packetsGenerated = readValue<uint64_t>(fd, process);
+    report.packetsSent = readValue<uint64_t>(fd, process);
+    report.packetsReceived = readValue<uint64_t>(fd, process);
+    report.bytesSent = readValue<uint64_t>(fd, process);
+    report.generateSeconds = readValue<double>(fd, process);
+    report.exchangeSeconds = readValue<double>(fd, process);
+    report.processSeconds = readValue<double>(fd, process);
+    report.stepSeconds.resize(numSteps);
+    for (auto& seconds : report.stepSeconds) seconds = readValue<double>(fd, process);
+    result.shards.push_back(std::move(report));
+}
+
+// Body of a branch process: run the branch on the process's copy of the
+// warmed simulator. Nothing writes to the caller's output or exporters.
+inline void runBranch(NetworkSimulator& simulator, const Scenario& branch, ResultWriter& result) {
+    auto start = std::chrono::steady_clock::now();
+    simulator.enableConsoleOutput(false);
+    simulator.setMetricsExporter(nullptr);
+    simulator.setTraceRecorder(nullptr);
+    ScenarioResult branchResult;
+    ScenarioMatrix::runSteps(simulator, branch, nullptr, branchResult);
+    result.put(uint32_t(0));
+    result.put(simulator.seed());
+    result.put(uint32_t(branchResult.steps.size()));
+    for (const auto& stats : branchResult.steps) result.put(stats);
+    result.put(branchResult.latency);
+    result.put(secondsSince(start));
+}
+
+inline void readBranchResult(int fd, size_t branch, ScenarioResult& result) {
+    std::string process = "Branch " + std::to_string(branch);
+    readStatus(fd, process);
+    result.seed = readValue<uint64_t>(fd, process);
+    result.steps.resize(readValue<uint32_t>(fd, process));
+    for (auto& stats : result.steps) {
+        stats = readValue<StepStats>(fd, process);
+        result.totals.merge(stats);
+    }
+    result.latency = readValue<LatencyByClass>(fd, process);
+    result.seconds = readValue<double>(fd, process);
+}
+
+}  // namespace detail
+
+// Run a network split across run.numShards forked processes and reduce
+// their results. The calling process only forks and collects, so no other
+// thread of it should be running; shards may start worker threads of
+// their own in run.configure. Throws std::invalid_argument for a bad run
+// and std::runtime_error if a shard fails.
+inline ShardedResult runSharded(const ShardedRun& run) {
+    const ScenarioParams& params = run.params;
+    std::vector<int> targets = run.targets.empty() ? std::vector<int>{params.targetNodeId} : run.targets;
+    if (run.numShards < 1 || run.numShards > kMaxShards) {
+        throw std::invalid_argument("A sharded run needs 1 to " + std::to_string(kMaxShards) + " shards");
+    }
+    if (targets.size() > kMaxShardedTargets) {
+        throw std::invalid_argument("A sharded run attacks at most " + std::to_string(kMaxShardedTargets) +
+                                    " targets");
+    }
+    for (int target : targets) {
+        if (target < 0 || target >= params.numNodes) {
+            throw std::invalid_argument("Target " + std::to_string(target) + " is not a node");
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    int numShards = run.numShards;
+
+    // sockets[i][j] is shard i's end of its link to shard j; results[i]
+    // holds the parent's and shard i's ends of its result link
+    std::vector<std::vector<int>> sockets(numShards, std::vector<int>(numShards, -1));
+    std::vector<std::array<int, 2>> results(numShards, std::array<int, 2>{-1, -1});
+    auto closeAll = [&]() {
+        for (auto& row : sockets) {
+            for (int& fd : row) {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+        }
+        for (auto& pair : results) {
+            for (int& fd : pair) {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+        }
+    };
+    for (int i = 0; i < numShards; i++) {
+        int pair[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            closeAll();
+            throw detail::shardError("Cannot create shard sockets");
+        }
+        results[i] = {pair[0], pair[1]};
+        for (int j = i + 1; j < numShards; j++) {
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                closeAll();
+                throw detail::shardError("Cannot create shard sockets");
+            }
+            sockets[i][j] = pair[0];
+            sockets[j][i] = pair[1];
+        }
+    }
+
+    // Buffered output would otherwise be written once per process
+    std::fflush(nullptr);
+    std::vector<pid_t> children;
+    for (int shard = 0; shard < numShards; shard++) {
+        pid_t pid = ::fork();
+        if (pid < 0) {
+            int error = errno;
+            closeAll();
+            for (pid_t child : children) {
+                ::kill(child, SIGKILL);
+                ::waitpid(child, nullptr, 0);
+            }
+            errno = error;
+            throw detail::shardError("Cannot fork shard " + std::to_string(shard));
+        }
+        if (pid == 0) {
+            // Keep only this shard's sockets, so a shard that dies is seen
+            // as a closed connection by everyone else
+            int resultFd = results[shard][1];
+            results[shard][1] = -1;
+            std::vector<int> mine = sockets[shard];
+            std::fill(sockets[shard].begin(), sockets[shard].end(), -1);
+            closeAll();
+            detail::ResultWriter result;
+            int status = 0;
+            try {
+                detail::ShardMesh mesh(shard, mine);
+                detail::runShard(run, targets, shard, mesh, result);
+            } catch (const std::exception& e) {
+                result = detail::ResultWriter();
+                result.put(uint32_t(1));
+                result.putString(e.what());
+                status = 1;
+            }
+            if (!result.writeTo(resultFd)) status = 1;
+            ::close(resultFd);
+            ::_exit(status);
+        }
+        children.push_back(pid);
+    }
+
+    // The parent keeps only its ends of the result links
+    std::vector<int> resultFds;
+    for (auto& pair : results) {
+        resultFds.push_back(pair[0]);
+        pair[0] = -1;
+    }
+    closeAll();
+    ShardedResult result;
+    std::string failure;
+    for (int shard = 0; shard < numShards; shard++) {
+        try {
+            detail::readShardResult(resultFds[shard], shard, result);
+        } catch (const std::exception& e) {
+            if (failure.empty()) failure = e.what();
+        }
+        ::close(resultFds[shard]);
+    }
+    for (pid_t child : children) {
+        ::waitpid(child, nullptr, 0);
+    }
+    if (!failure.empty()) {
+        throw std::runtime_error(failure);
+    }
+    for (const auto& stats : result.steps) {
+        result.totals.merge(stats);
+    }
+    result.seconds = detail::secondsSince(start);
+    return result;
+}
+
+// Run what-if branches off a warmed-up simulator, each in a process forked
+// from the caller, at most maxProcesses at a time. A branch starts from a
+// copy-on-write image of warmed, so starting one costs a fork rather than
+// a rebuild or a restore, and memory is only copied as the branch writes
+// to it. Each branch applies its mitigations and configure, then runs
+// params.steps steps of params' traffic from warmed's time step; the
+// network size fields of params are ignored. warmed itself is untouched.
+// Results come back in branch order with warmed's seed; their seconds are
+// the branch's own run time and their latency covers the branch's steps.
+// warmed must not own worker or generator threads, which a forked copy
+// would lack, and no other thread of the caller should be running. Throws
+// std::invalid_argument if warmed owns threads and std::runtime_error if a
+// branch fails.
+inline std::vector<ScenarioResult> forkScenarios(NetworkSimulator& warmed, const std::vector<Scenario>& branches,
+                                                 size_t maxProcesses = ScenarioMatrix::defaultThreads()) {
+    if (warmed.ownsThreads()) {
+        throw std::invalid_argument("Cannot fork branches of a simulator with worker or generator threads");
+    }
+    std::vector<ScenarioResult> results(branches.size());
+    size_t wave = std::max<size_t>(1, maxProcesses);
+    std::string failure;
+    for (size_t first = 0; first < branches.size() && failure.empty(); first += wave) {
+        size_t last = std::min(branches.size(), first + wave);
+        std::vector<int> resultFds;
+        std::vector<pid_t> children;
+        auto abandon = [&](const std::string& what) {
+            int error = errno;
+            for (int fd : resultFds) ::close(fd);
+            for (pid_t child : children) {
+                ::kill(child, SIGKILL);
+                ::waitpid(child, nullptr, 0);
+            }
+            errno = error;
+            return detail::shardError(what);
+        };
+
+        // Buffered output would otherwise be written once per process
+        std::fflush(nullptr);
+        for (size_t b = first; b < last; b++) {
+            int pair[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                throw abandon("Cannot create branch sockets");
+            }
+            pid_t pid = ::fork();
+            if (pid < 0) {
+                ::close(pair[0]);
+                ::close(pair[1]);
+                throw abandon("Cannot fork branch " + std::to_string(b));
+            }
+            if (pid == 0) {
+                ::close(pair[0]);
+                for (int fd : resultFds) ::close(fd);
+                detail::ResultWriter result;
+                int status = 0;
+                try {
+                    detail::runBranch(warmed, branches[b], result);
+                } catch (const std::exception& e) {
+                    result = detail::ResultWriter();
+                    result.put(uint32_t(1));
+                    result.putString(e.what());
+                    status = 1;
+                }
+                if (!result.writeTo(pair[1])) status = 1;
+                ::close(pair[1]);
+                ::_exit(status);
+            }
+            ::close(pair[1]);
+            resultFds.push_back(pair[0]);
+            children.push_back(pid);
+        }
+
+        for (size_t b = first; b < last; b++) {
+            results[b].scenario = branches[b];
+            try {
+                detail::readBranchResult(resultFds[b - first], b, results[b]);
+            } catch (const std::exception& e) {
+                if (failure.empty()) failure = e.what();
+            }
+            ::close(resultFds[b - first]);
+        }
+        for (pid_t child : children) {
+            ::waitpid(child, nullptr, 0);
+        }
+    }
+    if (!failure.empty()) {
+        throw std::runtime_error(failure);
+    }
+    return results;
+}
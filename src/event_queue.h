@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Simulated time is kept in microseconds; one simulation step spans a second
+constexpr int64_t kMicrosPerStep = 1000000;
+
+// Calendar queue for timestamped simulation events.
+// Time is divided into buckets of `bucketWidth` microseconds laid out on a
+// ring that covers numBuckets * bucketWidth of the future. Inserting is an
+// append to the bucket for the event's time, and a bucket is only sorted
+// when the clock reaches it, so the cost per event does not grow with the
+// number pending the way a binary heap's does. Events beyond the ring's
+// horizon wait in a small heap until the ring reaches them.
+//
+// Buckets are linked lists threaded through one shared pool of entries,
+// and popped entries go back on the pool's free list. The pool only grows
+// when more events are pending than ever before, so a simulation whose
+// traffic has levelled off schedules without allocating.
+//
+// Events come out in time order; events with equal times come out in the
+// order they were pushed, which keeps runs reproducible.
+template <typename T>
+class CalendarQueue {
+public:
+    explicit CalendarQueue(int64_t bucketWidth = 64, size_t numBuckets = size_t(1) << 15) :
+        buckets(numBuckets), width(bucketWidth), mask(numBuckets - 1),
+        cursor(0), inBuckets(0), nextSequence(0), freeHead(kEnd) {}
+
+    size_t size() const { return inBuckets + overflow.size(); }
+    bool empty() const { return size() == 0; }
+
+    // Room for n events pending in the ring at once, so pushing and popping
+    // up to that many does not allocate. Capacity at least doubles when it
+    // grows, keeping a slowly rising count amortized.
+    void reserve(size_t n) {
+        if (pool.capacity() >= n) return;
+        n = std::max(n, 2 * pool.capacity());
+        pool.reserve(n);
+        links.reserve(n);
+        order.reserve(n);
+    }
+
+    void push(int64_t time, const T& value) {
+        Entry entry{time, nextSequence++, value};
+        int64_t bucket = std::max(bucketOf(time), cursor);  // Late events join the current bucket
+        if (bucket < cursor + static_cast<int64_t>(buckets.size())) {
+            append(buckets[bucket & mask], entry);
+        } else {
+            overflow.push_back(entry);
+            std::push_heap(overflow.begin(), overflow.end(), Later());
+        }
+    }
+
+    // Pass every event with time < limit to sink(time, value), in order
+    template <typename Sink>
+    void popUntil(int64_t limit, Sink sink) {
+        int64_t limitBucket = bucketOf(limit);
+        for (;;) {
+            admitOverflow();
+            if (inBuckets == 0) {
+                // Nothing in the ring: jump straight to the limit or the next far event
+                int64_t next = overflow.empty() ? limitBucket
+                             : bucketOf(overflow.front().time) - static_cast<int64_t>(buckets.size()) + 1;
+                int64_t target = std::min(limitBucket, next);
+                if (target <= cursor) return;
+                cursor = target;
+                continue;
+            }
+
+            Bucket& bucket = buckets[cursor & mask];
+            if (bucket.head != kEnd) {
+                // Unlink the bucket's entries into a reusable list of indices
+                order.clear();
+                for (uint32_t i = bucket.head; i != kEnd; i = links[i]) order.push_back(i);
+                bucket = Bucket();
+                auto earlier = [this](uint32_t a, uint32_t b) { return Earlier()(pool[a], pool[b]); };
+                if (!std::is_sorted(order.begin(), order.end(), earlier)) {
+                    std::sort(order.begin(), order.end(), earlier);
+                }
+                size_t emitted = 0;
+                while (emitted < order.size() && pool[order[emitted]].time < limit) {
+                    Entry entry = pool[order[emitted]];  // The sink may push and grow the pool
+                    release(order[emitted++]);
+                    sink(entry.time, entry.value);
+                }
+                // Relink what is left, in order, ahead of anything the sink pushed
+                for (size_t k = order.size(); k > emitted; k--) {
+                    uint32_t i = order[k - 1];
+                    links[i] = bucket.head;
+                    bucket.head = i;
+                    if (bucket.tail == kEnd) bucket.tail = i;
+                }
+                inBuckets -= emitted;
+                if (bucket.head != kEnd) return;    // The rest is at or after the limit
+            }
+            if (cursor >= limitBucket) return;
+            cursor++;
+        }
+    }
+
+    // The ring, pool and overflow as they stand, so a restored queue pops
+    // the same events in the same order
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(buckets, pool, links, overflow, width, mask, cursor, inBuckets, nextSequence, freeHead);
+    }
+
+private:
+    static constexpr uint32_t kEnd = UINT32_MAX;
+
+    struct Entry {
+        int64_t time;
+        uint64_t sequence;
+        T value;
+    };
+
+    // First and last pool index of a bucket's list, kEnd when empty
+    struct Bucket {
+        uint32_t head = kEnd;
+        uint32_t tail = kEnd;
+    };
+
+    // Push order breaks ties, so an in-place sort keeps equal times stable
+    // without the buffer std::stable_sort allocates
+    struct Earlier {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.time != b.time ? a.time < b.time : a.sequence < b.sequence;
+        }
+    };
+
+    // Heap order for the overflow: earliest (time, sequence) on top
+    struct Later {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+        }
+    };
+
+    int64_t bucketOf(int64_t time) const { return time / width; }
+
+    // Store entry in a free pool slot at the end of bucket's list
+    void append(Bucket& bucket, const Entry& entry) {
+        uint32_t i;
+        if (freeHead != kEnd) {
+            i = freeHead;
+            freeHead = links[i];
+            pool[i] = entry;
+        } else {
+            i = static_cast<uint32_t>(pool.size());
+            pool.push_back(entry);
+            links.push_back(kEnd);
+        }
+        links[i] = kEnd;
+        if (bucket.tail == kEnd) {
+            bucket.head = i;
+        } else {
+            links[bucket.tail] = i;
+        }
+        bucket.tail = i;
+        inBuckets++;
+    }
+
+    void release(uint32_t i) {
+        links[i] = freeHead;
+        freeHead = i;
+    }
+
+    // Move far events that the advancing ring now covers into their buckets
+    void admitOverflow() {
+        int64_t horizon = cursor + static_cast<int64_t>(buckets.size());
+        while (!overflow.empty() && bucketOf(overflow.front().time) < horizon) {
+            std::pop_heap(overflow.begin(), overflow.end(), Later());
+            Entry entry = overflow.back();
+            overflow.pop_back();
+            append(buckets[std::max(bucketOf(entry.time), cursor) & mask], entry);
+        }
+    }
+
+    std::vector<Bucket> buckets;
+    std::vector<Entry> pool;        // Entries of every bucket's list
+    std::vector<uint32_t> links;    // Next pool index in the same list, or kEnd
+    std::vector<uint32_t> order;    // Scratch: the bucket being popped
+    std::vector<Entry> overflow;
+    int64_t width;
+    size_t mask;
+    int64_t cursor;         // Bucket number the clock is in
+    size_t inBuckets;
+    uint64_t nextSequence;
+    uint32_t freeHead;      // First free pool slot, or kEnd
+};
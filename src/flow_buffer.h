@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Columnar store of traffic flows for the aggregate simulation mode.
+// A flow stands for `count` packets with the same source, destination,
+// signature and timestamp, listed in the order the packets would have been
+// generated. Like PacketBuffer, clear() keeps the storage for the next step.
+class FlowBuffer {
+public:
+    std::vector<int> sourceIds;
+    std::vector<int> destinationIds;
+    std::vector<int64_t> timestamps;    // Microseconds of simulated time
+    std::vector<uint32_t> signatureIds;
+    std::vector<int> counts;
+    std::vector<uint8_t> legitimate;
+
+    size_t size() const { return sourceIds.size(); }
+    bool empty() const { return sourceIds.empty(); }
+
+    void clear() {
+        sourceIds.clear();
+        destinationIds.clear();
+        timestamps.clear();
+        signatureIds.clear();
+        counts.clear();
+        legitimate.clear();
+    }
+
+    void push(int src, int dst, bool isLegitimate, int64_t time, uint32_t signatureId, int count) {
+        sourceIds.push_back(src);
+        destinationIds.push_back(dst);
+        timestamps.push_back(time);
+        signatureIds.push_back(signatureId);
+        counts.push_back(count);
+        legitimate.push_back(isLegitimate ? 1 : 0);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(sourceIds, destinationIds, timestamps, signatureIds, counts, legitimate);
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+// Log-linear histogram of non-negative integer values, such as latencies in
+// microseconds, in the style of HdrHistogram.
+//
+// Values below 2 * kSubBuckets get a bucket each. Above that every power of
+// two is split into kSubBuckets equal buckets, so a value is known to within
+// 1/kSubBuckets of itself however large it is. Recording is a shift and an
+// increment. The buckets in use are tracked, so clearing and merging only
+// touch the range that holds data.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 5;
+    static constexpr int64_t kSubBuckets = int64_t(1) << kSubBucketBits;
+    static constexpr int kMaxValueBits = 40;        // Larger values are clamped, about 12 days in µs
+    static constexpr size_t kNumBuckets = size_t(kMaxValueBits - kSubBucketBits + 1) << kSubBucketBits;
+
+    LatencyHistogram() : counts{}, total(0), lowest(kNumBuckets), highest(0), largest(0) {}
+
+    void record(int64_t value, uint64_t count = 1) {
+        value = std::max<int64_t>(0, std::min(value, (int64_t(1) << kMaxValueBits) - 1));
+        size_t bucket = bucketOf(value);
+        counts[bucket] += count;
+        total += count;
+        lowest = std::min(lowest, bucket);
+        highest = std::max(highest, bucket);
+        largest = std::max(largest, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t b = other.lowest; b <= other.highest && b < kNumBuckets; b++) {
+            counts[b] += other.counts[b];
+        }
+        total += other.total;
+        lowest = std::min(lowest, other.lowest);
+        highest = std::max(highest, other.highest);
+        largest = std::max(largest, other.largest);
+    }
+
+    void clear() {
+        if (total == 0) return;
+        std::fill(counts.begin() + lowest, counts.begin() + highest + 1, 0);
+        total = 0;
+        lowest = kNumBuckets;
+        highest = 0;
+        largest = 0;
+    }
+
+    uint64_t count() const { return total; }
+    bool empty() const { return total == 0; }
+    int64_t max() const { return largest; }
+
+    // Smallest recorded value v such that at least percent% of the values
+    // are <= v, reported as the top of its bucket; 0 when empty
+    int64_t percentile(double percent) const {
+        if (total == 0) return 0;
+        double wanted = std::max(1.0, std::min(100.0, percent) / 100.0 * double(total));
+        uint64_t seen = 0;
+        for (size_t b = lowest; b <= highest; b++) {
+            seen += counts[b];
+            if (double(seen) >= wanted) return std::min(largest, highestIn(b));
+        }
+        return largest;
+    }
+
+    // Only the buckets in use are stored
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        if constexpr (Archive::kLoading) clear();
+        archive(total, lowest, highest, largest);
+        if (lowest > highest || highest >= kNumBuckets) {
+            if (total != 0) throw std::runtime_error("Snapshot holds a histogram without buckets");
+            return;
+        }
+        archive.raw(&counts[lowest], highest - lowest + 1);
+    }
+
+private:
+    // Values below 2 * kSubBuckets map to themselves; above, the top
+    // kSubBucketBits + 1 bits pick the bucket within the value's power of two
+    static size_t bucketOf(int64_t value) {
+        int shift = 0;
+        if (value >= 2 * kSubBuckets) {
+            int bits = 63 - __builtin_clzll(static_cast<unsigned long long>(value));
+            shift = bits - kSubBucketBits;
+        }
+        return (size_t(shift) << kSubBucketBits) + size_t(value >> shift);
+    }
+
+    static int64_t highestIn(size_t bucket) {
+        if (bucket < size_t(2 * kSubBuckets)) return int64_t(bucket);
+        int shift = int(bucket >> kSubBucketBits) - 1;
+        int64_t mantissa = int64_t(bucket) - (int64_t(shift) << kSubBucketBits);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::array<uint64_t, kNumBuckets> counts;
+    uint64_t total;
+    size_t lowest;      // Range of buckets that may be non-zero
+    size_t highest;
+    int64_t largest;
+};
+
+// Traffic classes that latency is kept for
+enum TrafficClass : int {
+    kLegitimateClass,
+    kAttackClass,
+    kNumTrafficClasses
+};
+
+inline const char* trafficClassName(int trafficClass) {
+    static const char* const kNames[kNumTrafficClasses] = {"legitimate", "attack"};
+    return kNames[trafficClass];
+}
+
+// One histogram per traffic class
+struct LatencyByClass {
+    LatencyHistogram classes[kNumTrafficClasses];
+
+    LatencyHistogram& operator[](int trafficClass) { return classes[trafficClass]; }
+    const LatencyHistogram& operator[](int trafficClass) const { return classes[trafficClass]; }
+
+    void record(bool isLegitimate, int64_t value, uint64_t count = 1) {
+        classes[isLegitimate ? kLegitimateClass : kAttackClass].record(value, count);
+    }
+
+    void merge(const LatencyByClass& other) {
+        for (int c = 0; c < kNumTrafficClasses; c++) classes[c].merge(other.classes[c]);
+    }
+
+    void clear() {
+        for (auto& histogram : classes) histogram.clear();
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        for (auto& histogram : classes) archive(histogram);
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// How a node's ingress queue chooses what to drop and what to serve next
+enum class QueueDiscipline {
+    DropTail,   // FIFO; arrivals are dropped while the queue is full
+    RED,        // FIFO with random early drops as the average length grows
+    Fair,       // Sources hashed into buckets served round robin, each capped at its share
+};
+
+struct IngressQueueConfig {
+    QueueDiscipline discipline = QueueDiscipline::DropTail;
+    int limit = 100;            // Packets a queue holds, the one being served included
+    int drainRate = 0;          // Packets per step a node serves; 0 uses its capacity
+
+    // RED thresholds on the average length, as fractions of the limit
+    double redMinThreshold = 0.25;
+    double redMaxThreshold = 0.75;
+    double redMaxProbability = 0.1; // Drop probability as the average reaches the max threshold
+    double redWeight = 0.002;       // Weight of each arrival in the moving average
+
+    int fairBuckets = 256;      // Source buckets of the fair discipline
+};
+
+struct QueuedPacket {
+    int64_t arrivalTime;
+    int64_t sendTime;
+    int sourceId;
+    bool isLegitimate;
+};
+
+// Bounded queue in front of a node, served at a fixed rate.
+//
+// The node serves one packet every kMicrosPerStep / drainRate microseconds
+// of simulated time. Arrivals must be offered in time order; before each
+// one the queue serves whatever finishes by then, and advance() serves up
+// to a given time, e.g. the end of a step, so packets left over wait into
+// the next step. Every packet is enqueued and served once, so the cost per
+// packet is O(1).
+//
+// Entries live in one pool sized to the limit and are linked into FIFO
+// lists: one list for drop-tail and RED, one per source bucket for fair
+// queueing. Nothing is allocated once the queue is configured.
+class IngressQueue {
+public:
+    bool configured() const { return !pool.empty(); }
+
+    void configure(const IngressQueueConfig& queueConfig, int drainRate, int64_t microsPerStep) {
+        config = queueConfig;
+        config.limit = std::max(1, config.limit);
+        serviceMicros = std::max<int64_t>(1, microsPerStep / std::max(1, drainRate));
+        size_t numBuckets = config.discipline == QueueDiscipline::Fair ? std::max(1, config.fairBuckets) : 1;
+        pool.assign(config.limit, QueuedPacket());
+        links.assign(config.limit, kEnd);
+        for (int i = 0; i + 1 < config.limit; i++) {
+            links[i] = i + 1;
+        }
+        freeHead = 0;
+        buckets.assign(numBuckets, Bucket());
+        activeRing.assign(numBuckets, 0);
+        activeFront = 0;
+        activeCount = 0;
+        queued = 0;
+        busy = false;
+        freeAt = 0;
+        clock = 0;
+        average = 0;
+        sinceDrop = 0;
+    }
+
+    // Packets waiting or in service
+    size_t size() const { return queued + (busy ? 1 : 0); }
+
+    // Serve every packet that finishes by time, calling
+    // served(packet, departureTime) for each in the order they leave
+    template <typename Served>
+    void advance(int64_t time, Served served) {
+        while (busy && current.departure <= time) {
+            QueuedPacket packet = current.packet;
+            int64_t departure = current.departure;
+            busy = false;
+            freeAt = departure;
+            startNext();
+            served(packet, departure);
+        }
+        clock = std::max(clock, time);
+    }
+
+    // Offer a packet arriving at its arrivalTime, serving first what
+    // finishes by then. uniform is a draw from [0, 1) that RED uses for its
+    // early drops. Returns false if the packet is dropped.
+    template <typename Served>
+    bool offer(const QueuedPacket& arriving, double uniform, Served served) {
+        QueuedPacket packet = arriving;
+        packet.arrivalTime = std::max(packet.arrivalTime, clock);   // Late arrivals wait for the clock
+        advance(packet.arrivalTime, served);
+        if (!admit(packet, uniform)) {
+            return false;
+        }
+        if (!busy) {
+            // An idle server takes the packet straight away
+            serve(packet);
+            return true;
+        }
+        Bucket& bucket = buckets[bucketOf(packet.sourceId)];
+        uint32_t i = freeHead;
+        freeHead = links[i];
+        pool[i] = packet;
+        links[i] = kEnd;
+        if (bucket.tail == kEnd) {
+            bucket.head = i;
+            activeRing[(activeFront + activeCount++) % activeRing.size()] = uint32_t(&bucket - buckets.data());
+        } else {
+            links[bucket.tail] = i;
+        }
+        bucket.tail = i;
+        bucket.length++;
+        queued++;
+        return true;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(config, serviceMicros, pool, links, freeHead, buckets, activeRing, activeFront, activeCount, queued,
+                busy, current, freeAt, clock, average, sinceDrop);
+    }
+
+private:
+    static constexpr uint32_t kEnd = UINT32_MAX;
+
+    struct Bucket {
+        uint32_t head = kEnd;
+        uint32_t tail = kEnd;
+        uint32_t length = 0;
+    };
+
+    struct InService {
+        QueuedPacket packet;
+        int64_t departure;
+    };
+
+    size_t bucketOf(int sourceId) const {
+        return buckets.size() == 1 ? 0 : (uint32_t(sourceId) * 2654435761u) % buckets.size();
+    }
+
+    // Whether the discipline lets the packet in
+    bool admit(const QueuedPacket& packet, double uniform) {
+        if (size() >= size_t(config.limit)) return false;
+        switch (config.discipline) {
+            case QueueDiscipline::DropTail:
+                return true;
+            case QueueDiscipline::RED:
+                return redAdmit(packet.arrivalTime, uniform);
+            case QueueDiscipline::Fair: {
+                // A bucket may hold its share of the limit among the active ones
+                const Bucket& bucket = buckets[bucketOf(packet.sourceId)];
+                size_t active = activeCount + (bucket.length == 0 ? 1 : 0);
+                return bucket.length < std::max<size_t>(1, config.limit / active);
+            }
+        }
+        return true;
+    }
+
+    // Classic RED: early drops spaced out by the count since the last one
+    bool redAdmit(int64_t time, double uniform) {
+        if (size() == 0 && time > freeAt) {
+            // The average decays while the queue sits empty
+            average *= std::pow(1.0 - config.redWeight, double(time - freeAt) / double(serviceMicros));
+        }
+        average += config.redWeight * (double(size()) - average);
+        double minThreshold = config.redMinThreshold * config.limit;
+        double maxThreshold = config.redMaxThreshold * config.limit;
+        if (average < minThreshold) {
+            sinceDrop = 0;
+            return true;
+        }
+        if (average >= maxThreshold) {
+            sinceDrop = 0;
+            return false;
+        }
+        double probability = config.redMaxProbability * (average - minThreshold) / (maxThreshold - minThreshold);
+        double spaced = probability * sinceDrop < 1.0 ? probability / (1.0 - probability * sinceDrop) : 1.0;
+        if (uniform < spaced) {
+            sinceDrop = 0;
+            return false;
+        }
+        sinceDrop++;
+        return true;
+    }
+
+    void serve(const QueuedPacket& packet) {
+        current.packet = packet;
+        current.departure = std::max(packet.arrivalTime, freeAt) + serviceMicros;
+        busy = true;
+    }
+
+    // Move the next waiting packet, round robin over the active buckets, into service
+    void startNext() {
+        if (activeCount == 0) return;
+        uint32_t b = activeRing[activeFront];
+        activeFront = (activeFront + 1) % activeRing.size();
+        activeCount--;
+        Bucket& bucket = buckets[b];
+        uint32_t i = bucket.head;
+        bucket.head = links[i];
+        if (bucket.head == kEnd) {
+            bucket.tail = kEnd;
+        } else {
+            activeRing[(activeFront + activeCount++) % activeRing.size()] = b;  // Back of the round
+        }
+        bucket.length--;
+        queued--;
+        serve(pool[i]);
+        links[i] = freeHead;
+        freeHead = i;
+    }
+
+    IngressQueueConfig config;
+    int64_t serviceMicros = 1;
+    std::vector<QueuedPacket> pool;
+    std::vector<uint32_t> links;        // Next entry in the same list, or the next free entry
+    uint32_t freeHead = kEnd;
+    std::vector<Bucket> buckets;
+    std::vector<uint32_t> activeRing;   // Non-empty buckets in serving order
+    size_t activeFront = 0;
+    size_t activeCount = 0;
+    size_t queued = 0;                  // Waiting packets, not counting the one in service
+    bool busy = false;
+    InService current{};
+    int64_t freeAt = 0;                 // Time the last departure left
+    int64_t clock = 0;                  // Latest time the queue has been advanced to
+    double average = 0;                 // RED moving average of the length
+    uint32_t sinceDrop = 0;             // RED arrivals admitted since the last drop
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+// Hot-path instrumentation, compiled in with -DDDOS_INSTRUMENTATION=1.
+//
+// Probes time the phases of a step and every mitigation stage and count
+// the packets each stage saw and dropped; gauges keep high-water marks of
+// queue depths. Every thread accumulates into a slot of its own, and
+// Instrumentation::endStep() folds all slots into a per-step report. The
+// timed spans can also be written out as a Chrome trace (chrome://tracing
+// or Perfetto) or as folded stacks for flamegraph.pl.
+//
+// Without the flag the DDOS_* macros expand to nothing and none of this is
+// compiled, so the hot path carries no cost.
+
+#ifndef DDOS_INSTRUMENTATION
+#define DDOS_INSTRUMENTATION 0
+#endif
+
+#include "stage_slot.h"
+
+enum Probe : int {
+    kProbeGenerate,
+    kProbeProcess,
+    kProbeSchedule,
+    kProbeForward,
+    kProbeDeliver,
+    kProbeFirstStage,
+    kNumProbes = kProbeFirstStage + kNumStageSlots
+};
+
+enum Gauge : int {
+    kGaugeStepPackets,      // Packets handled in one step
+    kGaugePendingPackets,   // Packets in flight in the event queue
+    kGaugePartitionSize,    // Largest partition of a parallel phase
+    kNumGauges
+};
+
+#if DDOS_INSTRUMENTATION
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class Instrumentation {
+public:
+    struct ProbeTotals {
+        uint64_t ticks = 0;     // Time stamp counter ticks, or nanoseconds without one
+        uint64_t calls = 0;
+        uint64_t hits = 0;      // Packets the probe saw
+        uint64_t drops = 0;     // Packets dropped there
+    };
+
+    struct Report {
+        ProbeTotals probes[kNumProbes];
+        uint64_t highWater[kNumGauges] = {};
+    };
+
+    static const char* probeName(int probe) {
+        static const char* const kNames[kProbeFirstStage] = {
+            "generate", "process", "schedule", "forward", "deliver",
+        };
+        return probe < kProbeFirstStage ? kNames[probe] : stageSlotName(probe - kProbeFirstStage);
+    }
+
+    static const char* gaugeName(int gauge) {
+        static const char* const kNames[kNumGauges] = {"step_packets", "pending_packets", "partition_size"};
+        return kNames[gauge];
+    }
+
+    // Probe a probe is nested in, or -1 at the top level
+    static int probeParent(int probe) {
+        if (probe == kProbeGenerate || probe == kProbeProcess) return -1;
+        return kProbeProcess;
+    }
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static void record(int probe, uint64_t start, uint64_t end) {
+        Slot& slot = threadSlot();
+        add(slot.ticks[probe], end - start);
+        add(slot.calls[probe], 1);
+        if (slot.events.size() < kMaxEventsPerThread) {
+            slot.events.push_back(Event{probe, start, end});
+        }
+    }
+
+    static void count(int probe, uint64_t hits, uint64_t drops) {
+        Slot& slot = threadSlot();
+        add(slot.hits[probe], hits);
+        add(slot.drops[probe], drops);
+    }
+
+    static void gauge(int gauge, uint64_t depth) {
+        std::atomic<uint64_t>& mark = threadSlot().highWater[gauge];
+        if (depth > mark.load(std::memory_order_relaxed)) mark.store(depth, std::memory_order_relaxed);
+    }
+
+    // Fold every thread's slot into the report for the step just finished.
+    // Counts are process-wide, so concurrent simulations are summed together.
+    static void endStep() {
+        State& state = globalState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        Report totals;
+        for (const auto& slot : state.slots) {
+            for (int p = 0; p < kNumProbes; p++) {
+                totals.probes[p].ticks += slot->ticks[p].load(std::memory_order_relaxed);
+                totals.probes[p].calls += slot->calls[p].load(std::memory_order_relaxed);
+                totals.probes[p].hits += slot->hits[p].load(std::memory_order_relaxed);
+                totals.probes[p].drops += slot->drops[p].load(std::memory_order_relaxed);
+            }
+            for (int g = 0; g < kNumGauges; g++) {
+                totals.highWater[g] = std::max(totals.highWater[g], slot->highWater[g].exchange(0));
+            }
+        }
+        for (int p = 0; p < kNumProbes; p++) {
+            ProbeTotals& step = state.lastStep.probes[p];
+            step.ticks = totals.probes[p].ticks - state.total.probes[p].ticks;
+            step.calls = totals.probes[p].calls - state.total.probes[p].calls;
+            step.hits = totals.probes[p].hits - state.total.probes[p].hits;
+            step.drops = totals.probes[p].drops - state.total.probes[p].drops;
+            state.total.probes[p] = totals.probes[p];
+        }
+        for (int g = 0; g < kNumGauges; g++) {
+            state.lastStep.highWater[g] = totals.highWater[g];
+            state.total.highWater[g] = std::max(state.total.highWater[g], totals.highWater[g]);
+        }
+    }
+
+    // Report of the last step and of everything up to it
+    static Report lastStep() {
+        State& state = globalState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.lastStep;
+    }
+
+    static Report total() {
+        State& state = globalState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.total;
+    }
+
+    // The writers below read other threads' span buffers, so call them
+    // once no simulation is running. They return false if path cannot be
+    // written.
+
+    // Chrome trace event format, one complete event per probe span
+    static bool writeChromeTrace(const std::string& path) {
+        std::FILE* out = std::fopen(path.c_str(), "w");
+        if (!out) return false;
+        State& state = globalState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        double ticksPerMicro = ticksPerMicrosecond(state);
+        uint64_t origin = ~uint64_t(0);
+        for (const auto& slot : state.slots) {
+            for (const Event& event : slot->events) origin = std::min(origin, event.start);
+        }
+        std::fputs("{\"traceEvents\": [\n", out);
+        bool first = true;
+        for (size_t t = 0; t < state.slots.size(); t++) {
+            for (const Event& event : state.slots[t]->events) {
+                std::fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %zu, "
+                             "\"ts\": %.3f, \"dur\": %.3f}", first ? "" : ",\n", probeName(event.probe), t,
+                             (event.start - origin) / ticksPerMicro,
+                             (event.end - event.start) / ticksPerMicro);
+                first = false;
+            }
+        }
+        std::fputs("\n], \"displayTimeUnit\": \"ns\"}\n", out);
+        std::fclose(out);
+        return true;
+    }
+
+    // "parent;child ticks" lines of self time for flamegraph.pl
+    static bool writeFoldedStacks(const std::string& path) {
+        std::FILE* out = std::fopen(path.c_str(), "w");
+        if (!out) return false;
+        Report report = total();
+        for (int p = 0; p < kNumProbes; p++) {
+            uint64_t self = report.probes[p].ticks;
+            for (int child = 0; child < kNumProbes; child++) {
+                if (probeParent(child) == p) self -= std::min(self, report.probes[child].ticks);
+            }
+            if (self == 0) continue;
+            std::string stack = probeName(p);
+            for (int parent = probeParent(p); parent >= 0; parent = probeParent(parent)) {
+                stack = std::string(probeName(parent)) + ";" + stack;
+            }
+            std::fprintf(out, "%s %llu\n", stack.c_str(), static_cast<unsigned long long>(self));
+        }
+        std::fclose(out);
+        return true;
+    }
+
+private:
+    static constexpr size_t kMaxEventsPerThread = size_t(1) << 20;
+
+    struct Event {
+        int probe;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    // Written only by its own thread; relaxed atomics let endStep() read it
+    // from another thread without a data race
+    struct Slot {
+        std::atomic<uint64_t> ticks[kNumProbes] = {};
+        std::atomic<uint64_t> calls[kNumProbes] = {};
+        std::atomic<uint64_t> hits[kNumProbes] = {};
+        std::atomic<uint64_t> drops[kNumProbes] = {};
+        std::atomic<uint64_t> highWater[kNumGauges] = {};
+        std::vector<Event> events;
+    };
+
+    // Slots outlive their threads so that spans of finished workers are kept
+    struct State {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Slot>> slots;
+        Report lastStep;
+        Report total;
+        uint64_t originTicks = now();
+        std::chrono::steady_clock::time_point originTime = std::chrono::steady_clock::now();
+    };
+
+    static State& globalState() {
+        static State state;
+        return state;
+    }
+
+    static Slot& threadSlot() {
+        thread_local Slot* slot = nullptr;
+        if (!slot) {
+            State& state = globalState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.slots.emplace_back(new Slot());
+            slot = state.slots.back().get();
+        }
+        return *slot;
+    }
+
+    // Uncontended increment: each slot has a single writer
+    static void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static double ticksPerMicrosecond(const State& state) {
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                 state.originTime).count();
+        return micros > 0 ? std::max(1e-3, (now() - state.originTicks) / micros) : 1.0;
+    }
+};
+
+// Times the enclosing scope under a probe
+class ScopedProbe {
+public:
+    explicit ScopedProbe(int probe) : probe(probe), start(Instrumentation::now()) {}
+    ~ScopedProbe() { Instrumentation::record(probe, start, Instrumentation::now()); }
+
+    ScopedProbe(const ScopedProbe&) = delete;
+    ScopedProbe& operator=(const ScopedProbe&) = delete;
+
+private:
+    int probe;
+    uint64_t start;
+};
+
+#define DDOS_CONCAT_INNER(a, b) a##b
+#define DDOS_CONCAT(a, b) DDOS_CONCAT_INNER(a, b)
+#define DDOS_PROBE(probe) ScopedProbe DDOS_CONCAT(ddosProbe, __LINE__)(probe)
+#define DDOS_COUNT(probe, hits, drops) Instrumentation::count((probe), (hits), (drops))
+#define DDOS_GAUGE(which, depth) Instrumentation::gauge((which), (depth))
+#define DDOS_END_STEP() Instrumentation::endStep()
+
+#else
+
+#define DDOS_PROBE(probe) ((void)0)
+#define DDOS_COUNT(probe, hits, drops) ((void)0)
+#define DDOS_GAUGE(which, depth) ((void)0)
+#define DDOS_END_STEP() ((void)0)
+
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Bit-mask kernels for processing packets in blocks.
+// A block's packets are described by masks with one bit per packet, 64 to
+// a word, bit j standing for packet j of the block. Checks that boil down
+// to comparisons over a column run through these kernels, which use AVX2
+// or NEON when the compiler targets them (e.g. -march=native) and plain
+// loops otherwise; all paths give the same masks.
+
+constexpr size_t kBlockSize = 1024;     // Packets per block, a multiple of 64
+constexpr size_t kBlockWords = kBlockSize / 64;
+
+inline int popcount64(uint64_t word) {
+    return __builtin_popcountll(word);
+}
+
+// Word with the low n bits set, for n in [0, 64]
+inline uint64_t lowBits(size_t n) {
+    return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+}
+
+// Set the first n bits of mask and clear the rest of its last word
+inline void fillMask(size_t n, uint64_t* mask) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        mask[w] = lowBits(n - w * 64);
+    }
+}
+
+// Number of set bits in an n-bit mask
+inline int countBits(const uint64_t* mask, size_t n) {
+    int count = 0;
+    for (size_t w = 0; w * 64 < n; w++) {
+        count += popcount64(mask[w]);
+    }
+    return count;
+}
+
+// Call fn(j) for every set bit j of an n-bit mask, in increasing order
+template <typename Fn>
+inline void forEachSetBit(const uint64_t* mask, size_t n, Fn fn) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+            fn(w * 64 + __builtin_ctzll(bits));
+        }
+    }
+}
+
+// Bits of the first count (at most 64) flags that are non-zero
+inline uint64_t nonZeroWord(const uint8_t* flags, size_t count) {
+    uint64_t word = 0;
+    size_t j = 0;
+#if defined(__AVX2__)
+    for (; j + 32 <= count; j += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(flags + j));
+        __m256i zero = _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256());
+        word |= uint64_t(~uint32_t(_mm256_movemask_epi8(zero))) << j;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t kBitWeights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t weights = vld1q_u8(kBitWeights);
+    for (; j + 16 <= count; j += 16) {
+        uint8x16_t bits = vandq_u8(vtstq_u8(vld1q_u8(flags + j), vdupq_n_u8(0xFF)), weights);
+        uint64_t low = vaddv_u8(vget_low_u8(bits));
+        uint64_t high = vaddv_u8(vget_high_u8(bits));
+        word |= (low | (high << 8)) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= uint64_t(flags[j] != 0) << j;
+    }
+    return word;
+}
+
+// Bits of the first count (at most 64) values that exceed threshold
+inline uint64_t aboveWord(const int32_t* values, size_t count, int32_t threshold) {
+    uint64_t word = 0;
+    size_t j = 0;
+#if defined(__AVX2__)
+    __m256i limit = _mm256_set1_epi32(threshold);
+    for (; j + 8 <= count; j += 8) {
+        __m256i above = _mm256_cmpgt_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + j)), limit);
+        word |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(above))) << j;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint32_t kBitWeights[4] = {1, 2, 4, 8};
+    uint32x4_t weights = vld1q_u32(kBitWeights);
+    int32x4_t limit = vdupq_n_s32(threshold);
+    for (; j + 4 <= count; j += 4) {
+        uint32x4_t above = vcgtq_s32(vld1q_s32(values + j), limit);
+        word |= uint64_t(vaddvq_u32(vandq_u32(above, weights))) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= uint64_t(values[j] > threshold) << j;
+    }
+    return word;
+}
+
+// Bit j of out is set when flags[j] is non-zero
+inline void nonZeroMask(const uint8_t* flags, size_t n, uint64_t* out) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        out[w] = nonZeroWord(flags + w * 64, std::min<size_t>(64, n - w * 64));
+    }
+}
+
+// Clear bit j of mask where candidates has it set and values[j] > threshold.
+// Only the candidates' values affect the result, so the others need not be set.
+inline void clearAbove(const int32_t* values, const uint64_t* candidates, size_t n, int32_t threshold,
+                       uint64_t* mask) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        if (candidates[w] == 0) continue;
+        mask[w] &= ~(candidates[w] & aboveWord(values + w * 64, std::min<size_t>(64, n - w * 64), threshold));
+    }
+}
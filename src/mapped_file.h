@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <iterator>
+#include <vector>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. On POSIX systems the file is mapped into
+// memory, so pages are read in on first touch and readers work straight
+// from the page cache; elsewhere it is read into memory up front.
+class MappedFile {
+public:
+    // Throws std::runtime_error if path cannot be opened or mapped
+    explicit MappedFile(const std::string& path) : bytes(nullptr), length(0) {
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = reinterpret_cast<const unsigned char*>(contents.data());
+        length = contents.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map " + path);
+            }
+            bytes = static_cast<const unsigned char*>(address);
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (bytes) ::munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Tell the kernel the file will be read front to back so it reads ahead
+    void adviseSequential() const {
+#if !defined(_WIN32)
+        if (bytes) ::madvise(const_cast<unsigned char*>(bytes), length, MADV_SEQUENTIAL);
+#endif
+    }
+
+private:
+    const unsigned char* bytes;
+    size_t length;
+#if defined(_WIN32)
+    std::vector<char> contents;
+#endif
+};
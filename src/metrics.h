@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mitigation.h"
+
+// Per-step metrics exported off the simulation thread.
+//
+// The simulator fills one StepRecord per step and hands it to a
+// MetricsExporter, which copies it into a preallocated single-producer,
+// single-consumer ring. A background thread drains the ring and writes the
+// records as CSV, JSON Lines or a binary columnar file, so recording a step
+// costs a copy and never touches the file system.
+
+// Columns of a step record. The per-stage drop counts follow the fixed
+// columns, one per StageSlot.
+enum MetricColumn : int {
+    kMetricTimeStep,
+    kMetricPacketsProcessed,
+    kMetricLegitimateProcessed,
+    kMetricAttackProcessed,
+    kMetricPacketsDropped,
+    kMetricLegitimateDropped,
+    kMetricAttackDropped,
+    kMetricTransitDropped,
+    kMetricTargetLoad,
+    kMetricTargetCapacity,
+    kMetricLegitimateLatencyP50,    // Delivery latency percentiles in microseconds
+    kMetricLegitimateLatencyP99,
+    kMetricLegitimateLatencyP999,
+    kMetricAttackLatencyP50,
+    kMetricAttackLatencyP99,
+    kMetricAttackLatencyP999,
+    kMetricBlocklistSources,        // Sources on the IP filter's blocklist
+    kMetricBlocklistFalsePositives, // Legitimate packets the blocklist dropped
+    kMetricFirstStageDropped,
+    kNumMetricColumns = kMetricFirstStageDropped + kNumStageSlots
+};
+
+inline std::string metricColumnName(int column) {
+    static const char* const kNames[kMetricFirstStageDropped] = {
+        "time_step", "packets_processed", "legitimate_processed", "attack_processed",
+        "packets_dropped", "legitimate_dropped", "attack_dropped", "transit_dropped",
+        "target_load", "target_capacity",
+        "legitimate_latency_p50", "legitimate_latency_p99", "legitimate_latency_p999",
+        "attack_latency_p50", "attack_latency_p99", "attack_latency_p999",
+        "blocklist_sources", "blocklist_false_positives",
+    };
+    if (column < kMetricFirstStageDropped) return kNames[column];
+    return std::string("dropped_") + stageSlotName(column - kMetricFirstStageDropped);
+}
+
+struct StepRecord {
+    int64_t values[kNumMetricColumns] = {};
+
+    int64_t& operator[](int column) { return values[column]; }
+    int64_t operator[](int column) const { return values[column]; }
+};
+
+enum class MetricsFormat { Csv, JsonLines, Binary };
+
+// Binary layout: the magic "DDOSMET1", a uint32 column count and each
+// column name as a uint16 length and its bytes, then any number of row
+// groups. A row group is a uint32 row count followed by every column's
+// values for those rows as contiguous int64s. All integers little-endian.
+class MetricsExporter {
+public:
+    // Throws std::runtime_error if path cannot be opened. capacity is the
+    // number of records the ring holds before record() has to wait.
+    MetricsExporter(const std::string& path, MetricsFormat format, size_t capacity = 1024) :
+        format(format), ring(roundUpToPowerOfTwo(capacity)), mask(ring.size() - 1),
+        head(0), tail(0), flushed(0), stopping(false) {
+        out = std::fopen(path.c_str(), format == MetricsFormat::Binary ? "wb" : "w");
+        if (!out) {
+            throw std::runtime_error("Cannot open metrics file " + path);
+        }
+        writeHeader();
+        writer = std::thread([this] { run(); });
+    }
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // Writes out everything recorded, then closes the file
+    ~MetricsExporter() {
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+        std::fclose(out);
+    }
+
+    // Queue a record; only waits if the writer is a full ring behind
+    void record(const StepRecord& step) {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        while (position - tail.load(std::memory_order_acquire) >= ring.size()) {
+            std::this_thread::yield();
+        }
+        ring[position & mask] = step;
+        head.store(position + 1, std::memory_order_release);
+    }
+
+    // Wait until every record queued so far is written and flushed
+    void flush() {
+        uint64_t target = head.load(std::memory_order_relaxed);
+        while (flushed.load(std::memory_order_acquire) < target) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    uint64_t recorded() const { return head.load(std::memory_order_relaxed); }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t size = 1;
+        while (size < n) size <<= 1;
+        return size;
+    }
+
+    void writeHeader() {
+        if (format == MetricsFormat::Csv) {
+            for (int c = 0; c < kNumMetricColumns; c++) {
+                std::fprintf(out, "%s%s", c ? "," : "", metricColumnName(c).c_str());
+            }
+            std::fputc('\n', out);
+        } else if (format == MetricsFormat::Binary) {
+            std::fwrite("DDOSMET1", 1, 8, out);
+            writeLittleEndian(uint32_t(kNumMetricColumns), 4);
+            for (int c = 0; c < kNumMetricColumns; c++) {
+                std::string name = metricColumnName(c);
+                writeLittleEndian(uint16_t(name.size()), 2);
+                std::fwrite(name.data(), 1, name.size(), out);
+            }
+        }
+    }
+
+    void writeLittleEndian(uint64_t value, int bytes) {
+        unsigned char buffer[8];
+        for (int b = 0; b < bytes; b++) {
+            buffer[b] = static_cast<unsigned char>(value >> (8 * b));
+        }
+        std::fwrite(buffer, 1, bytes, out);
+    }
+
+    // Write the records in [begin, end) of the ring
+    void writeRecords(uint64_t begin, uint64_t end) {
+        switch (format) {
+            case MetricsFormat::Csv:
+                for (uint64_t r = begin; r < end; r++) {
+                    const StepRecord& step = ring[r & mask];
+                    for (int c = 0; c < kNumMetricColumns; c++) {
+                        std::fprintf(out, "%s%lld", c ? "," : "", static_cast<long long>(step[c]));
+                    }
+                    std::fputc('\n', out);
+                }
+                break;
+            case MetricsFormat::JsonLines:
+                for (uint64_t r = begin; r < end; r++) {
+                    const StepRecord& step = ring[r & mask];
+                    for (int c = 0; c < kNumMetricColumns; c++) {
+                        std::fprintf(out, "%s\"%s\": %lld", c ? ", " : "{", metricColumnName(c).c_str(),
+                                     static_cast<long long>(step[c]));
+                    }
+                    std::fputs("}\n", out);
+                }
+                break;
+            case MetricsFormat::Binary:
+                writeLittleEndian(uint32_t(end - begin), 4);
+                for (int c = 0; c < kNumMetricColumns; c++) {
+                    for (uint64_t r = begin; r < end; r++) {
+                        writeLittleEndian(uint64_t(ring[r & mask][c]), 8);
+                    }
+                }
+                break;
+        }
+    }
+
+    void run() {
+        for (;;) {
+            bool stop = stopping.load(std::memory_order_acquire);
+            uint64_t begin = tail.load(std::memory_order_relaxed);
+            uint64_t end = head.load(std::memory_order_acquire);
+            if (begin != end) {
+                writeRecords(begin, end);
+                tail.store(end, std::memory_order_release);
+                std::fflush(out);
+                flushed.store(end, std::memory_order_release);
+            } else if (stop) {
+                return;
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    }
+
+    MetricsFormat format;
+    std::FILE* out;
+    std::vector<StepRecord> ring;
+    size_t mask;
+    std::atomic<uint64_t> head;         // Next record to fill, owned by the producer
+    std::atomic<uint64_t> tail;         // Next record to write, owned by the writer
+    std::atomic<uint64_t> flushed;      // Records written and flushed so far
+    std::atomic<bool> stopping;
+    std::thread writer;
+};
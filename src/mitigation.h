@@ -0,0 +1,625 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "counters.h"
+#include "cuckoo_filter.h"
+#include "instrumentation.h"
+#include "kernels.h"
+#include "signature_table.h"
+#include "sketch.h"
+#include "stage_slot.h"
+#include "token_bucket.h"
+
+// Mitigation stages and the pipelines that chain them.
+//
+// A stage decides whether a packet is dropped. Every stage provides
+//   static constexpr StageKey kKey;                 field its state is keyed by
+//   static constexpr StageSlot kSlot;               where its drops are tallied
+//   void beginStep();                               called once before each step
+//   bool drops(const PacketView& packet);           verdict for one packet
+//   int admit(const PacketView& flow, int count);   how many of count identical
+//                                                   packets pass, in order
+//   void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch);
+//                                                   clear the bits of the alive
+//                                                   packets it drops, as if they
+//                                                   went through drops() in order
+// A stage only sees the packets that every earlier stage let through, and
+// it may only touch state belonging to the packet's key: the parallel path
+// runs each stage as its own phase partitioned by that key.
+
+// Fields of a packet the mitigations look at
+struct PacketView {
+    int sourceId;
+    int destinationId;
+    uint32_t signatureId;
+    bool isLegitimate;
+    int64_t arrivalTime;    // Microseconds of simulated time
+};
+
+enum class StageKey { Source, Destination, Signature };
+
+// Up to kBlockSize consecutive packets for the stages' block kernels. The
+// block starts on a legitimacy word, so bit j of legitimateBits is packet j.
+// Kernels get a scratch array of kBlockSize values alongside.
+struct PacketBlock {
+    const int* sourceIds;
+    const int* destinationIds;
+    const uint32_t* signatureIds;
+    const int64_t* arrivalTimes;
+    const uint64_t* legitimateBits;
+    size_t size;
+
+    bool isLegitimate(size_t j) const { return (legitimateBits[j / 64] >> (j % 64)) & 1; }
+
+    PacketView view(size_t j) const {
+        return PacketView{sourceIds[j], destinationIds[j], signatureIds[j], isLegitimate(j), arrivalTimes[j]};
+    }
+};
+
+// Block kernel for stages whose state needs one update per packet in
+// order: apply drops() to each alive packet
+template <typename Stage>
+inline void dropEach(Stage& stage, const PacketBlock& block, uint64_t* alive) {
+    forEachSetBit(alive, block.size, [&](size_t j) {
+        if (stage.drops(block.view(j))) alive[j / 64] &= ~(uint64_t(1) << (j % 64));
+    });
+}
+
+// Number of leading packets out of count that stay at or below threshold
+// when a counter starting at current is incremented once per packet
+inline int passingPrefix(int current, int count, int threshold) {
+    return std::max(0, std::min(count, threshold - current));
+}
+
+// Aging of the detectors' counts unless configured otherwise: halved every
+// ten steps, so their thresholds apply to recent rates and a steady source
+// below the rate never trips them
+constexpr CounterDecay kDefaultCounterDecay{10, 1};
+
+// How the IP filter picks the sources it drops. By default it drops attack
+// sources, which it knows from the simulator's ground truth, once they have
+// sent kThreshold packets. With blocklist set it works the way an edge box
+// does: a source that sends more than threshold packets in a step goes into
+// a cuckoo filter, and every packet from a source in the filter is dropped.
+struct IPFilterConfig {
+    bool blocklist = false;
+    int threshold = 100;                // Packets per source per step before it is blocked
+    int blockSteps = 50;                // Steps a source stays blocked; 0 blocks it for good
+    size_t capacity = size_t(1) << 20;  // Sources the blocklist is sized for
+};
+
+// What the blocklist did in a step. Legitimate packets it drops are its
+// false positives, whether their source crossed the threshold or merely
+// shares a fingerprint with one that did.
+struct BlocklistTally {
+    uint64_t legitimateDropped = 0;
+    uint64_t attackDropped = 0;
+    uint64_t sourcesBlocked = 0;        // Sources added to the filter
+    uint64_t insertFailures = 0;        // Sources over the threshold that did not fit
+
+    void merge(const BlocklistTally& other) {
+        legitimateDropped += other.legitimateDropped;
+        attackDropped += other.attackDropped;
+        sourcesBlocked += other.sourcesBlocked;
+        insertFailures += other.insertFailures;
+    }
+};
+
+// IP filtering, by ground truth or through a blocklist, see IPFilterConfig.
+// In ground-truth mode every attack packet is counted, dropped or not.
+// Counters is DenseCounterStore or SparseCounterStore.
+template <typename Counters>
+class IPFilterStage {
+public:
+    static constexpr StageKey kKey = StageKey::Source;
+    static constexpr StageSlot kSlot = kIPFilterSlot;
+    static constexpr int kThreshold = 100;      // Attack packets per source before filtering
+
+    // Indexed by source node id: decaying attack packet counts, or with
+    // the blocklist the packets of the current step
+    Counters counts;
+    IPFilterConfig config;
+    CuckooFilter blocked;   // Tagged with the epoch a source was blocked in
+    CounterDecay decay;     // Aging of the ground-truth counts
+
+    explicit IPFilterStage(uint64_t numSources = 0) :
+        counts(numSources, kDefaultCounterDecay), decay(kDefaultCounterDecay), tallies(kNumPartitions) {}
+
+    // Switch modes and forget every count and blocked source. The
+    // blocklist's counts start over every step.
+    void configure(const IPFilterConfig& filterConfig) {
+        config = filterConfig;
+        counts.setDecay(config.blocklist ? CounterDecay{1, CounterDecay::kForget} : decay);
+        blocked.resize(config.blocklist ? config.capacity : 0);
+        tallies.assign(kNumPartitions, PartitionTally());
+        stepsRun = 0;
+    }
+
+    // Aging of the ground-truth counts; counts start over
+    void setDecay(const CounterDecay& counterDecay) {
+        decay = counterDecay;
+        if (!config.blocklist) counts.setDecay(decay);
+    }
+
+    // Blocked sources expire an epoch at a time, an eighth of blockSteps,
+    // so a source stays blocked from blockSteps to an epoch longer
+    void beginStep() {
+        counts.advance();
+        if (!config.blocklist) return;
+        for (auto& partition : tallies) partition.tally = BlocklistTally();
+        int step = stepsRun++;
+        if (config.blockSteps <= 0) return;
+        int epochSteps = (config.blockSteps + 7) / 8;
+        int keptEpochs = (config.blockSteps + epochSteps - 1) / epochSteps + 1;
+        int epoch = step / epochSteps;
+        if (step % epochSteps == 0 && epoch >= keptEpochs) {
+            blocked.eraseTag(uint32_t(epoch - keptEpochs) % CuckooFilter::kNumTags);
+        }
+        epochTag = uint32_t(epoch) % CuckooFilter::kNumTags;
+    }
+
+    bool drops(const PacketView& packet) {
+        if (config.blocklist) return blocklistDrops(packet.sourceId, packet.isLegitimate);
+        return !packet.isLegitimate && counts.increment(packet.sourceId) > kThreshold;
+    }
+
+    int admit(const PacketView& flow, int count) {
+        if (config.blocklist) {
+            BlocklistTally& tally = tallies[partitionOf(flow.sourceId)].tally;
+            int passed = 0;
+            if (!blocked.contains(flow.sourceId)) {
+                passed = passingPrefix(counts.get(flow.sourceId), count, config.threshold);
+                int total = counts.increment(flow.sourceId, count);
+                if (passed < count && !(crossedThreshold(total, count) && block(flow.sourceId, tally))) {
+                    passed = count;
+                }
+            }
+            (flow.isLegitimate ? tally.legitimateDropped : tally.attackDropped) += count - passed;
+            return passed;
+        }
+        if (flow.isLegitimate) return count;
+        int passed = passingPrefix(counts.get(flow.sourceId), count, kThreshold);
+        counts.increment(flow.sourceId, count);
+        return passed;
+    }
+
+    // Counting stays sequential; the threshold test runs over the block
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch) {
+        if (config.blocklist) {
+            // Floods come as runs from one source, and once it is blocked
+            // the rest of the run needs no lookup
+            int blockedSource = -1;
+            forEachSetBit(alive, block.size, [&](size_t j) {
+                int sourceId = block.sourceIds[j];
+                bool isLegitimate = block.isLegitimate(j);
+                if (sourceId == blockedSource) {
+                    BlocklistTally& tally = tallies[partitionOf(sourceId)].tally;
+                    (isLegitimate ? tally.legitimateDropped : tally.attackDropped)++;
+                } else if (blocklistDrops(sourceId, isLegitimate)) {
+                    blockedSource = sourceId;
+                } else {
+                    return;
+                }
+                alive[j / 64] &= ~(uint64_t(1) << (j % 64));
+            });
+            return;
+        }
+        uint64_t attack[kBlockWords];
+        for (size_t w = 0; w * 64 < block.size; w++) {
+            attack[w] = alive[w] & ~block.legitimateBits[w];
+        }
+        forEachSetBit(attack, block.size, [&](size_t j) { scratch[j] = counts.increment(block.sourceIds[j]); });
+        clearAbove(scratch, attack, block.size, kThreshold, alive);
+    }
+
+    // Blocklist activity in the current step, summed over the partitions
+    BlocklistTally stepTally() const {
+        BlocklistTally total;
+        for (const auto& partition : tallies) total.merge(partition.tally);
+        return total;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(counts, config, blocked, decay, tallies, stepsRun, epochTag); }
+
+private:
+    // Tallies are kept per partition so the parallel path can count
+    // without sharing a cache line
+    struct alignas(kCacheLineSize) PartitionTally {
+        BlocklistTally tally;
+    };
+
+    // The ground truth only feeds the tallies
+    bool blocklistDrops(int sourceId, bool isLegitimate) {
+        BlocklistTally& tally = tallies[partitionOf(sourceId)].tally;
+        if (blocked.contains(sourceId) ||
+            (crossedThreshold(counts.increment(sourceId), 1) && block(sourceId, tally))) {
+            (isLegitimate ? tally.legitimateDropped : tally.attackDropped)++;
+            return true;
+        }
+        return false;
+    }
+
+    // Whether adding amount took a source's count for the step over the
+    // threshold. Only then is the source offered to the blocklist, so one
+    // that does not fit is let through for the rest of the step and counts
+    // as one insert failure, in packet and aggregate mode alike.
+    bool crossedThreshold(int count, int amount) const {
+        return count > config.threshold && count - amount <= std::max(config.threshold, 0);
+    }
+
+    // A source that does not fit is let through rather than dropped
+    bool block(int sourceId, BlocklistTally& tally) {
+        if (!blocked.insert(sourceId, epochTag)) {
+            tally.insertFailures++;
+            return false;
+        }
+        tally.sourcesBlocked++;
+        return true;
+    }
+
+    std::vector<PartitionTally> tallies;
+    int stepsRun = 0;
+    uint32_t epochTag = 0;
+};
+
+// Deep packet inspection: counts signature occurrences and blocks
+// attack-class signatures that appear too often
+template <typename Counters>
+class InspectionStage {
+public:
+    static constexpr StageKey kKey = StageKey::Signature;
+    static constexpr StageSlot kSlot = kInspectionSlot;
+    static constexpr int kThreshold = 50;       // Attack signature occurrences before blocking
+
+    Counters counts;        // Decaying occurrences, indexed by signature id
+    const SignatureTable* signatures;
+
+    explicit InspectionStage(const SignatureTable* signatures = nullptr) :
+        counts(0, kDefaultCounterDecay), signatures(signatures) {}
+
+    // Signatures registered since the last step need a counter slot
+    void beginStep() {
+        counts.advance();
+        if (counts.keySpace() < signatures->size()) {
+            counts.resize(signatures->size());
+        }
+    }
+
+    bool drops(const PacketView& packet) {
+        int occurrences = counts.increment(packet.signatureId);
+        return signatures->isAttackClass(packet.signatureId) && occurrences > kThreshold;
+    }
+
+    int admit(const PacketView& flow, int count) {
+        int occurrences = counts.get(flow.signatureId);
+        counts.increment(flow.signatureId, count);
+        return signatures->isAttackClass(flow.signatureId) ? passingPrefix(occurrences, count, kThreshold) : count;
+    }
+
+    // Occurrences of signatures outside the attack class are masked to zero
+    // so that a single threshold test covers both conditions
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch) {
+        forEachSetBit(alive, block.size, [&](size_t j) {
+            uint32_t signatureId = block.signatureIds[j];
+            int32_t attackClass = signatures->isAttackClass(signatureId);
+            scratch[j] = counts.increment(signatureId) & -attackClass;
+        });
+        clearAbove(scratch, alive, block.size, kThreshold, alive);
+    }
+
+    // The signature table belongs to the simulator and is stored with it
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(counts); }
+};
+
+// Rate limiting, first stage: token bucket per source
+class SourceRateLimitStage {
+public:
+    static constexpr StageKey kKey = StageKey::Source;
+    static constexpr StageSlot kSlot = kSourceRateLimitSlot;
+
+    TokenBucketArray buckets;
+
+    void beginStep() {}
+
+    bool drops(const PacketView& packet) {
+        return !buckets.tryConsume(packet.sourceId, packet.arrivalTime);
+    }
+
+    int admit(const PacketView& flow, int count) {
+        return buckets.consumeUpTo(flow.sourceId, flow.arrivalTime, count);
+    }
+
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t*) { dropEach(*this, block, alive); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(buckets); }
+};
+
+// Rate limiting, second stage: token bucket per destination
+class DestinationRateLimitStage {
+public:
+    static constexpr StageKey kKey = StageKey::Destination;
+    static constexpr StageSlot kSlot = kDestinationRateLimitSlot;
+
+    TokenBucketArray buckets;
+
+    void beginStep() {}
+
+    bool drops(const PacketView& packet) {
+        return !buckets.tryConsume(packet.destinationId, packet.arrivalTime);
+    }
+
+    int admit(const PacketView& flow, int count) {
+        return buckets.consumeUpTo(flow.destinationId, flow.arrivalTime, count);
+    }
+
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t*) { dropEach(*this, block, alive); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(buckets); }
+};
+
+// Traffic pattern analysis: drops sources sending too many packets within
+// a sliding window of steps, and keeps the busiest ones for reporting
+class PatternStage {
+public:
+    static constexpr StageKey kKey = StageKey::Source;
+    static constexpr StageSlot kSlot = kPatternSlot;
+    static constexpr int kThreshold = 200;      // Packets per source per window
+
+    SlidingWindowSketch sketch;     // Per-source packet counts, one sub-window per step
+    HeavyHitters heavyHitters;      // Busiest sources seen this step
+
+    explicit PatternStage(size_t windowSteps = 5) : sketch(windowSteps) {}
+
+    void beginStep() {
+        sketch.advance();
+        heavyHitters.clear();
+    }
+
+    bool drops(const PacketView& packet) {
+        uint32_t windowCount = sketch.add(packet.sourceId);
+        heavyHitters.offer(packet.sourceId, windowCount);
+        return windowCount > kThreshold;
+    }
+
+    // Each packet raises the windowed estimate by exactly one
+    int admit(const PacketView& flow, int count) {
+        int passed = passingPrefix(static_cast<int>(sketch.estimate(flow.sourceId)), count, kThreshold);
+        heavyHitters.offer(flow.sourceId, sketch.add(flow.sourceId, count));
+        return passed;
+    }
+
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch) {
+        forEachSetBit(alive, block.size, [&](size_t j) {
+            uint32_t windowCount = sketch.add(block.sourceIds[j]);
+            heavyHitters.offer(block.sourceIds[j], windowCount);
+            scratch[j] = static_cast<int32_t>(windowCount);
+        });
+        clearAbove(scratch, alive, block.size, kThreshold, alive);
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(sketch, heavyHitters); }
+};
+
+// Stage interface for techniques registered at run time, e.g. to try one
+// out without touching the simulator. Same contract as the built-in
+// stages; admit() and dropBlock() default to asking drops() once per packet.
+class MitigationStage {
+public:
+    virtual ~MitigationStage() = default;
+
+    virtual const char* name() const = 0;
+    virtual StageKey key() const = 0;
+    virtual void beginStep() {}
+    virtual bool drops(const PacketView& packet) = 0;
+
+    virtual int admit(const PacketView& flow, int count) {
+        int passed = 0;
+        for (int i = 0; i < count; i++) {
+            if (!drops(flow)) passed++;
+        }
+        return passed;
+    }
+
+    virtual void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t*) { dropEach(*this, block, alive); }
+};
+
+// Wraps a built-in stage so it can be registered at run time
+template <typename Stage>
+class StageAdapter : public MitigationStage {
+public:
+    StageAdapter(const char* stageName, Stage stage) : stageName(stageName), stage(std::move(stage)) {}
+
+    const char* name() const override { return stageName; }
+    StageKey key() const override { return Stage::kKey; }
+    void beginStep() override { stage.beginStep(); }
+    bool drops(const PacketView& packet) override { return stage.drops(packet); }
+    int admit(const PacketView& flow, int count) override { return stage.admit(flow, count); }
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch) override {
+        stage.dropBlock(block, alive, scratch);
+    }
+
+    const char* stageName;
+    Stage stage;
+};
+
+// Stages chained at run time through virtual calls, in registration order
+class RuntimePipeline {
+public:
+    static constexpr StageSlot kSlot = kCustomSlot;
+
+    void add(std::unique_ptr<MitigationStage> stage) { stages.push_back(std::move(stage)); }
+
+    size_t size() const { return stages.size(); }
+    bool empty() const { return stages.empty(); }
+
+    void beginStep() {
+        for (auto& stage : stages) {
+            stage->beginStep();
+        }
+    }
+
+    bool drops(const PacketView& packet) {
+        for (auto& stage : stages) {
+            if (stage->drops(packet)) return true;
+        }
+        return false;
+    }
+
+    int admit(const PacketView& flow, int count) {
+        for (size_t s = 0; s < stages.size() && count > 0; s++) {
+            count = stages[s]->admit(flow, count);
+        }
+        return count;
+    }
+
+    void dropBlock(const PacketBlock& block, uint64_t* alive, int32_t* scratch) {
+        for (auto& stage : stages) {
+            stage->dropBlock(block, alive, scratch);
+        }
+    }
+
+    template <typename Fn>
+    void forEachStage(Fn&& fn) {
+        for (auto& stage : stages) {
+            fn(*stage);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<MitigationStage>> stages;
+};
+
+// Stages chained at compile time. The whole chain inlines into the
+// caller's packet loop, and drops() stops at the first stage that drops.
+template <typename... Stages>
+class StagePipeline {
+public:
+    explicit StagePipeline(Stages&... stages) : stages(stages...) {}
+
+    // Pipeline over the stages of these types held in a tuple of stages
+    template <typename Tuple>
+    static StagePipeline from(Tuple& all) { return StagePipeline(std::get<Stages>(all)...); }
+
+    void beginStep() { (std::get<Stages&>(stages).beginStep(), ...); }
+
+    bool drops(const PacketView& packet) { return (std::get<Stages&>(stages).drops(packet) || ...); }
+
+    // admit() and dropBlock() add what each stage drops to stageDropped[kSlot]
+    int admit(const PacketView& flow, int count, [[maybe_unused]] int* stageDropped) {
+        ((count = count > 0 ? admitCounted(std::get<Stages&>(stages), flow, count, stageDropped) : 0), ...);
+        return count;
+    }
+
+    // Each stage sees the block once, after every earlier stage
+    void dropBlock([[maybe_unused]] const PacketBlock& block, [[maybe_unused]] uint64_t* alive,
+                   [[maybe_unused]] int32_t* scratch, [[maybe_unused]] int* stageDropped) {
+        (dropBlockCounted(std::get<Stages&>(stages), block, alive, scratch, stageDropped), ...);
+    }
+
+    // Call fn on each stage in order
+    template <typename Fn>
+    void forEachStage(Fn&& fn) { (fn(std::get<Stages&>(stages)), ...); }
+
+private:
+    template <typename Stage>
+    static int admitCounted(Stage& stage, const PacketView& flow, int count, int* stageDropped) {
+        DDOS_PROBE(kProbeFirstStage + Stage::kSlot);
+        DDOS_COUNT(kProbeFirstStage + Stage::kSlot, count, 0);
+        int passed = stage.admit(flow, count);
+        stageDropped[Stage::kSlot] += count - passed;
+        return passed;
+    }
+
+    template <typename Stage>
+    static void dropBlockCounted(Stage& stage, const PacketBlock& block, uint64_t* alive, int32_t* scratch,
+                                 int* stageDropped) {
+        DDOS_PROBE(kProbeFirstStage + Stage::kSlot);
+        int before = countBits(alive, block.size);
+        DDOS_COUNT(kProbeFirstStage + Stage::kSlot, before, 0);
+        stage.dropBlock(block, alive, scratch);
+        stageDropped[Stage::kSlot] += before - countBits(alive, block.size);
+    }
+
+    std::tuple<Stages&...> stages;
+};
+
+namespace detail {
+
+template <typename Tuple, unsigned Mask, typename Indices>
+struct SelectStages;
+
+template <typename... Stages, unsigned Mask, size_t... I>
+struct SelectStages<std::tuple<Stages...>, Mask, std::index_sequence<I...>> {
+    using type = decltype(std::tuple_cat(
+        std::declval<std::conditional_t<((Mask >> I) & 1) != 0, std::tuple<Stages>, std::tuple<>>>()...));
+};
+
+template <typename Selected>
+struct PipelineOver;
+
+template <typename... Stages>
+struct PipelineOver<std::tuple<Stages...>> {
+    using type = StagePipeline<Stages...>;
+};
+
+template <typename Tuple, typename Fn, size_t... Masks>
+void withPipeline(Tuple& all, unsigned mask, Fn& fn, std::index_sequence<Masks...>);
+
+template <template <typename> class Stage, typename T>
+struct IsStageOf : std::false_type {};
+
+template <template <typename> class Stage, typename Counters>
+struct IsStageOf<Stage, Stage<Counters>> : std::true_type {};
+
+template <template <typename> class Stage, typename... Stages>
+constexpr size_t stageIndex() {
+    constexpr bool matches[] = {IsStageOf<Stage, Stages>::value...};
+    size_t i = 0;
+    while (!matches[i]) i++;
+    return i;
+}
+
+}  // namespace detail
+
+// The element of stages that is a Stage, whatever counter store it uses
+template <template <typename> class Stage, typename... Stages>
+auto& stageOf(std::tuple<Stages...>& stages) {
+    return std::get<detail::stageIndex<Stage, Stages...>()>(stages);
+}
+
+template <template <typename> class Stage, typename... Stages>
+const auto& stageOf(const std::tuple<Stages...>& stages) {
+    return std::get<detail::stageIndex<Stage, Stages...>()>(stages);
+}
+
+// StagePipeline over the stages of Tuple whose bit is set in Mask, the
+// i-th bit standing for the i-th element
+template <typename Tuple, unsigned Mask>
+using PipelineFor = typename detail::PipelineOver<typename detail::SelectStages<
+    Tuple, Mask, std::make_index_sequence<std::tuple_size<Tuple>::value>>::type>::type;
+
+// Call fn with the pipeline of the stages in all selected by mask. Every
+// combination is instantiated up front, so choosing one is a single
+// dispatch per call and the packet loop inside fn tests no flags.
+template <typename Tuple, typename Fn>
+void withPipeline(Tuple& all, unsigned mask, Fn&& fn) {
+    detail::withPipeline(all, mask, fn, std::make_index_sequence<size_t(1) << std::tuple_size<Tuple>::value>());
+}
+
+template <typename Tuple, typename Fn, size_t... Masks>
+void detail::withPipeline(Tuple& all, unsigned mask, Fn& fn, std::index_sequence<Masks...>) {
+    ((mask == Masks ? (fn(PipelineFor<Tuple, Masks>::from(all)), true) : false) || ...);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Columnar packet store used in place of a queue of Packet objects.
+// Each field lives in its own contiguous array so that traffic generation and
+// the mitigation pass stream through memory. clear() only resets the size, so
+// a buffer reused every step keeps its capacity and stops allocating once it
+// has grown to the peak step size.
+class PacketBuffer {
+public:
+    std::vector<int> sourceIds;
+    std::vector<int> destinationIds;
+    std::vector<int64_t> timestamps;        // Send time in microseconds of simulated time
+    std::vector<int64_t> arrivalTimes;      // Time the packet reaches its destination
+    std::vector<uint32_t> signatureIds;     // Interned id from the SignatureTable
+    std::vector<uint64_t> legitimateBits;   // One bit per packet, set for legitimate traffic
+
+    PacketBuffer() : count(0) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return sourceIds.capacity(); }
+
+    void reserve(size_t n) {
+        sourceIds.reserve(n);
+        destinationIds.reserve(n);
+        timestamps.reserve(n);
+        arrivalTimes.reserve(n);
+        signatureIds.reserve(n);
+        legitimateBits.reserve((n + 63) / 64);
+    }
+
+    // Drop all packets but keep the allocated storage for the next step
+    void clear() {
+        sourceIds.clear();
+        destinationIds.clear();
+        timestamps.clear();
+        arrivalTimes.clear();
+        signatureIds.clear();
+        legitimateBits.clear();
+        count = 0;
+    }
+
+    void push(int src, int dst, bool legitimate, int64_t time, int64_t arrivalTime, uint32_t signatureId) {
+        if (count % 64 == 0) {
+            legitimateBits.push_back(0);
+        }
+        if (legitimate) {
+            legitimateBits[count / 64] |= uint64_t(1) << (count % 64);
+        }
+        sourceIds.push_back(src);
+        destinationIds.push_back(dst);
+        timestamps.push_back(time);
+        arrivalTimes.push_back(arrivalTime);
+        signatureIds.push_back(signatureId);
+        count++;
+    }
+
+    // Size the buffer to n packets so they can be filled in place with set().
+    // New legitimacy bits start cleared.
+    void resize(size_t n) {
+        sourceIds.resize(n);
+        destinationIds.resize(n);
+        timestamps.resize(n);
+        arrivalTimes.resize(n);
+        signatureIds.resize(n);
+        legitimateBits.resize((n + 63) / 64, 0);
+        if (n % 64 != 0) {
+            legitimateBits.back() &= (uint64_t(1) << (n % 64)) - 1;
+        }
+        count = n;
+    }
+
+    // Fill packet i of a resized buffer. Packets sharing a 64-packet block
+    // share a legitimacy word, so concurrent writers must use disjoint blocks.
+    void set(size_t i, int src, int dst, bool legitimate, int64_t time, int64_t arrivalTime, uint32_t signatureId) {
+        sourceIds[i] = src;
+        destinationIds[i] = dst;
+        timestamps[i] = time;
+        arrivalTimes[i] = arrivalTime;
+        signatureIds[i] = signatureId;
+        if (legitimate) {
+            legitimateBits[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+
+    bool isLegitimate(size_t i) const {
+        return (legitimateBits[i / 64] >> (i % 64)) & 1;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(sourceIds, destinationIds, timestamps, arrivalTimes, signatureIds, legitimateBits, count);
+    }
+
+private:
+    size_t count;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Key partitioning for the parallel processing path.
+// The partition count is fixed rather than tied to the thread count, so the
+// ownership of every key (and therefore every result) is the same no matter
+// how many workers run. Keys are assigned in blocks of 16 so that the 16 int
+// counters sharing a cache line always belong to the same partition.
+
+constexpr size_t kNumPartitions = 64;
+constexpr uint64_t kKeysPerPartitionBlock = 16;
+
+inline size_t partitionOf(uint64_t key) {
+    return (key / kKeysPerPartitionBlock) % kNumPartitions;
+}
+
+// Packet indices grouped by the partition of a key column.
+// Grouping is stable: within a partition, indices keep their original order,
+// which is what makes the parallel result match the serial one.
+class PartitionIndex {
+public:
+    std::vector<uint32_t> order;
+    std::vector<size_t> offsets;    // Partition p owns order[offsets[p], offsets[p + 1])
+
+    const uint32_t* begin(size_t partition) const { return order.data() + offsets[partition]; }
+    const uint32_t* end(size_t partition) const { return order.data() + offsets[partition + 1]; }
+
+    // Group the indices i in [0, n) for which include(i) holds by partitionOf(keys[i])
+    template <typename Key, typename Include>
+    void build(const Key* keys, size_t n, Include include, ThreadPool& pool) {
+        size_t numChunks = pool.size();
+        size_t chunkSize = (n + numChunks - 1) / numChunks;
+        histogram.assign(numChunks * kNumPartitions, 0);
+
+        // Count packets per (chunk, partition)
+        pool.parallelFor(numChunks, [&](size_t chunk) {
+            size_t* counts = &histogram[chunk * kNumPartitions];
+            size_t last = std::min(n, (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < last; i++) {
+                if (include(i)) counts[partitionOf(keys[i])]++;
+            }
+        });
+
+        // Turn counts into write positions, partition-major then chunk order
+        offsets.assign(kNumPartitions + 1, 0);
+        size_t total = 0;
+        for (size_t p = 0; p < kNumPartitions; p++) {
+            offsets[p] = total;
+            for (size_t chunk = 0; chunk < numChunks; chunk++) {
+                size_t count = histogram[chunk * kNumPartitions + p];
+                histogram[chunk * kNumPartitions + p] = total;
+                total += count;
+            }
+        }
+        offsets[kNumPartitions] = total;
+        order.resize(total);
+
+        // Scatter indices into their partitions
+        pool.parallelFor(numChunks, [&](size_t chunk) {
+            size_t* positions = &histogram[chunk * kNumPartitions];
+            size_t last = std::min(n, (chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < last; i++) {
+                if (include(i)) order[positions[partitionOf(keys[i])]++] = static_cast<uint32_t>(i);
+            }
+        });
+    }
+
+private:
+    std::vector<size_t> histogram;
+};
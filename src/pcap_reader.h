@@ -0,0 +1,578 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "event_queue.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "traffic_trace.h"
+
+// Packet capture ingestion: turns a pcap or pcapng file into a TrafficTrace
+// that drives the mitigations in place of generated traffic.
+//
+// Every distinct IP address becomes a node, numbered in order of first
+// appearance, and the first payload bytes after the L4 header are hashed
+// into a signature. Capture time is cut into simulation steps, by default
+// one second of capture per step.
+//
+// The file is mapped and read in three passes. A serial pass walks the
+// record headers, which is all it takes to find every packet. The packets
+// are then decoded on a thread pool in fixed-size chunks, each chunk
+// numbering the addresses and signatures it sees. A final pass merges
+// the chunks' numbering in file order and fills the trace in parallel.
+// The result does not depend on the number of threads.
+
+// Headers of one captured packet, as handed to PcapOptions::isAttack
+struct PcapPacket {
+    int64_t timeNanos;                  // Capture time since the epoch
+    unsigned char sourceAddress[16];    // IPv6, or IPv4-mapped IPv6
+    unsigned char destinationAddress[16];
+    uint8_t protocol;                   // IP protocol of the L4 header
+    uint16_t sourcePort;                // Zero unless TCP or UDP
+    uint16_t destinationPort;
+    const unsigned char* payload;       // Bytes after the L4 header, within the capture
+    size_t payloadBytes;
+};
+
+struct PcapOptions {
+    int64_t captureMicrosPerStep = kMicrosPerStep;  // Capture time per simulation step
+    size_t signatureBytes = 16;             // Payload bytes hashed into the signature
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunkPackets = size_t(1) << 16;  // Packets per decode task
+    size_t maxStepGap = 100000;             // Steps a packet may jump ahead; stamped later, it is skipped
+
+    // Ground truth for the legitimate/attack tallies; packets count as
+    // legitimate when it is empty. Called concurrently from the decode
+    // threads. Signatures of attack packets are in the DPI attack class.
+    std::function<bool(const PcapPacket&)> isAttack;
+};
+
+struct PcapCapture {
+    // Steps of traffic, starting at time step 0. Its signature ids index
+    // signatureNames; intern those in the simulator and remap the trace
+    // before replaying it (see NetworkSimulator::internSignatures()).
+    TrafficTrace trace;
+    std::vector<std::string> addresses;         // Printable address of every node
+    std::vector<std::string> signatureNames;
+    uint64_t packetsSkipped = 0;    // Not IP, an unsupported link type, truncated, or stamped far ahead
+
+    int numNodes() const { return static_cast<int>(addresses.size()); }
+
+    // Node that receives the most packets, the natural target node
+    int busiestDestination() const {
+        std::vector<uint64_t> received(addresses.size(), 0);
+        for (const auto& step : trace.steps) {
+            for (size_t i = 0; i < step.size(); i++) received[step.destinationIds[i]]++;
+        }
+        return received.empty() ? 0 : int(std::max_element(received.begin(), received.end()) - received.begin());
+    }
+};
+
+class PcapReader {
+public:
+    // Throws std::runtime_error if path cannot be read or is neither pcap
+    // nor pcapng
+    static PcapCapture read(const std::string& path, const PcapOptions& options = PcapOptions()) {
+        MappedFile file(path);
+        file.adviseSequential();
+        std::vector<Record> records;
+        if (file.size() >= 4 && load32(file.data(), false) == kPcapngSectionHeader) {
+            scanPcapng(file, records);
+        } else {
+            scanPcap(file, records);
+        }
+        return decode(records, options);
+    }
+
+private:
+    static constexpr uint32_t kPcapngSectionHeader = 0x0A0D0D0A;
+    static constexpr uint32_t kPcapngInterface = 1;
+    static constexpr uint32_t kPcapngSimplePacket = 3;
+    static constexpr uint32_t kPcapngEnhancedPacket = 6;
+
+    // Link types
+    static constexpr uint32_t kLinkNull = 0;
+    static constexpr uint32_t kLinkEthernet = 1;
+    static constexpr uint32_t kLinkRaw = 101;
+    static constexpr uint32_t kLinkLinuxSll = 113;
+    static constexpr uint32_t kLinkIPv4 = 228;
+    static constexpr uint32_t kLinkIPv6 = 229;
+    static constexpr uint32_t kLinkLinuxSll2 = 276;
+
+    // A captured packet found by the header scan
+    struct Record {
+        const unsigned char* data;
+        uint32_t length;        // Captured bytes
+        uint32_t linkType;
+        int64_t timeNanos;
+    };
+
+    // A decoded packet, with addresses and signature numbered within its chunk
+    struct Decoded {
+        int64_t timeNanos;
+        uint32_t source;
+        uint32_t destination;
+        uint32_t signature;
+        bool isAttack;
+    };
+
+    struct Address {
+        uint64_t high;
+        uint64_t low;
+        bool operator==(const Address& other) const { return high == other.high && low == other.low; }
+    };
+
+    struct AddressHash {
+        size_t operator()(const Address& a) const {
+            uint64_t h = (a.high ^ (a.low * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+            return static_cast<size_t>(h ^ (h >> 31));
+        }
+    };
+
+    // Signatures are keyed by payload hash and class
+    struct SignatureKey {
+        uint64_t hash;
+        bool isAttack;
+        bool operator==(const SignatureKey& other) const { return hash == other.hash && isAttack == other.isAttack; }
+    };
+
+    struct SignatureKeyHash {
+        size_t operator()(const SignatureKey& k) const { return static_cast<size_t>(k.hash * 2 + k.isAttack); }
+    };
+
+    struct Chunk {
+        std::vector<Decoded> packets;
+        std::vector<Address> addresses;         // Chunk numbering, in order of first appearance
+        std::vector<SignatureKey> signatures;
+        uint64_t skipped = 0;
+    };
+
+    static uint16_t load16(const unsigned char* p, bool swap) {
+        uint16_t v;
+        std::memcpy(&v, p, 2);
+        return swap ? uint16_t(v << 8 | v >> 8) : v;
+    }
+
+    static uint32_t load32(const unsigned char* p, bool swap) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return swap ? __builtin_bswap32(v) : v;
+    }
+
+    static uint16_t loadBigEndian16(const unsigned char* p) { return uint16_t(p[0] << 8 | p[1]); }
+
+    [[noreturn]] static void damaged() {
+        throw std::runtime_error("Capture file is truncated or damaged");
+    }
+
+    static void scanPcap(const MappedFile& file, std::vector<Record>& records) {
+        const unsigned char* data = file.data();
+        if (file.size() < 24) {
+            throw std::runtime_error("Not a pcap or pcapng file");
+        }
+        uint32_t magic = load32(data, false);
+        bool swap;
+        bool nanos;
+        switch (magic) {
+            case 0xA1B2C3D4: swap = false; nanos = false; break;
+            case 0xA1B23C4D: swap = false; nanos = true; break;
+            case 0xD4C3B2A1: swap = true; nanos = false; break;
+            case 0x4D3CB2A1: swap = true; nanos = true; break;
+            default: throw std::runtime_error("Not a pcap or pcapng file");
+        }
+        uint32_t linkType = load32(data + 20, swap) & 0x0FFFFFFF;
+        size_t offset = 24;
+        while (offset + 16 <= file.size()) {
+            const unsigned char* header = data + offset;
+            int64_t seconds = load32(header, swap);
+            int64_t fraction = load32(header + 4, swap);
+            uint32_t length = load32(header + 8, swap);
+            offset += 16;
+            if (length > file.size() - offset) break;   // Cut off by an interrupted capture
+            records.push_back(Record{data + offset, length, linkType,
+                                     seconds * 1000000000 + (nanos ? fraction : fraction * 1000)});
+            offset += length;
+        }
+    }
+
+    static void scanPcapng(const MappedFile& file, std::vector<Record>& records) {
+        struct Interface {
+            uint32_t linkType;
+            int64_t ticksPerSecond;
+        };
+        const unsigned char* data = file.data();
+        std::vector<Interface> interfaces;
+        bool swap = false;
+        int64_t lastTime = 0;
+        size_t offset = 0;
+        while (offset + 12 <= file.size()) {
+            const unsigned char* block = data + offset;
+            uint32_t type = load32(block, false);
+            if (type == kPcapngSectionHeader) {
+                // The byte-order magic decides how the rest of the section reads
+                uint32_t byteOrder = load32(block + 8, false);
+                if (byteOrder == 0x1A2B3C4D) swap = false;
+                else if (byteOrder == 0x4D3C2B1A) swap = true;
+                else damaged();
+                interfaces.clear();
+            } else {
+                type = load32(block, swap);
+            }
+            uint32_t length = load32(block + 4, swap);
+            if (length < 12 || length % 4 != 0) damaged();
+            if (length > file.size() - offset) break;   // Cut off by an interrupted capture
+            const unsigned char* body = block + 8;
+            size_t bodyLength = length - 12;
+
+            if (type == kPcapngInterface && bodyLength >= 8) {
+                Interface interface{load16(body, swap), 1000000};
+                // Options: if_tsresol (code 9) sets the timestamp unit
+                for (size_t o = 8; o + 4 <= bodyLength;) {
+                    uint16_t code = load16(body + o, swap);
+                    uint16_t optionLength = load16(body + o + 2, swap);
+                    if (code == 0 || o + 4 + optionLength > bodyLength) break;
+                    if (code == 9 && optionLength >= 1) {
+                        uint8_t resolution = body[o + 4];
+                        int64_t ticks = 1;
+                        for (int i = 0; i < (resolution & 0x7F) && ticks < 1000000000000000000ll; i++) {
+                            ticks *= (resolution & 0x80) ? 2 : 10;
+                        }
+                        interface.ticksPerSecond = ticks;
+                    }
+                    o += 4 + (optionLength + 3) / 4 * 4;
+                }
+                interfaces.push_back(interface);
+            } else if (type == kPcapngEnhancedPacket && bodyLength >= 20) {
+                uint32_t interfaceId = load32(body, swap);
+                if (interfaceId >= interfaces.size()) damaged();
+                const Interface& interface = interfaces[interfaceId];
+                uint64_t ticks = uint64_t(load32(body + 4, swap)) << 32 | load32(body + 8, swap);
+                uint32_t captured = load32(body + 12, swap);
+                if (captured > bodyLength - 20) damaged();
+                int64_t seconds = static_cast<int64_t>(ticks / interface.ticksPerSecond);
+                int64_t remainder = static_cast<int64_t>(ticks % interface.ticksPerSecond);
+                // Resolutions finer than a nanosecond leave remainders whose
+                // product with 10^9 does not fit in 64 bits
+                lastTime = seconds * 1000000000 +
+                           static_cast<int64_t>(static_cast<__int128>(remainder) * 1000000000 /
+                                                interface.ticksPerSecond);
+                records.push_back(Record{body + 20, captured, interface.linkType, lastTime});
+            } else if (type == kPcapngSimplePacket && bodyLength >= 4) {
+                // No timestamp: it counts as captured with the previous packet
+                if (interfaces.empty()) damaged();
+                uint32_t captured = std::min<uint32_t>(load32(body, swap), uint32_t(bodyLength - 4));
+                records.push_back(Record{body + 4, captured, interfaces[0].linkType, lastTime});
+            }
+            offset += length;
+        }
+    }
+
+    // Offset of the IP header within a frame, or -1 if it carries none
+    static long networkOffset(const Record& record) {
+        const unsigned char* p = record.data;
+        size_t n = record.length;
+        switch (record.linkType) {
+            case kLinkEthernet: {
+                size_t offset = 12;
+                for (;;) {
+                    if (offset + 2 > n) return -1;
+                    uint16_t etherType = loadBigEndian16(p + offset);
+                    if (etherType == 0x8100 || etherType == 0x88A8 || etherType == 0x9100) {
+                        offset += 4;
+                        continue;
+                    }
+                    return etherType == 0x0800 || etherType == 0x86DD ? long(offset + 2) : -1;
+                }
+            }
+            case kLinkLinuxSll: {
+                if (n < 16) return -1;
+                uint16_t protocol = loadBigEndian16(p + 14);
+                return protocol == 0x0800 || protocol == 0x86DD ? 16 : -1;
+            }
+            case kLinkLinuxSll2: {
+                if (n < 20) return -1;
+                uint16_t protocol = loadBigEndian16(p);
+                return protocol == 0x0800 || protocol == 0x86DD ? 20 : -1;
+            }
+            case kLinkNull:
+                return n >= 4 ? 4 : -1;
+            case kLinkRaw:
+            case kLinkIPv4:
+            case kLinkIPv6:
+                return 0;
+            default:
+                return -1;
+        }
+    }
+
+    // Fill the packet's L3 and L4 fields; false if it is not a usable IP packet
+    static bool parse(const Record& record, PcapPacket& packet) {
+        long start = networkOffset(record);
+        if (start < 0) return false;
+        const unsigned char* ip = record.data + start;
+        size_t n = record.length - start;
+        if (n < 1) return false;
+        size_t l4;
+        uint8_t protocol;
+        bool fragment = false;
+        if (ip[0] >> 4 == 4) {
+            size_t headerLength = size_t(ip[0] & 0x0F) * 4;
+            if (headerLength < 20 || n < headerLength) return false;
+            std::memset(packet.sourceAddress, 0, 10);
+            std::memset(packet.sourceAddress + 10, 0xFF, 2);
+            std::memcpy(packet.sourceAddress + 12, ip + 12, 4);
+            std::memset(packet.destinationAddress, 0, 10);
+            std::memset(packet.destinationAddress + 10, 0xFF, 2);
+            std::memcpy(packet.destinationAddress + 12, ip + 16, 4);
+            protocol = ip[9];
+            fragment = (loadBigEndian16(ip + 6) & 0x1FFF) != 0;
+            l4 = headerLength;
+        } else if (ip[0] >> 4 == 6) {
+            if (n < 40) return false;
+            std::memcpy(packet.sourceAddress, ip + 8, 16);
+            std::memcpy(packet.destinationAddress, ip + 24, 16);
+            protocol = ip[6];
+            l4 = 40;
+            // Skip hop-by-hop, routing, fragment, authentication and destination options headers
+            while (protocol == 0 || protocol == 43 || protocol == 44 || protocol == 51 || protocol == 60) {
+                if (l4 + 8 > n) return false;
+                size_t extensionLength = protocol == 44 ? 8
+                                         : protocol == 51 ? (size_t(ip[l4 + 1]) + 2) * 4
+                                                          : (size_t(ip[l4 + 1]) + 1) * 8;
+                if (protocol == 44) fragment = (loadBigEndian16(ip + l4 + 2) & 0xFFF8) != 0;
+                protocol = ip[l4];
+                l4 += extensionLength;
+                if (l4 > n) return false;
+            }
+        } else {
+            return false;
+        }
+
+        packet.protocol = protocol;
+        packet.sourcePort = 0;
+        packet.destinationPort = 0;
+        size_t payload = l4;
+        if (!fragment) {
+            if (protocol == 6 && l4 + 20 <= n) {
+                packet.sourcePort = loadBigEndian16(ip + l4);
+                packet.destinationPort = loadBigEndian16(ip + l4 + 2);
+                payload = l4 + std::max<size_t>(20, size_t(ip[l4 + 12] >> 4) * 4);
+            } else if (protocol == 17 && l4 + 8 <= n) {
+                packet.sourcePort = loadBigEndian16(ip + l4);
+                packet.destinationPort = loadBigEndian16(ip + l4 + 2);
+                payload = l4 + 8;
+            } else if ((protocol == 1 || protocol == 58) && l4 + 8 <= n) {
+                payload = l4 + 8;
+            }
+        }
+        payload = std::min(payload, n);
+        packet.payload = ip + payload;
+        packet.payloadBytes = n - payload;
+        packet.timeNanos = record.timeNanos;
+        return true;
+    }
+
+    // FNV-1a over the first bytes of the payload
+    static uint64_t payloadHash(const PcapPacket& packet, size_t bytes) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (size_t i = 0; i < std::min(bytes, packet.payloadBytes); i++) {
+            hash = (hash ^ packet.payload[i]) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    static Address addressOf(const unsigned char* bytes) {
+        Address address;
+        std::memcpy(&address.high, bytes, 8);
+        std::memcpy(&address.low, bytes + 8, 8);
+        return address;
+    }
+
+    static std::string formatAddress(const Address& address) {
+        unsigned char bytes[16];
+        std::memcpy(bytes, &address.high, 8);
+        std::memcpy(bytes + 8, &address.low, 8);
+        char text[48];
+        static const unsigned char kMappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+        if (std::memcmp(bytes, kMappedPrefix, 12) == 0) {
+            std::snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[12], bytes[13], bytes[14], bytes[15]);
+        } else {
+            char* out = text;
+            for (int i = 0; i < 16; i += 2) {
+                out += std::snprintf(out, text + sizeof(text) - out, i ? ":%x" : "%x", unsigned(bytes[i] << 8 | bytes[i + 1]));
+            }
+        }
+        return text;
+    }
+
+    static std::string signatureName(const SignatureKey& key) {
+        char text[40];
+        std::snprintf(text, sizeof(text), "%spayload_%016llx", key.isAttack ? "attack_" : "",
+                      static_cast<unsigned long long>(key.hash));
+        return text;
+    }
+
+    static void decodeChunk(const Record* records, size_t count, const PcapOptions& options, Chunk& chunk) {
+        std::unordered_map<Address, uint32_t, AddressHash> addressIds;
+        std::unordered_map<SignatureKey, uint32_t, SignatureKeyHash> signatureIds;
+        auto number = [](auto& ids, auto& list, const auto& key) {
+            auto inserted = ids.emplace(key, static_cast<uint32_t>(list.size()));
+            if (inserted.second) list.push_back(key);
+            return inserted.first->second;
+        };
+        // Floods and flows repeat the same addresses back to back, so the
+        // last lookup is kept
+        Address lastAddress{0, 0};
+        uint32_t lastAddressId = 0;
+        bool haveLastAddress = false;
+        auto numberAddress = [&](const unsigned char* bytes) {
+            Address address = addressOf(bytes);
+            if (!haveLastAddress || !(address == lastAddress)) {
+                haveLastAddress = true;
+                lastAddress = address;
+                lastAddressId = number(addressIds, chunk.addresses, address);
+            }
+            return lastAddressId;
+        };
+        chunk.packets.reserve(count);
+        for (size_t r = 0; r < count; r++) {
+            PcapPacket packet;
+            if (!parse(records[r], packet)) {
+                chunk.skipped++;
+                continue;
+            }
+            bool isAttack = options.isAttack && options.isAttack(packet);
+            SignatureKey signature{payloadHash(packet, options.signatureBytes), isAttack};
+            uint32_t source = numberAddress(packet.sourceAddress);
+            uint32_t destination = numberAddress(packet.destinationAddress);
+            chunk.packets.push_back(Decoded{packet.timeNanos, source, destination,
+                                            number(signatureIds, chunk.signatures, signature), isAttack});
+        }
+    }
+
+    static PcapCapture decode(const std::vector<Record>& records, const PcapOptions& options) {
+        size_t chunkPackets = std::max<size_t>(1, options.chunkPackets);
+        size_t numChunks = (records.size() + chunkPackets - 1) / chunkPackets;
+        std::vector<Chunk> chunks(numChunks);
+        ThreadPool pool(std::max<size_t>(1, std::min(options.numThreads, numChunks)));
+        pool.parallelFor(numChunks, [&](size_t c) {
+            size_t begin = c * chunkPackets;
+            decodeChunk(&records[begin], std::min(chunkPackets, records.size() - begin), options, chunks[c]);
+        });
+
+        // Number addresses and signatures globally, in file order
+        PcapCapture capture;
+        std::unordered_map<Address, uint32_t, AddressHash> addressIds;
+        std::unordered_map<SignatureKey, uint32_t, SignatureKeyHash> signatureIds;
+        std::vector<std::vector<uint32_t>> addressMaps(numChunks);
+        std::vector<std::vector<uint32_t>> signatureMaps(numChunks);
+        for (size_t c = 0; c < numChunks; c++) {
+            for (const Address& address : chunks[c].addresses) {
+                auto inserted = addressIds.emplace(address, static_cast<uint32_t>(capture.addresses.size()));
+                if (inserted.second) capture.addresses.push_back(formatAddress(address));
+                addressMaps[c].push_back(inserted.first->second);
+            }
+            for (const SignatureKey& signature : chunks[c].signatures) {
+                auto inserted = signatureIds.emplace(signature, static_cast<uint32_t>(capture.signatureNames.size()));
+                if (inserted.second) capture.signatureNames.push_back(signatureName(signature));
+                signatureMaps[c].push_back(inserted.first->second);
+            }
+            capture.packetsSkipped += chunks[c].skipped;
+        }
+
+        // Cut capture time into steps. A packet stamped earlier than the
+        // step being filled, as happens across pcapng interfaces, joins it;
+        // one stamped more than maxStepGap steps ahead is taken for a bogus
+        // timestamp and skipped, so it cannot blow up the step count.
+        TrafficTrace& trace = capture.trace;
+        trace.numNodes = capture.numNodes();
+        trace.numAttackers = 0;
+        trace.firstStep = 0;
+        int64_t nanosPerStep = std::max<int64_t>(1, options.captureMicrosPerStep) * 1000;
+        int64_t origin = 0;
+        bool first = true;
+        size_t step = 0;
+        std::vector<size_t> stepCounts;
+        std::vector<std::vector<uint32_t>> chunkSteps(numChunks);
+        for (size_t c = 0; c < numChunks; c++) {
+            std::vector<Decoded>& packets = chunks[c].packets;
+            size_t kept = 0;
+            for (const Decoded& packet : packets) {
+                if (first) {
+                    origin = packet.timeNanos;
+                    first = false;
+                }
+                uint64_t packetStep = static_cast<uint64_t>(std::max<int64_t>(0, packet.timeNanos - origin) /
+                                                            nanosPerStep);
+                if (packetStep > step + options.maxStepGap || packetStep > UINT32_MAX) {
+                    capture.packetsSkipped++;
+                    continue;
+                }
+                step = std::max<size_t>(step, packetStep);
+                if (step >= stepCounts.size()) stepCounts.resize(step + 1, 0);
+                stepCounts[step]++;
+                chunkSteps[c].push_back(static_cast<uint32_t>(step));
+                packets[kept++] = packet;
+            }
+            packets.resize(kept);
+        }
+        trace.steps.resize(stepCounts.size());
+        for (size_t s = 0; s < stepCounts.size(); s++) {
+            trace.steps[s].resize(stepCounts[s]);
+        }
+
+        // Each chunk fills a known range of each step
+        std::vector<std::vector<size_t>> chunkStart(numChunks);
+        std::vector<size_t> filled(stepCounts.size(), 0);
+        for (size_t c = 0; c < numChunks; c++) {
+            for (size_t i = 0; i < chunkSteps[c].size(); i++) {
+                size_t s = chunkSteps[c][i];
+                if (i == 0 || s != chunkSteps[c][i - 1]) chunkStart[c].push_back(filled[s]);
+                filled[s]++;
+            }
+        }
+        double microsPerNano = double(kMicrosPerStep) / nanosPerStep;
+        pool.parallelFor(numChunks, [&](size_t c) {
+            size_t run = 0;
+            size_t at = 0;
+            for (size_t i = 0; i < chunks[c].packets.size(); i++) {
+                const Decoded& packet = chunks[c].packets[i];
+                size_t s = chunkSteps[c][i];
+                if (i == 0 || s != chunkSteps[c][i - 1]) at = chunkStart[c][run++];
+                PacketBuffer& out = trace.steps[s];
+                int64_t offset = std::min<int64_t>(kMicrosPerStep - 1, std::max<int64_t>(0,
+                    static_cast<int64_t>((packet.timeNanos - origin - int64_t(s) * nanosPerStep) * microsPerNano)));
+                int64_t time = int64_t(s) * kMicrosPerStep + offset;
+                out.sourceIds[at] = addressMaps[c][packet.source];
+                out.destinationIds[at] = addressMaps[c][packet.destination];
+                out.timestamps[at] = time;
+                out.arrivalTimes[at] = time;
+                out.signatureIds[at] = signatureMaps[c][packet.signature];
+                at++;
+            }
+        });
+
+        // Legitimacy words are shared across chunk boundaries, so set them last
+        std::fill(filled.begin(), filled.end(), 0);
+        for (size_t c = 0; c < numChunks; c++) {
+            for (size_t i = 0; i < chunks[c].packets.size(); i++) {
+                size_t s = chunkSteps[c][i];
+                size_t at = filled[s]++;
+                if (!chunks[c].packets[i].isAttack) {
+                    trace.steps[s].legitimateBits[at / 64] |= uint64_t(1) << (at % 64);
+                }
+            }
+        }
+        return capture;
+    }
+};
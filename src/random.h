@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+// Counter-based random number generation.
+// Instead of advancing a shared engine, every draw is a pure function of
+// (seed, stream, counter). Any thread can compute the value for any packet
+// directly, so traffic can be generated in parallel and still be identical
+// for the same seed regardless of how the work is split.
+class CounterRng {
+public:
+    explicit CounterRng(uint64_t seed = 0) : key(seed) {}
+
+    uint64_t seed() const { return key; }
+
+    // 64 random bits for the given stream and counter
+    uint64_t at(uint64_t stream, uint64_t counter) const {
+        uint64_t x = key ^ mix(stream + 0x9E3779B97F4A7C15ull);
+        x += counter * 0xD1B54A32D192ED03ull;
+        return mix(mix(x));
+    }
+
+    // Uniform integer in [0, n) using a multiply-shift on the top 32 bits
+    uint32_t below(uint64_t stream, uint64_t counter, uint32_t n) const {
+        return static_cast<uint32_t>(((at(stream, counter) >> 32) * n) >> 32);
+    }
+
+    // Uniform double in [0, 1)
+    double uniform(uint64_t stream, uint64_t counter) const {
+        return (at(stream, counter) >> 11) * 0x1.0p-53;
+    }
+
+    // at(stream, firstCounter + k) for k in [0, n), written to out. The
+    // draws are independent, so the loop has no carried state and compiles
+    // to straight-line integer code the vectorizer can widen.
+    void fill(uint64_t stream, uint64_t firstCounter, uint64_t* out, size_t n) const {
+        uint64_t x = key ^ mix(stream + 0x9E3779B97F4A7C15ull);
+        for (size_t k = 0; k < n; k++) {
+            out[k] = mix(mix(x + (firstCounter + k) * 0xD1B54A32D192ED03ull));
+        }
+    }
+
+    // Non-deterministic seed for runs that do not ask for one
+    static uint64_t randomSeed() {
+        std::random_device rd;
+        return (uint64_t(rd()) << 32) ^ rd();
+    }
+
+    // The seed is the whole state
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(key); }
+
+private:
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t key;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// How a thread waits on a full or empty ring. Spinning reacts fastest but
+// burns a core, so it only pays when every thread has a core of its own.
+enum class WaitPolicy { Spin, Yield, Sleep };
+
+inline void waitOnce(WaitPolicy policy) {
+    switch (policy) {
+        case WaitPolicy::Spin: break;
+        case WaitPolicy::Yield: std::this_thread::yield(); break;
+        case WaitPolicy::Sleep: std::this_thread::sleep_for(std::chrono::microseconds(50)); break;
+    }
+}
+
+// Bounded lock-free ring of items handed from producer threads to one
+// consumer in sequence order.
+//
+// Items are numbered 0, 1, 2, ... and item n lives in slot n % capacity.
+// Any number of producers may fill an item at once, each writing its own
+// part; the item is published when the last of its parts is committed.
+// The consumer takes items strictly in order and releases each one when
+// done, which reopens the slot for item n + capacity. A producer that runs
+// capacity items ahead of the consumer waits for its slot, so capacity
+// bounds the memory in flight. With one producer and one part per item
+// this is a plain SPSC queue.
+//
+// Slot values are built once and reused, so passing items never allocates.
+template <typename T>
+class BatchRing {
+public:
+    explicit BatchRing(size_t capacity) : slots(capacity < 1 ? 1 : capacity) {
+        for (size_t s = 0; s < slots.size(); s++) {
+            slots[s].state.store(2 * s, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    // Parts the next items are split into; call only while no item is
+    // being filled, i.e. before producers start on them
+    void setPartsPerItem(size_t parts) {
+        for (auto& slot : slots) slot.remaining.store(parts, std::memory_order_relaxed);
+        partsPerItem = parts;
+    }
+
+    // Slot value of item, once the consumer has released what was there
+    // before. Returns nullptr if stop is raised while waiting.
+    T* acquire(uint64_t item, const std::atomic<bool>& stop, WaitPolicy policy) {
+        Slot& slot = slotOf(item);
+        while (slot.state.load(std::memory_order_acquire) != 2 * item) {
+            if (stop.load(std::memory_order_relaxed)) return nullptr;
+            waitOnce(policy);
+        }
+        return &slot.value;
+    }
+
+    // One part of item is written; the last part publishes it
+    void commit(uint64_t item) {
+        Slot& slot = slotOf(item);
+        if (slot.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            slot.state.store(2 * item + 1, std::memory_order_release);
+        }
+    }
+
+    // Consumer side: wait until item is published. Returns nullptr if stop
+    // is raised while waiting.
+    T* waitReady(uint64_t item, const std::atomic<bool>& stop, WaitPolicy policy) {
+        Slot& slot = slotOf(item);
+        while (slot.state.load(std::memory_order_acquire) != 2 * item + 1) {
+            if (stop.load(std::memory_order_relaxed)) return nullptr;
+            waitOnce(policy);
+        }
+        return &slot.value;
+    }
+
+    // Consumer side: hand item's slot back to the producers
+    void release(uint64_t item) {
+        Slot& slot = slotOf(item);
+        slot.remaining.store(partsPerItem, std::memory_order_relaxed);
+        slot.state.store(2 * (item + slots.size()), std::memory_order_release);
+    }
+
+    // Every slot value, e.g. to size them; only while no item is in flight
+    template <typename Visit>
+    void forEachValue(Visit visit) {
+        for (auto& slot : slots) visit(slot.value);
+    }
+
+private:
+    // state is 2n while the slot is open to producers of item n and 2n + 1
+    // once item n is published. Slots sit on their own cache lines so
+    // producers and the consumer of neighbouring items do not contend.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> state{0};
+        std::atomic<size_t> remaining{1};   // Parts of the current item not yet committed
+        T value;
+    };
+
+    Slot& slotOf(uint64_t item) { return slots[item % slots.size()]; }
+
+    std::vector<Slot> slots;
+    size_t partsPerItem = 1;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "topology.h"
+
+// Shortest-path next-hop tables, one per destination.
+// A table is computed by a single BFS from the destination the first time
+// a packet heads there and is cached until the topology changes, so
+// forwarding a packet costs one array lookup per hop.
+class RoutingTable {
+public:
+    struct Routes {
+        std::vector<int> nextHop;       // Neighbour toward the destination, -1 if unreachable
+        std::vector<size_t> nextLink;   // Topology::neighbors index of the link to nextHop
+        std::vector<int> hopCount;      // Links between the node and the destination, -1 if unreachable
+    };
+
+    // Forget every cached table; call whenever the topology changes
+    void clear() { cache.clear(); }
+
+    const Routes& routesTo(const Topology& topology, int destination) {
+        auto it = cache.find(destination);
+        if (it != cache.end()) {
+            return it->second;
+        }
+        Routes& routes = cache[destination];
+        int numNodes = topology.numNodes();
+        routes.nextHop.assign(numNodes, -1);
+        routes.nextLink.assign(numNodes, 0);
+        routes.hopCount.assign(numNodes, -1);
+
+        // BFS outward from the destination; each node reached from u forwards to u
+        routes.nextHop[destination] = destination;
+        routes.hopCount[destination] = 0;
+        frontier.assign(1, destination);
+        for (size_t head = 0; head < frontier.size(); head++) {
+            int u = frontier[head];
+            for (const int* v = topology.neighborsBegin(u); v != topology.neighborsEnd(u); ++v) {
+                if (routes.hopCount[*v] >= 0) continue;
+                routes.nextHop[*v] = u;
+                routes.nextLink[*v] = linkIndex(topology, *v, u);
+                routes.hopCount[*v] = routes.hopCount[u] + 1;
+                frontier.push_back(*v);
+            }
+        }
+        return routes;
+    }
+
+private:
+    // Position of the directed link from -> to; adjacency lists are sorted
+    static size_t linkIndex(const Topology& topology, int from, int to) {
+        return std::lower_bound(topology.neighborsBegin(from), topology.neighborsEnd(from), to) -
+               topology.neighbors.data();
+    }
+
+    std::unordered_map<int, Routes> cache;
+    std::vector<int> frontier;
+};
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulator.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+
+// Scenario matrix: many independent simulations run side by side.
+//
+// Every scenario builds a NetworkSimulator of its own with a seed derived
+// from the matrix seed, so scenarios share no state and run concurrently on
+// a thread pool, one scenario per task. Results come back in the order the
+// scenarios were added whatever order they finish in, and can be printed
+// as a single comparison table.
+//
+// With shared traffic, scenarios with equal ScenarioParams replay one
+// TrafficTrace instead of generating their own, so they see identical
+// packets and differ only in their mitigations.
+//
+// A matrix can also start every scenario from one snapshot of a warmed-up
+// simulator, so what-if branches pick up where the warm-up left off
+// instead of each repeating it.
+
+// Which of the four built-in mitigations a scenario enables
+struct MitigationSet {
+    bool rateLimit = false;
+    bool ipFiltering = false;
+    bool deepPacketInspection = false;
+    bool trafficPatternAnalysis = false;
+
+    static constexpr unsigned kNumCombinations = 16;
+
+    // Bit 0 rate limiting, bit 1 IP filtering, bit 2 DPI, bit 3 pattern analysis
+    static MitigationSet fromBits(unsigned bits) {
+        MitigationSet set;
+        set.rateLimit = bits & 1;
+        set.ipFiltering = bits & 2;
+        set.deepPacketInspection = bits & 4;
+        set.trafficPatternAnalysis = bits & 8;
+        return set;
+    }
+
+    static MitigationSet none() { return MitigationSet(); }
+    static MitigationSet all() { return fromBits(kNumCombinations - 1); }
+
+    // Every combination, from none to all
+    static std::vector<MitigationSet> allCombinations() {
+        std::vector<MitigationSet> sets;
+        for (unsigned bits = 0; bits < kNumCombinations; bits++) {
+            sets.push_back(fromBits(bits));
+        }
+        return sets;
+    }
+
+    unsigned bits() const {
+        return unsigned(rateLimit) | unsigned(ipFiltering) << 1 | unsigned(deepPacketInspection) << 2 |
+               unsigned(trafficPatternAnalysis) << 3;
+    }
+
+    void applyTo(NetworkSimulator& simulator) const {
+        simulator.enableRateLimiting(rateLimit);
+        simulator.enableIPFiltering(ipFiltering);
+        simulator.enableDeepPacketInspection(deepPacketInspection);
+        simulator.enableTrafficPatternAnalysis(trafficPatternAnalysis);
+    }
+
+    // "none", "all" or the enabled techniques joined by '+', e.g. "RL+DPI"
+    std::string name() const {
+        if (bits() == 0) return "none";
+        if (bits() == kNumCombinations - 1) return "all";
+        static const char* const kNames[4] = {"RL", "IPF", "DPI", "TPA"};
+        std::string name;
+        for (int b = 0; b < 4; b++) {
+            if (bits() & (1u << b)) name += (name.empty() ? "" : "+") + std::string(kNames[b]);
+        }
+        return name;
+    }
+};
+
+// Network size and traffic of one scenario
+struct ScenarioParams {
+    int numNodes = 50;
+    int numAttackers = 10;
+    int targetNodeId = 0;
+    int steps = 10;
+    double attackIntensity = 2.0;   // Attack traffic as a multiple of each attacker's capacity
+    int legitimateTraffic = 100;    // Legitimate packets per step
+
+    // Whether two scenarios generate the same traffic from the same seed
+    bool sameTraffic(const ScenarioParams& other) const {
+        return numNodes == other.numNodes && numAttackers == other.numAttackers &&
+               targetNodeId == other.targetNodeId && steps == other.steps &&
+               attackIntensity == other.attackIntensity && legitimateTraffic == other.legitimateTraffic;
+    }
+};
+
+struct Scenario {
+    std::string name;
+    MitigationSet mitigations;
+    ScenarioParams params;
+    std::function<void(NetworkSimulator&)> configure;   // Extra setup such as routing; may be empty
+};
+
+struct ScenarioResult {
+    Scenario scenario;
+    uint64_t seed = 0;
+    std::vector<StepStats> steps;   // Tallies of every step
+    StepStats totals;               // Sum over the steps
+    LatencyByClass latency;         // Delivery latency over the steps, not those before a warm start
+    double seconds = 0;             // Wall time of the scenario's run
+    std::string console;            // Per-step report, if the matrix keeps it
+
+    // Share of legitimate packets delivered to their destination
+    double legitimateDelivered() const {
+        int sent = totals.legitimateProcessed + totals.legitimateDropped;
+        return sent > 0 ? double(totals.legitimateProcessed) / sent : 1.0;
+    }
+
+    // Share of attack packets stopped before their destination
+    double attackBlocked() const {
+        int sent = totals.attackProcessed + totals.attackDropped;
+        return sent > 0 ? double(totals.attackDropped) / sent : 0.0;
+    }
+};
+
+class ScenarioMatrix {
+public:
+    explicit ScenarioMatrix(uint64_t seed = CounterRng::randomSeed()) :
+        baseSeed(seed), keepConsole(false), shareTraffic(false) {}
+
+    void add(Scenario scenario) {
+        if (scenario.name.empty()) scenario.name = scenario.mitigations.name();
+        scenarios.push_back(std::move(scenario));
+    }
+
+    void add(const std::string& name, MitigationSet mitigations, const ScenarioParams& params = ScenarioParams()) {
+        add(Scenario{name, mitigations, params, nullptr});
+    }
+
+    // Every mitigation set at every point of the parameter grid, sets
+    // varying fastest. configure, if given, runs on every simulator.
+    void addGrid(const std::vector<MitigationSet>& sets, const std::vector<ScenarioParams>& grid,
+                 const std::function<void(NetworkSimulator&)>& configure = nullptr) {
+        for (const auto& params : grid) {
+            for (const auto& set : sets) {
+                add(Scenario{set.name(), set, params, configure});
+            }
+        }
+    }
+
+    // Keep every simulator's per-step report in ScenarioResult::console
+    // instead of discarding it
+    void keepConsoleOutput(bool keep) { keepConsole = keep; }
+
+    // Generate the traffic of each distinct ScenarioParams once and replay
+    // it to every scenario with those parameters. The trace is recorded by
+    // the first such scenario's simulator setup, so scenarios sharing
+    // traffic should agree on event scheduling. Replays always run in
+    // packet mode.
+    void enableSharedTraffic(bool enable) { shareTraffic = enable; }
+
+    // Restore every scenario's simulator from warm instead of building a
+    // new one (nullptr goes back to that). The snapshot's network, seed and
+    // time step replace the scenario's numNodes, numAttackers and matrix
+    // seed; its mitigations and configure still apply on top, and the
+    // steps run from the snapshot's time step on. Scenarios restore from
+    // the snapshot concurrently without copying it first.
+    void startFrom(std::shared_ptr<const Snapshot> warm) { warmStart = std::move(warm); }
+
+    size_t size() const { return scenarios.size(); }
+    uint64_t seed() const { return baseSeed; }
+
+    // Seed of the scenario at index, derived from the matrix seed so a
+    // whole matrix is reproduced from one number
+    uint64_t scenarioSeed(size_t index) const { return CounterRng(baseSeed).at(kScenarioSeedStream, index); }
+
+    // Run every scenario on numThreads threads, the calling one included
+    std::vector<ScenarioResult> run(size_t numThreads = defaultThreads()) const {
+        ThreadPool pool(std::max<size_t>(1, std::min(numThreads, scenarios.size())));
+        std::vector<std::shared_ptr<const TrafficTrace>> traces(scenarios.size());
+        if (shareTraffic) {
+            // Record a trace per distinct parameter set, owned by the first
+            // scenario with those parameters
+            std::vector<size_t> owners;
+            std::vector<size_t> traceOf(scenarios.size());
+            for (size_t i = 0; i < scenarios.size(); i++) {
+                size_t k = 0;
+                while (k < owners.size() && !scenarios[owners[k]].params.sameTraffic(scenarios[i].params)) k++;
+                if (k == owners.size()) owners.push_back(i);
+                traceOf[i] = k;
+            }
+            std::vector<std::shared_ptr<const TrafficTrace>> recorded(owners.size());
+            pool.parallelFor(owners.size(), [&](size_t k) { recorded[k] = recordTrace(owners[k]); });
+            for (size_t i = 0; i < scenarios.size(); i++) {
+                traces[i] = recorded[traceOf[i]];
+            }
+        }
+
+        std::vector<ScenarioResult> results(scenarios.size());
+        pool.parallelFor(scenarios.size(), [&](size_t i) { results[i] = runScenario(i, traces[i].get()); });
+        return results;
+    }
+
+    static size_t defaultThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+    // Apply scenario's mitigations and setup to simulator and run its
+    // steps from the simulator's current time step, replaying trace if
+    // given, tallying each step into result
+    static void runSteps(NetworkSimulator& simulator, const Scenario& scenario, const TrafficTrace* trace,
+                         ScenarioResult& result) {
+        const ScenarioParams& params = scenario.params;
+        scenario.mitigations.applyTo(simulator);
+        if (scenario.configure) scenario.configure(simulator);
+
+        result.steps.reserve(result.steps.size() + params.steps);
+        for (int step = 0; step < params.steps; step++) {
+            if (trace) {
+                simulator.processTraffic(trace->steps[step]);
+            } else {
+                simulator.runSimulation(1, params.targetNodeId, params.attackIntensity, params.legitimateTraffic);
+            }
+            result.steps.push_back(simulator.lastStepStats());
+            result.totals.merge(simulator.lastStepStats());
+            for (int c = 0; c < kNumTrafficClasses; c++) {
+                result.latency[c].merge(simulator.lastStepLatency(TrafficClass(c)));
+            }
+        }
+    }
+
+private:
+    static constexpr uint64_t kScenarioSeedStream = 1;
+
+    std::shared_ptr<const TrafficTrace> recordTrace(size_t index) const {
+        const Scenario& scenario = scenarios[index];
+        const ScenarioParams& params = scenario.params;
+        NetworkSimulator generator(warmStart ? 1 : params.numNodes, warmStart ? 0 : params.targetNodeId,
+                                   warmStart ? 0 : params.numAttackers, scenarioSeed(index));
+        generator.enableConsoleOutput(false);
+        if (warmStart) generator.restoreSnapshot(*warmStart);
+        if (scenario.configure) scenario.configure(generator);
+        return generator.recordTrace(params.steps, params.targetNodeId, params.attackIntensity,
+                                     params.legitimateTraffic);
+    }
+
+    // Run the scenario at index on its own traffic, or on trace if given
+    ScenarioResult runScenario(size_t index, const TrafficTrace* trace) const {
+        const Scenario& scenario = scenarios[index];
+        const ScenarioParams& params = scenario.params;
+        ScenarioResult result;
+        result.scenario = scenario;
+
+        auto start = std::chrono::steady_clock::now();
+        // A warm start only needs a placeholder network to restore into
+        NetworkSimulator simulator(warmStart ? 1 : params.numNodes, warmStart ? 0 : params.targetNodeId,
+                                   warmStart ? 0 : params.numAttackers, scenarioSeed(index));
+        if (warmStart) simulator.restoreSnapshot(*warmStart);
+        result.seed = trace ? trace->seed : simulator.seed();
+        std::ostringstream console;
+        if (keepConsole) {
+            simulator.setConsoleStream(console);
+        } else {
+            simulator.enableConsoleOutput(false);
+        }
+        runSteps(simulator, scenario, trace, result);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.console = console.str();
+        return result;
+    }
+
+    uint64_t baseSeed;
+    bool keepConsole;
+    bool shareTraffic;
+    std::shared_ptr<const Snapshot> warmStart;
+    std::vector<Scenario> scenarios;
+};
+
+// One row per scenario with its parameters and totals over all steps.
+// Legitimate latency percentiles, in microseconds, are added when any
+// scenario's packets took time to be delivered.
+inline void printScenarioTable(const std::vector<ScenarioResult>& results, std::ostream& out) {
+    size_t nameWidth = 10;
+    bool showLatency = false;
+    for (const auto& result : results) {
+        nameWidth = std::max(nameWidth, result.scenario.name.size() + 2);
+        showLatency = showLatency || result.latency[kLegitimateClass].max() > 0;
+    }
+    out << std::left << std::setw(nameWidth) << "scenario" << std::right << std::setw(7) << "nodes"
+        << std::setw(10) << "attackers" << std::setw(10) << "intensity" << std::setw(7) << "legit"
+        << std::setw(10) << "legit ok" << std::setw(10) << "blocked" << std::setw(13) << "legit drops"
+        << std::setw(14) << "attack in" << std::setw(10) << "transit" << std::setw(10) << "ms";
+    if (showLatency) {
+        out << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p999 us";
+    }
+    out << '\n';
+    for (const auto& result : results) {
+        const ScenarioParams& params = result.scenario.params;
+        const StepStats& totals = result.totals;
+        out << std::left << std::setw(nameWidth) << result.scenario.name << std::right
+            << std::setw(7) << params.numNodes << std::setw(10) << params.numAttackers
+            << std::setw(10) << params.attackIntensity << std::setw(7) << params.legitimateTraffic
+            << std::fixed << std::setprecision(1)
+            << std::setw(9) << 100 * result.legitimateDelivered() << '%'
+            << std::setw(9) << 100 * result.attackBlocked() << '%'
+            << std::setw(13) << totals.legitimateDropped << std::setw(14) << totals.attackProcessed
+            << std::setw(10) << totals.transitDropped << std::setw(10) << 1000 * result.seconds
+            << std::defaultfloat << std::setprecision(6);
+        if (showLatency) {
+            const LatencyHistogram& legitimate = result.latency[kLegitimateClass];
+            out << std::setw(10) << legitimate.percentile(50) << std::setw(10) << legitimate.percentile(99)
+                << std::setw(10) << legitimate.percentile(99.9);
+        }
+        out << '\n';
+    }
+}
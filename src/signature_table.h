@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Interned packet signatures.
+// Each distinct signature string is registered once and mapped to a dense
+// 32-bit id; packets only carry the id. Attributes that mitigation stages
+// need per packet (such as whether the signature belongs to the attack class)
+// are computed at registration time and kept in flat arrays indexed by id.
+// A numbered family such as one signature per attacker is registered as a
+// range, whose names are formatted on demand rather than stored.
+class SignatureTable {
+public:
+    static constexpr uint32_t kInvalidId = UINT32_MAX;
+
+    // Return the id for a signature, registering it on first use
+    uint32_t intern(const std::string& name) {
+        uint32_t found = find(name);
+        if (found != kInvalidId) {
+            return found;
+        }
+        uint32_t id = static_cast<uint32_t>(attackClass.size());
+        names.push_back(name);
+        nameIds.push_back(id);
+        attackClass.push_back(isAttackName(name));
+        ids.emplace(name, id);
+        return id;
+    }
+
+    // Register prefix + "0" through prefix + (count - 1) under consecutive
+    // ids and return the first. Names of the range already registered one
+    // by one keep their own ids, so register a range before its members.
+    uint32_t internRange(const std::string& prefix, uint32_t count) {
+        uint32_t first = static_cast<uint32_t>(attackClass.size());
+        ranges.push_back(Range{prefix, first, count});
+        attackClass.resize(first + size_t(count), isAttackName(prefix));
+        return first;
+    }
+
+    // Look up a signature without registering it
+    uint32_t find(const std::string& name) const {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        for (const Range& range : ranges) {
+            uint32_t member = range.member(name);
+            if (member != kInvalidId) return range.first + member;
+        }
+        return kInvalidId;
+    }
+
+    std::string name(uint32_t id) const {
+        for (const Range& range : ranges) {
+            if (id - range.first < range.count) return range.prefix + std::to_string(id - range.first);
+        }
+        return names[std::lower_bound(nameIds.begin(), nameIds.end(), id) - nameIds.begin()];
+    }
+    bool isAttackClass(uint32_t id) const { return attackClass[id] != 0; }
+    size_t size() const { return attackClass.size(); }
+
+    // The name index is rebuilt rather than stored
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(names, nameIds, attackClass, ranges);
+        if constexpr (Archive::kLoading) {
+            ids.clear();
+            for (size_t i = 0; i < names.size(); i++) ids.emplace(names[i], nameIds[i]);
+        }
+    }
+
+private:
+    struct Range {
+        std::string prefix;
+        uint32_t first;
+        uint32_t count;
+
+        // Number of name within the range, or kInvalidId
+        uint32_t member(const std::string& name) const {
+            size_t digits = name.size() - prefix.size();
+            if (name.size() <= prefix.size() || digits > 10 || name.compare(0, prefix.size(), prefix) != 0 ||
+                (digits > 1 && name[prefix.size()] == '0')) {
+                return kInvalidId;
+            }
+            uint64_t number = 0;
+            for (size_t i = prefix.size(); i < name.size(); i++) {
+                if (name[i] < '0' || name[i] > '9') return kInvalidId;
+                number = number * 10 + uint64_t(name[i] - '0');
+            }
+            return number < count ? uint32_t(number) : kInvalidId;
+        }
+
+        template <typename Archive>
+        void serialize(Archive& archive) { archive(prefix, first, count); }
+    };
+
+    static uint8_t isAttackName(const std::string& name) {
+        return name.find("attack") != std::string::npos ? 1 : 0;
+    }
+
+    std::vector<std::string> names;     // Signatures registered one by one
+    std::vector<uint32_t> nameIds;      // Id of each of names, ascending
+    std::vector<uint8_t> attackClass;   // 1 if the signature is in the attack class, for every id
+    std::vector<Range> ranges;
+    std::unordered_map<std::string, uint32_t> ids;
+};
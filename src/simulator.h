@@ -0,0 +1,1625 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <variant>
+
+#include "counters.h"
+#include "event_queue.h"
+#include "flow_buffer.h"
+#include "histogram.h"
+#include "ingress_queue.h"
+#include "metrics.h"
+#include "mitigation.h"
+#include "packet_buffer.h"
+#include "partition.h"
+#include "random.h"
+#include "routing.h"
+#include "signature_table.h"
+#include "snapshot.h"
+#include "topology.h"
+#include "trace_file.h"
+#include "traffic_model.h"
+#include "traffic_pipeline.h"
+#include "traffic_trace.h"
+
+// Network node representation
+class Node {
+public:
+    int id;
+    int capacity;         // Maximum packets per second this node can process
+    int currentLoad;      // Current load on this node
+    bool isAttacker;      // Flag to mark if this is an attacker node
+    IngressQueue ingress; // Packets waiting for the node when ingress queueing is on
+    
+    Node(int _id, int _capacity, bool _isAttacker = false) :
+        id(_id), capacity(_capacity), currentLoad(0), isAttacker(_isAttacker) {}
+    
+    // Placeholder for a node about to be restored from a snapshot
+    Node() : Node(0, 0) {}
+    
+    bool canHandlePacket() {
+        return currentLoad < capacity;
+    }
+    
+    void processPacket() {
+        currentLoad++;
+    }
+    
+    void processPackets(int count) {
+        currentLoad += count;
+    }
+    
+    void resetLoad() {
+        currentLoad = 0;
+    }
+    
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(id, capacity, currentLoad, isAttacker, ingress); }
+};
+
+// Packet tallies for one simulation step
+struct StepStats {
+    int packetsProcessed = 0;
+    int legitimateProcessed = 0;
+    int attackProcessed = 0;
+    int packetsDropped = 0;
+    int legitimateDropped = 0;
+    int attackDropped = 0;
+    int transitDropped = 0;     // Dropped on a saturated link or router, part of packetsDropped
+    int stageDropped[kNumStageSlots] = {};     // Dropped by each mitigation stage, see StageSlot
+    
+    void recordProcessed(bool isLegitimate, int count = 1) {
+        packetsProcessed += count;
+        if (isLegitimate) legitimateProcessed += count;
+        else attackProcessed += count;
+    }
+    
+    void recordDropped(bool isLegitimate, int count = 1) {
+        packetsDropped += count;
+        if (isLegitimate) legitimateDropped += count;
+        else attackDropped += count;
+    }
+    
+    void recordTransitDropped(bool isLegitimate, int count = 1) {
+        recordDropped(isLegitimate, count);
+        transitDropped += count;
+    }
+    
+    // Tally 64 packets at once from bit masks of the processed packets, those
+    // dropped by a mitigation and those lost in transit
+    void recordWord(uint64_t processed, uint64_t dropped, uint64_t lostInTransit, uint64_t legitimate) {
+        int processedLegitimate = popcount64(processed & legitimate);
+        int droppedLegitimate = popcount64((dropped | lostInTransit) & legitimate);
+        int processedCount = popcount64(processed);
+        int droppedCount = popcount64(dropped | lostInTransit);
+        packetsProcessed += processedCount;
+        legitimateProcessed += processedLegitimate;
+        attackProcessed += processedCount - processedLegitimate;
+        packetsDropped += droppedCount;
+        legitimateDropped += droppedLegitimate;
+        attackDropped += droppedCount - droppedLegitimate;
+        transitDropped += popcount64(lostInTransit);
+    }
+    
+    void merge(const StepStats& other) {
+        packetsProcessed += other.packetsProcessed;
+        legitimateProcessed += other.legitimateProcessed;
+        attackProcessed += other.attackProcessed;
+        packetsDropped += other.packetsDropped;
+        legitimateDropped += other.legitimateDropped;
+        attackDropped += other.attackDropped;
+        transitDropped += other.transitDropped;
+        for (int s = 0; s < kNumStageSlots; s++) {
+            stageDropped[s] += other.stageDropped[s];
+        }
+    }
+};
+
+// Part of a network held by one simulator of a sharded run: the nodes
+// whose id is index modulo count. The default holds the whole network.
+struct NodeShard {
+    int index = 0;
+    int count = 1;
+};
+
+// How a simulator builds its network and mitigation state
+struct NetworkConfig {
+    int targetCapacity = 1000;      // Packets per step the target node can take
+    int nodeCapacity = 500;         // Packets per step every other node can take
+    NodeShard shard;
+    CounterStorage counterStorage = CounterStorage::Automatic;     // Picked from the number of nodes
+};
+
+// Network simulator
+class NetworkSimulator {
+private:
+    std::vector<Node> nodes;    // The shard's nodes, by local id: node id / shard.count
+    int targetNode;         // Node built with the target's capacity
+    NodeShard shard;
+    int networkNodes;       // Nodes in the whole network, every one a possible source
+    Topology topology;      // Network links in CSR form
+    
+    // Multi-hop forwarding
+    bool routing;
+    RoutingTable routes;
+    std::vector<int> linkCapacity;          // Packets per step, per directed link
+    std::vector<int> linkLoad;              // Packets sent over each directed link this step
+    std::vector<uint8_t> transitDropped;    // Per packet, set when forwarding failed
+    PacketBuffer packets;   // Packets generated for, then arriving in, the current step
+    const PacketBuffer* traffic;    // Packets of the current step: packets or a step of a shared trace
+    FlowBuffer flows;       // Flows generated for the current step in aggregate mode
+    int timeStep;
+    bool aggregateMode;
+    bool consoleOutput;
+    std::ostream* console;  // Where the per-step report goes; not owned
+    StepStats lastStats;    // Tallies of the most recent step
+    MetricsExporter* metrics;   // Receives a record per step when set; not owned
+    TraceWriter* traceRecorder; // Receives each step's packets when set; not owned
+    
+    // Discrete-event timing
+    struct PendingPacket {
+        int sourceId;
+        int destinationId;
+        uint32_t signatureId;
+        bool isLegitimate;
+        int64_t sendTime;
+    };
+    bool eventScheduling;
+    int64_t linkLatency;                        // Microseconds per hop when routing
+    CalendarQueue<PendingPacket> pendingPackets;    // Packets in flight, keyed by arrival time
+    
+    // Ingress queues in front of the nodes
+    bool ingressQueueing;
+    IngressQueueConfig ingressConfig;
+    
+    // Delivery latency, from send time to delivery, by traffic class.
+    // Deliveries in a row with the same node, class and latency, which is
+    // every delivery without per-packet timing, are recorded as one.
+    struct DeliveryRecorder {
+        LatencyByClass step;            // Packets delivered this step
+        int nodeId = -1;                // Run of deliveries not yet recorded
+        bool isLegitimate = false;
+        int64_t latency = 0;
+        uint64_t count = 0;
+        
+        template <typename Archive>
+        void serialize(Archive& archive) { archive(step, nodeId, isLegitimate, latency, count); }
+    };
+    DeliveryRecorder delivered;
+    std::vector<DeliveryRecorder> partitionDelivered;   // Per partition of the parallel path
+    LatencyByClass runLatency;      // Every step so far
+    bool nodeLatencyTracking;       // Off by default: a replayed capture can have millions of nodes
+    std::vector<std::unique_ptr<LatencyByClass>> nodeLatency;   // Per destination over every step, made on first use
+    
+    // Mitigation strategies
+    bool rateLimit;
+    bool ipFiltering;
+    bool deepPacketInspection;
+    bool trafficPatternAnalysis;
+    BlocklistTally blocklistTotal;      // IP filter blocklist activity over every step
+    
+    static constexpr size_t kPatternWindowSteps = 5;    // Sliding window length for pattern analysis
+    static constexpr int kDefaultSourceRate = 100;      // Packets per step each source may send
+    
+    // Source token bucket settings. A destination's bucket refills at its
+    // own capacity per step.
+    int sourceRate;
+    int sourceBurst;
+    
+    // Interned packet signatures
+    SignatureTable signatures;
+    uint32_t legitimateSignatureId;
+    std::vector<uint32_t> nodeSignatureIds;     // Signature an attacker node stamps on its packets
+    
+    // Mitigation stage state, in pipeline order. Stages registered at run
+    // time come last. The counting stages' storage is a template parameter,
+    // picked once at construction, so the packet loops call it directly.
+    template <typename Counters>
+    using MitigationStages = std::tuple<IPFilterStage<Counters>, InspectionStage<Counters>, SourceRateLimitStage,
+                                        DestinationRateLimitStage, PatternStage, RuntimePipeline>;
+    using StageSet = std::variant<MitigationStages<DenseCounterStore>, MitigationStages<SparseCounterStore>>;
+    StageSet mitigations;
+    
+    // Counter-based random number generator
+    CounterRng rng;
+    static constexpr uint64_t kLegitimateSourceStream = 1;
+    static constexpr uint64_t kSendTimeStream = 2;
+    static constexpr uint64_t kQueueDropStream = 3;
+    static constexpr size_t kGenerationBlock = 1 << 16;    // Packets per generation task
+    
+    // Source lists built once from the node roles, of the shard's nodes
+    std::vector<int> legitimateSources;     // Nodes that send legitimate traffic
+    std::vector<int> attackerNodes;
+    
+    // The shard's part of the legitimate traffic: the legitimate sources'
+    // weights summed over the shards before it and through it, out of the
+    // total. Generation streams are offset per shard so shards draw
+    // independently.
+    struct LegitimateShare {
+        double before = 0;
+        double through = 1;
+        double total = 1;
+        
+        // Rounding at the shared boundaries keeps the shards' counts
+        // summing to legitimateTraffic
+        size_t count(int legitimateTraffic) const {
+            auto upTo = [&](double weight) {
+                return weight >= total ? double(legitimateTraffic) : std::floor(legitimateTraffic * weight / total);
+            };
+            return static_cast<size_t>(std::max(0.0, upTo(through) - upTo(before)));
+        }
+    };
+    LegitimateShare legitimateShare;
+    LegitimateShare modelShare;     // By the traffic model's weights
+    uint64_t streamOffset;
+    std::vector<size_t> attackOffsets;      // First packet of each attacker's flood this step
+    
+    // Traffic model, when set, and the first packet of each legitimate
+    // user's run this step under on-off users
+    bool trafficModeling;
+    ArrivalSampler arrivals;
+    std::vector<size_t> userOffsets;
+    
+    // Parallel processing state, reused across steps
+    std::unique_ptr<ThreadPool> workers;
+    std::unique_ptr<TrafficPipeline> generators;    // Set when generation runs ahead of processing
+    PartitionIndex partitionIndex;
+    std::vector<uint8_t> droppedFlags;      // Per packet: 0 if it passed the filter phases, else 1 + StageSlot
+    std::vector<int32_t> blockScratch;      // Scratch values for the serial path's block kernels
+    std::vector<StepStats> partitionStats;
+    
+    // Stages selected by the mitigation switches, one bit per element of
+    // MitigationStages
+    unsigned stageMask() const {
+        return (ipFiltering ? 1u << 0 : 0) |
+               (deepPacketInspection ? 1u << 1 : 0) |
+               (rateLimit && sourceRate > 0 ? 1u << 2 : 0) |
+               (rateLimit ? 1u << 3 : 0) |
+               (trafficPatternAnalysis ? 1u << 4 : 0) |
+               (!stage<RuntimePipeline>().empty() ? 1u << 5 : 0);
+    }
+    
+    // Replace the stages with fresh ones counting into dense or sparse
+    // stores. Stages registered at run time carry over.
+    void resetStages(bool denseCounters) {
+        RuntimePipeline runtimeStages = std::move(stage<RuntimePipeline>());
+        if (denseCounters) {
+            emplaceStages<DenseCounterStore>(std::move(runtimeStages));
+        } else {
+            emplaceStages<SparseCounterStore>(std::move(runtimeStages));
+        }
+    }
+    
+    // Built in place, as assigning a whole stage set trips GCC's
+    // -Wstringop-overflow under some -march targets
+    template <typename Counters>
+    void emplaceStages(RuntimePipeline runtimeStages) {
+        mitigations.template emplace<MitigationStages<Counters>>(
+            IPFilterStage<Counters>(networkNodes), InspectionStage<Counters>(&signatures), SourceRateLimitStage(),
+            DestinationRateLimitStage(), PatternStage(kPatternWindowSteps), std::move(runtimeStages));
+    }
+    
+    // Call fn with the mitigation stages, whichever counter store they use
+    template <typename Fn>
+    decltype(auto) withStages(Fn&& fn) { return std::visit(std::forward<Fn>(fn), mitigations); }
+    
+    template <typename Fn>
+    decltype(auto) withStages(Fn&& fn) const { return std::visit(std::forward<Fn>(fn), mitigations); }
+    
+    // A stage that keeps no counters
+    template <typename Stage>
+    Stage& stage() { return *withStages([](auto& stages) { return &std::get<Stage>(stages); }); }
+    
+    template <typename Stage>
+    const Stage& stage() const { return *withStages([](const auto& stages) { return &std::get<Stage>(stages); }); }
+    
+    bool blocklisting() const {
+        if (!ipFiltering) return false;
+        return withStages([](const auto& stages) { return stageOf<IPFilterStage>(stages).config.blocklist; });
+    }
+    
+    BlocklistTally stepBlocklist() const {
+        return withStages([](const auto& stages) { return stageOf<IPFilterStage>(stages).stepTally(); });
+    }
+    
+    PacketView packetView(size_t i) const {
+        return PacketView{traffic->sourceIds[i], traffic->destinationIds[i], traffic->signatureIds[i],
+                          traffic->isLegitimate(i), traffic->arrivalTimes[i]};
+    }
+    
+    // Send count packets from source toward the destination of table and
+    // return how many arrive. Every link and intermediate node passes as
+    // many as it still has capacity for this step and only packets that get
+    // through load the next hop.
+    int forward(const RoutingTable::Routes& table, int sourceId, int destinationId, int count) {
+        if (table.nextHop[sourceId] < 0) return 0;
+        for (int node = sourceId; node != destinationId && count > 0; ) {
+            size_t link = table.nextLink[node];
+            count = std::min(count, std::max(0, linkCapacity[link] - linkLoad[link]));
+            linkLoad[link] += count;
+            node = table.nextHop[node];
+            if (node != destinationId) {
+                if (count == 1) {
+                    if (!nodes[node].canHandlePacket()) return 0;
+                    nodes[node].processPacket();
+                } else {
+                    count = std::min(count, std::max(0, nodes[node].capacity - nodes[node].currentLoad));
+                    nodes[node].processPackets(count);
+                }
+            }
+        }
+        return count;
+    }
+    
+    int64_t stepStartTime() const { return int64_t(timeStep) * kMicrosPerStep; }
+    
+    bool ownsNode(int nodeId) const { return nodeId % shard.count == shard.index; }
+    int localNode(int nodeId) const { return nodeId / shard.count; }
+    
+    // Throw std::invalid_argument in a shard for what needs every node, such
+    // as traffic addressed by global node id
+    void requireWholeNetwork(const char* what) const {
+        if (shard.count > 1) {
+            throw std::invalid_argument(std::string(what) + " needs the whole network, not a shard of it");
+        }
+    }
+    
+    static uint64_t packetKey(int step, size_t i) { return (uint64_t(step) << 32) | i; }
+    
+    int64_t sendTimeOf(int step, size_t i) const {
+        int64_t offset = eventScheduling
+                       ? rng.below(kSendTimeStream + streamOffset, packetKey(step, i), kMicrosPerStep) : 0;
+        return int64_t(step) * kMicrosPerStep + offset;
+    }
+    
+    // Lay out a step of packets starting at index base: legitimate packets
+    // first, then each attacker's flood in node order. With a traffic model
+    // the counts are the model's for the current step, on-off users send a
+    // run each and an attacker's spoofed packets open its flood. Sets
+    // attackOffsets and userOffsets and returns the index past the last
+    // packet.
+    size_t layOutStep(size_t base, double attackIntensity, int legitimateTraffic) {
+        size_t legitimateCount = legitimateSources.empty() ? 0
+                               : (trafficModeling ? modelShare : legitimateShare).count(legitimateTraffic);
+        if (trafficModeling) {
+            arrivals.prepare(rng, timeStep, attackIntensity, legitimateTraffic);
+        }
+        size_t total = base;
+        userOffsets.clear();
+        if (trafficModeling && arrivals.onOff()) {
+            for (size_t u = 0; u < legitimateSources.size(); u++) {
+                userOffsets.push_back(total);
+                total += arrivals.userCount(u);
+            }
+            userOffsets.push_back(total);
+        } else {
+            total += legitimateCount;
+        }
+        attackOffsets.clear();
+        for (size_t k = 0; k < attackerNodes.size(); k++) {
+            attackOffsets.push_back(total);
+            total += trafficModeling ? arrivals.attackCount(k)
+                                     : static_cast<int>(attackIntensity * nodes[localNode(attackerNodes[k])].capacity);
+        }
+        attackOffsets.push_back(total);
+        return total;
+    }
+    
+    // Source of legitimate packet i of step when it is drawn per packet: a
+    // random non-attacker node of the shard, or a user drawn by weight
+    // under a model
+    int legitimateSourceOf(int step, size_t i) const {
+        if (trafficModeling) return legitimateSources[arrivals.userOf(rng, packetKey(step, i))];
+        return legitimateSources[rng.below(kLegitimateSourceStream + streamOffset, packetKey(step, i),
+                                           legitimateSources.size())];
+    }
+    
+    // Fill packets [begin, end) of step, laid out by layOutStep(), into out.
+    // Every random draw is keyed by the packet's step and index, so blocks
+    // can be generated in any order and on any thread; nothing written by
+    // processing is read.
+    void fillPackets(PacketBuffer& out, int step, int targetNodeId, size_t begin, size_t end) const {
+        emitPackets(step, begin, end,
+                    [&](size_t i, int sourceId, bool isLegitimate, int64_t sendTime, uint32_t signatureId) {
+                        out.set(i, sourceId, targetNodeId, isLegitimate, sendTime, sendTime, signatureId);
+                    });
+    }
+    
+    // Draw packets [begin, end) of step and pass each to emit(i, sourceId,
+    // isLegitimate, sendTime, signatureId), in index order
+    template <typename Emit>
+    void emitPackets(int step, size_t begin, size_t end, Emit emit) const {
+        size_t i = begin;
+        size_t legitimateEnd = std::min(end, attackOffsets.front());
+        if (!userOffsets.empty()) {
+            // A run from every on-off user
+            size_t u = std::upper_bound(userOffsets.begin(), userOffsets.end(), i) - userOffsets.begin() - 1;
+            for (; i < legitimateEnd; u++) {
+                int sourceId = legitimateSources[u];
+                size_t last = std::min(legitimateEnd, userOffsets[u + 1]);
+                for (; i < last; i++) {
+                    emit(i, sourceId, true, sendTimeOf(step, i), legitimateSignatureId);
+                }
+            }
+        } else {
+            for (; i < legitimateEnd; i++) {
+                emit(i, legitimateSourceOf(step, i), true, sendTimeOf(step, i), legitimateSignatureId);
+            }
+        }
+        // Attack traffic, spoofed packets first
+        size_t k = std::upper_bound(attackOffsets.begin(), attackOffsets.end(), i) - attackOffsets.begin() - 1;
+        for (; i < end; k++) {
+            int attackerId = attackerNodes[k];
+            size_t last = std::min(end, attackOffsets[k + 1]);
+            uint32_t signatureId = nodeSignatureIds[localNode(attackerId)];
+            if (trafficModeling) {
+                size_t spoofedEnd = std::min(last, attackOffsets[k] + arrivals.spoofedCount(k));
+                for (; i < spoofedEnd; i++) {
+                    emit(i, arrivals.spoofedSourceOf(rng, packetKey(step, i)), false, sendTimeOf(step, i),
+                         signatureId);
+                }
+            }
+            for (; i < last; i++) {
+                emit(i, attackerId, false, sendTimeOf(step, i), signatureId);
+            }
+        }
+    }
+    
+    // runSimulation() with generation on the pipeline's threads: this
+    // thread processes each step in place in the pipeline's buffer while
+    // later steps are being generated
+    void runPipelined(int steps, int targetNodeId, double attackIntensity, int legitimateTraffic) {
+        size_t stepPackets = layOutStep(0, attackIntensity, legitimateTraffic);
+        auto fill = [&](int step, size_t begin, size_t end, PacketBuffer& out) {
+            DDOS_PROBE(kProbeGenerate);
+            fillPackets(out, step, targetNodeId, begin, end);
+        };
+        generators->start(timeStep, steps, stepPackets, fill);
+        try {
+            for (int i = 0; i < steps; i++) {
+                processTraffic(generators->next());
+                generators->release();
+            }
+        } catch (...) {
+            // Generators may be waiting on steps that will never be taken
+            int numThreads = generators->numThreads();
+            PipelineOptions options = generators->options();
+            generators.reset(new TrafficPipeline(numThreads, options));
+            throw;
+        }
+    }
+    
+    // Hand the step's packets to the event queue and replace them with the
+    // packets whose arrival falls within this step, in arrival order.
+    // Anything arriving later stays in flight for a following step.
+    void schedulePackets() {
+        DDOS_PROBE(kProbeSchedule);
+        int64_t latency = routing ? linkLatency : 0;
+        const RoutingTable::Routes* table = nullptr;
+        int tableDestination = -1;
+        // Grow the queue once for the step rather than as pending peaks
+        pendingPackets.reserve(pendingPackets.size() + traffic->size());
+        for (size_t i = 0; i < traffic->size(); i++) {
+            int destinationId = traffic->destinationIds[i];
+            int hops = 0;
+            if (latency > 0) {
+                if (destinationId != tableDestination) {
+                    table = &routes.routesTo(topology, destinationId);
+                    tableDestination = destinationId;
+                }
+                hops = std::max(0, table->hopCount[traffic->sourceIds[i]]);
+            }
+            pendingPackets.push(traffic->timestamps[i] + hops * latency,
+                                PendingPacket{traffic->sourceIds[i], destinationId, traffic->signatureIds[i],
+                                              traffic->isLegitimate(i), traffic->timestamps[i]});
+        }
+        packets.clear();
+        traffic = &packets;
+        // Whatever arrives this step is pending now; with room for twice
+        // that, arrivals that peak above earlier steps do not allocate
+        if (packets.capacity() < pendingPackets.size()) packets.reserve(2 * pendingPackets.size());
+        DDOS_GAUGE(kGaugePendingPackets, pendingPackets.size());
+        pendingPackets.popUntil(stepStartTime() + kMicrosPerStep, [&](int64_t arrivalTime, const PendingPacket& p) {
+            packets.push(p.sourceId, p.destinationId, p.isLegitimate, p.sendTime, arrivalTime, p.signatureId);
+        });
+    }
+    
+    // Record count packets delivered to nodeId, latency microseconds after
+    // they were sent. Delivery is partitioned by destination, so only one
+    // thread touches a node's histograms.
+    void recordDelivery(DeliveryRecorder& recorder, int nodeId, bool isLegitimate, int64_t latency,
+                        uint64_t count = 1) {
+        if (nodeId == recorder.nodeId && isLegitimate == recorder.isLegitimate && latency == recorder.latency) {
+            recorder.count += count;
+            return;
+        }
+        startDeliveryRun(recorder, nodeId, isLegitimate, latency, count);
+    }
+    
+    // Kept out of line so the common case stays small in the delivery loops
+    __attribute__((noinline)) void startDeliveryRun(DeliveryRecorder& recorder, int nodeId, bool isLegitimate,
+                                                    int64_t latency, uint64_t count) {
+        flushDeliveries(recorder);
+        recorder.nodeId = nodeId;
+        recorder.isLegitimate = isLegitimate;
+        recorder.latency = latency;
+        recorder.count = count;
+    }
+    
+    // Add the recorder's pending run to its step and the node's histograms
+    void flushDeliveries(DeliveryRecorder& recorder) {
+        if (recorder.count == 0) return;
+        recorder.step.record(recorder.isLegitimate, recorder.latency, recorder.count);
+        if (nodeLatencyTracking) {
+            std::unique_ptr<LatencyByClass>& node = nodeLatency[recorder.nodeId];
+            if (!node) node.reset(new LatencyByClass());
+            node->record(recorder.isLegitimate, recorder.latency, recorder.count);
+        }
+        recorder.count = 0;
+        recorder.nodeId = -1;
+    }
+    
+    // Packets leaving an ingress queue load their node and count as
+    // processed as they are delivered
+    auto servedBy(Node& node, StepStats& stats, DeliveryRecorder& recorder) {
+        return [this, &node, &stats, &recorder](const QueuedPacket& packet, int64_t departure) {
+            node.processPacket();
+            stats.recordProcessed(packet.isLegitimate);
+            recordDelivery(recorder, node.id, packet.isLegitimate, departure - packet.sendTime);
+        };
+    }
+    
+    // Hand packet i, which passed every mitigation, to its destination's
+    // ingress queue
+    void enqueuePacket(size_t i, StepStats& stats, DeliveryRecorder& recorder) {
+        Node& node = nodes[traffic->destinationIds[i]];
+        if (!node.ingress.configured()) {
+            int drainRate = ingressConfig.drainRate > 0 ? ingressConfig.drainRate : node.capacity;
+            node.ingress.configure(ingressConfig, drainRate, kMicrosPerStep);
+        }
+        bool isLegitimate = traffic->isLegitimate(i);
+        double uniform = ingressConfig.discipline == QueueDiscipline::RED
+                       ? rng.uniform(kQueueDropStream + streamOffset, packetKey(i)) : 0.0;
+        QueuedPacket packet{traffic->arrivalTimes[i], traffic->timestamps[i], traffic->sourceIds[i], isLegitimate};
+        if (!node.ingress.offer(packet, uniform, servedBy(node, stats, recorder))) {
+            stats.recordDropped(isLegitimate);
+            stats.stageDropped[kIngressQueueSlot]++;
+        }
+    }
+    
+    // Queues are configured when their first packet arrives
+    void resetIngressQueues() {
+        for (auto& node : nodes) node.ingress = IngressQueue();
+    }
+    
+    // Serve what the ingress queues finish by the end of the step; the rest
+    // waits for the next one
+    void drainIngressQueues(StepStats& stats) {
+        DDOS_PROBE(kProbeFirstStage + kIngressQueueSlot);
+        int64_t stepEnd = stepStartTime() + kMicrosPerStep;
+        for (auto& node : nodes) {
+            if (node.ingress.size() > 0) {
+                node.ingress.advance(stepEnd, servedBy(node, stats, delivered));
+            }
+        }
+    }
+    
+    // Forward every packet of the step in order, flagging the ones lost on the way
+    void forwardPackets() {
+        DDOS_PROBE(kProbeForward);
+        size_t packetCount = traffic->size();
+        if (transitDropped.capacity() < packetCount) transitDropped.reserve(2 * packetCount);
+        transitDropped.assign(packetCount, 0);
+        const RoutingTable::Routes* table = nullptr;
+        int tableDestination = -1;
+        for (size_t i = 0; i < packetCount; i++) {
+            int destinationId = traffic->destinationIds[i];
+            if (destinationId != tableDestination) {
+                table = &routes.routesTo(topology, destinationId);
+                tableDestination = destinationId;
+            }
+            transitDropped[i] = forward(*table, traffic->sourceIds[i], destinationId, 1) == 0;
+        }
+    }
+    
+    // Aggregate counterpart of processSerial(). Each stage admits a flow's
+    // packets in one call; the built-in ones are thresholds on counters
+    // that grow by one per packet or token buckets, so the packets that pass
+    // form a prefix whose length is computed directly. The per-step
+    // statistics match packet mode.
+    template <typename Pipeline>
+    StepStats processFlowsSerial(Pipeline& pipeline) {
+        StepStats stats;
+        for (size_t f = 0; f < flows.size(); f++) {
+            int sourceId = flows.sourceIds[f];
+            int destinationId = flows.destinationIds[f];
+            bool isLegitimate = flows.legitimate[f];
+            int count = flows.counts[f];
+            
+            // Packets lost in transit never reach the mitigations
+            if (routing) {
+                int arrived = forward(routes.routesTo(topology, destinationId), sourceId, destinationId, count);
+                stats.recordTransitDropped(isLegitimate, count - arrived);
+                count = arrived;
+            }
+            
+            PacketView flow{sourceId, destinationId, flows.signatureIds[f], isLegitimate, flows.timestamps[f]};
+            int processed = count > 0 ? pipeline.admit(flow, count, stats.stageDropped) : 0;
+            
+            nodes[destinationId].processPackets(processed);
+            stats.recordProcessed(isLegitimate, processed);
+            if (processed > 0) recordDelivery(delivered, destinationId, isLegitimate, 0, processed);
+            stats.recordDropped(isLegitimate, count - processed);
+        }
+        return stats;
+    }
+    
+    // How the packets that pass the mitigations reach their nodes. Each
+    // mode has its own instantiation of deliverBlock(), so the delivery
+    // loop tests no mode flags.
+    enum class DeliveryMode {
+        Direct,     // Delivered at once with latency 0
+        Timed,      // Delivered at once; latency from send to arrival time
+        Queued,     // Offered to the destination's ingress queue
+    };
+    
+    DeliveryMode deliveryMode() const {
+        if (ingressQueueing) return DeliveryMode::Queued;
+        return eventScheduling ? DeliveryMode::Timed : DeliveryMode::Direct;
+    }
+    
+    // Deliver the packets of block whose bits are set in alive. Direct
+    // deliveries all have latency 0, so a run of packets to one node in one
+    // class is counted in registers and handed to the node and the latency
+    // recorder whole.
+    template <DeliveryMode Mode>
+    void deliverBlock(const PacketBlock& block, size_t begin, const uint64_t* alive, StepStats& stats) {
+        if constexpr (Mode == DeliveryMode::Queued) {
+            forEachSetBit(alive, block.size, [&](size_t j) { enqueuePacket(begin + j, stats, delivered); });
+        } else if constexpr (Mode == DeliveryMode::Timed) {
+            forEachSetBit(alive, block.size, [&](size_t j) {
+                int destinationId = block.destinationIds[j];
+                nodes[destinationId].processPacket();
+                int64_t latency = block.arrivalTimes[j] - traffic->timestamps[begin + j];
+                recordDelivery(delivered, destinationId, block.isLegitimate(j), latency);
+            });
+        } else {
+            int runNode = -1;
+            bool runLegitimate = false;
+            int runCount = 0;
+            forEachSetBit(alive, block.size, [&](size_t j) {
+                int destinationId = block.destinationIds[j];
+                bool isLegitimate = block.isLegitimate(j);
+                if (destinationId == runNode && isLegitimate == runLegitimate) {
+                    runCount++;
+                    return;
+                }
+                deliverRun(runNode, runLegitimate, runCount);
+                runNode = destinationId;
+                runLegitimate = isLegitimate;
+                runCount = 1;
+            });
+            deliverRun(runNode, runLegitimate, runCount);
+        }
+    }
+    
+    void deliverRun(int nodeId, bool isLegitimate, int count) {
+        if (count == 0) return;
+        nodes[nodeId].processPackets(count);
+        recordDelivery(delivered, nodeId, isLegitimate, 0, count);
+    }
+    
+    PacketBlock packetBlock(size_t begin, size_t count) const {
+        return PacketBlock{&traffic->sourceIds[begin], &traffic->destinationIds[begin], &traffic->signatureIds[begin],
+                           &traffic->arrivalTimes[begin], &traffic->legitimateBits[begin / 64], count};
+    }
+    
+    // Packets go through the stages a block at a time. Every stage sees the
+    // block's surviving packets in order, so each stage's state goes through
+    // the same updates as when packets are checked one by one, and the
+    // verdicts come out as bit masks that are tallied by popcount.
+    template <typename Pipeline>
+    StepStats processSerial(Pipeline& pipeline) {
+        StepStats stats;
+        size_t packetCount = traffic->size();
+        uint64_t valid[kBlockWords];
+        uint64_t alive[kBlockWords];
+        uint64_t lostInTransit[kBlockWords] = {};
+        DeliveryMode mode = deliveryMode();
+        for (size_t begin = 0; begin < packetCount; begin += kBlockSize) {
+            PacketBlock block = packetBlock(begin, std::min(kBlockSize, packetCount - begin));
+            size_t words = (block.size + 63) / 64;
+            fillMask(block.size, valid);
+            if (routing) {
+                nonZeroMask(&transitDropped[begin], block.size, lostInTransit);
+            }
+            for (size_t w = 0; w < words; w++) {
+                alive[w] = valid[w] & ~lostInTransit[w];
+            }
+            
+            // Apply mitigation techniques in order; each clears the packets it drops
+            pipeline.dropBlock(block, alive, blockScratch.data(), stats.stageDropped);
+            
+            // Queued packets are tallied as they are served
+            DDOS_PROBE(kProbeDeliver);
+            switch (mode) {
+                case DeliveryMode::Direct: deliverBlock<DeliveryMode::Direct>(block, begin, alive, stats); break;
+                case DeliveryMode::Timed: deliverBlock<DeliveryMode::Timed>(block, begin, alive, stats); break;
+                case DeliveryMode::Queued: deliverBlock<DeliveryMode::Queued>(block, begin, alive, stats); break;
+            }
+            for (size_t w = 0; w < words; w++) {
+                uint64_t dropped = valid[w] & ~alive[w] & ~lostInTransit[w];
+                stats.recordWord(ingressQueueing ? 0 : alive[w], dropped, lostInTransit[w],
+                                 block.legitimateBits[w] & valid[w]);
+            }
+        }
+        return stats;
+    }
+    
+    // Partition the packets still in play by keys[i] and run drops(i) on
+    // every partition in parallel, marking the packets it rejects as
+    // dropped by the stage in slot
+    template <typename Key, typename Check>
+    void runPhase(const std::vector<Key>& keys, int slot, Check drops) {
+        partitionIndex.build(keys.data(), traffic->size(), [&](size_t i) { return !droppedFlags[i]; }, *workers);
+        workers->parallelFor(kNumPartitions, [&](size_t p) {
+            DDOS_PROBE(kProbeFirstStage + slot);
+            DDOS_COUNT(kProbeFirstStage + slot, partitionIndex.end(p) - partitionIndex.begin(p), 0);
+            DDOS_GAUGE(kGaugePartitionSize, partitionIndex.end(p) - partitionIndex.begin(p));
+            for (const uint32_t* it = partitionIndex.begin(p); it != partitionIndex.end(p); ++it) {
+                droppedFlags[*it] = drops(*it) ? slot + 1 : 0;
+            }
+        });
+    }
+    
+    template <typename Check>
+    void runPhase(StageKey key, int slot, Check drops) {
+        switch (key) {
+            case StageKey::Source: runPhase(traffic->sourceIds, slot, drops); break;
+            case StageKey::Destination: runPhase(traffic->destinationIds, slot, drops); break;
+            case StageKey::Signature: runPhase(traffic->signatureIds, slot, drops); break;
+        }
+    }
+    
+    template <typename Stage>
+    void runStagePhase(Stage& stage) {
+        runPhase(Stage::kKey, Stage::kSlot, [&](uint32_t i) { return stage.drops(packetView(i)); });
+    }
+    
+    // Stages registered at run time each get a phase of their own
+    void runStagePhase(RuntimePipeline& custom) {
+        custom.forEachStage([&](MitigationStage& stage) {
+            runPhase(stage.key(), RuntimePipeline::kSlot, [&](uint32_t i) { return stage.drops(packetView(i)); });
+        });
+    }
+    
+    // Sharded version of processSerial().
+    // Each stage runs as its own phase over the packets that survived
+    // the previous ones, partitioned by the field the check is keyed on.
+    // Within a partition packets keep their original order and every key is
+    // owned by exactly one partition, so each piece of mitigation state sees
+    // the same update sequence as in the serial loop. Delivery runs last,
+    // partitioned by destination, and the per-partition tallies are merged
+    // in partition order.
+    template <typename Pipeline>
+    StepStats processParallel(Pipeline& pipeline) {
+        size_t packetCount = traffic->size();
+        if (routing) {
+            droppedFlags = transitDropped;
+        } else {
+            droppedFlags.assign(packetCount, 0);
+        }
+        
+        pipeline.forEachStage([&](auto& stage) { runStagePhase(stage); });
+        
+        // Delivery
+        partitionStats.assign(kNumPartitions, StepStats());
+        partitionDelivered.resize(kNumPartitions);
+        partitionIndex.build(traffic->destinationIds.data(), packetCount, [](size_t) { return true; }, *workers);
+        workers->parallelFor(kNumPartitions, [&](size_t p) {
+            DDOS_PROBE(kProbeDeliver);
+            StepStats& stats = partitionStats[p];
+            DeliveryRecorder& recorder = partitionDelivered[p];
+            for (const uint32_t* it = partitionIndex.begin(p); it != partitionIndex.end(p); ++it) {
+                uint32_t i = *it;
+                bool isLegitimate = traffic->isLegitimate(i);
+                if (routing && transitDropped[i]) {
+                    stats.recordTransitDropped(isLegitimate);
+                } else if (droppedFlags[i]) {
+                    stats.recordDropped(isLegitimate);
+                    stats.stageDropped[droppedFlags[i] - 1]++;
+                } else if (ingressQueueing) {
+                    enqueuePacket(i, stats, recorder);
+                } else {
+                    int destinationId = traffic->destinationIds[i];
+                    nodes[destinationId].processPacket();
+                    stats.recordProcessed(isLegitimate);
+                    int64_t latency = eventScheduling ? traffic->arrivalTimes[i] - traffic->timestamps[i] : 0;
+                    recordDelivery(recorder, destinationId, isLegitimate, latency);
+                }
+            }
+            flushDeliveries(recorder);
+        });
+        
+        StepStats stats;
+        for (const auto& partition : partitionStats) {
+            stats.merge(partition);
+        }
+        for (auto& recorder : partitionDelivered) {
+            delivered.step.merge(recorder.step);
+            recorder.step.clear();
+        }
+        return stats;
+    }
+    
+    // Carry the step's traffic to its destinations and through the mitigations
+    StepStats processStep() {
+        DDOS_PROBE(kProbeProcess);
+        
+        // Shared traffic always comes as packets
+        bool flowStep = aggregateMode && traffic == &packets;
+        delivered.step.clear();
+        if (traceRecorder && !flowStep) {
+            traceRecorder->writeStep(timeStep, *traffic);
+        }
+        
+        // Order the step's packets by arrival time
+        if (eventScheduling && !flowStep) {
+            schedulePackets();
+        }
+        
+        // Carry the packets across the network to their destinations
+        if (routing) {
+            std::fill(linkLoad.begin(), linkLoad.end(), 0);
+            if (!flowStep) forwardPackets();
+        }
+        
+        // Run the step's traffic through the enabled mitigation stages
+        StepStats stats;
+        withStages([&](auto& stages) {
+            withPipeline(stages, stageMask(), [&](auto pipeline) {
+                pipeline.beginStep();
+                if (flowStep) {
+                    stats = processFlowsSerial(pipeline);
+                } else {
+                    stats = workers ? processParallel(pipeline) : processSerial(pipeline);
+                }
+            });
+        });
+        if (ingressQueueing && !flowStep) {
+            drainIngressQueues(stats);
+        }
+        flushDeliveries(delivered);
+        runLatency.merge(delivered.step);
+        if (blocklisting()) {
+            blocklistTotal.merge(stepBlocklist());
+        }
+        
+#if DDOS_INSTRUMENTATION
+        DDOS_GAUGE(kGaugeStepPackets, stats.packetsProcessed + stats.packetsDropped);
+        for (int s = 0; s < kNumStageSlots; s++) {
+            DDOS_COUNT(kProbeFirstStage + s, 0, stats.stageDropped[s]);
+        }
+#endif
+        return stats;
+    }
+    
+    StepRecord stepRecord(const StepStats& stats) const {
+        StepRecord record;
+        record[kMetricTimeStep] = timeStep;
+        record[kMetricPacketsProcessed] = stats.packetsProcessed;
+        record[kMetricLegitimateProcessed] = stats.legitimateProcessed;
+        record[kMetricAttackProcessed] = stats.attackProcessed;
+        record[kMetricPacketsDropped] = stats.packetsDropped;
+        record[kMetricLegitimateDropped] = stats.legitimateDropped;
+        record[kMetricAttackDropped] = stats.attackDropped;
+        record[kMetricTransitDropped] = stats.transitDropped;
+        if (ownsNode(targetNode)) {
+            record[kMetricTargetLoad] = nodes[localNode(targetNode)].currentLoad;
+            record[kMetricTargetCapacity] = nodes[localNode(targetNode)].capacity;
+        }
+        const int kPercentiles[3][2] = {{kMetricLegitimateLatencyP50, kMetricAttackLatencyP50},
+                                        {kMetricLegitimateLatencyP99, kMetricAttackLatencyP99},
+                                        {kMetricLegitimateLatencyP999, kMetricAttackLatencyP999}};
+        const double kPercents[3] = {50, 99, 99.9};
+        for (int q = 0; q < 3; q++) {
+            for (int c = 0; c < kNumTrafficClasses; c++) {
+                record[kPercentiles[q][c]] = delivered.step[c].percentile(kPercents[q]);
+            }
+        }
+        if (blocklisting()) {
+            record[kMetricBlocklistSources] = blocklist().size();
+            record[kMetricBlocklistFalsePositives] = stepBlocklist().legitimateDropped;
+        }
+        for (int s = 0; s < kNumStageSlots; s++) {
+            record[kMetricFirstStageDropped + s] = stats.stageDropped[s];
+        }
+        return record;
+    }
+    
+    // Everything a run depends on, in snapshot order. Output wiring,
+    // threads, stages registered at run time and per-step scratch are left
+    // out; the routing cache is rebuilt on demand.
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(nodes, targetNode, shard, networkNodes, topology, routing, linkCapacity, linkLoad, packets, flows);
+        archive(timeStep, aggregateMode, lastStats);
+        archive(eventScheduling, linkLatency, pendingPackets, ingressQueueing, ingressConfig);
+        archive(delivered, runLatency, nodeLatencyTracking, nodeLatency);
+        archive(rateLimit, ipFiltering, deepPacketInspection, trafficPatternAnalysis, blocklistTotal);
+        archive(sourceRate, sourceBurst, signatures, legitimateSignatureId, nodeSignatureIds);
+        // A snapshot loads into stages of the counter storage it was taken
+        // with; stages registered at run time stay
+        bool denseCounters = mitigations.index() == 0;
+        archive(denseCounters);
+        if constexpr (Archive::kLoading) {
+            if (denseCounters != (mitigations.index() == 0)) resetStages(denseCounters);
+        }
+        withStages([&](auto& stages) {
+            archive(stageOf<IPFilterStage>(stages), stageOf<InspectionStage>(stages),
+                    std::get<SourceRateLimitStage>(stages), std::get<DestinationRateLimitStage>(stages),
+                    std::get<PatternStage>(stages));
+        });
+        archive(rng, legitimateSources, attackerNodes, legitimateShare, modelShare, streamOffset,
+                trafficModeling, arrivals);
+        if constexpr (Archive::kLoading) {
+            routes.clear();
+            traffic = &packets;
+        }
+    }
+    
+    // Console report of one step
+    void printStepStats(const StepStats& stats) const {
+        *console << "Time step: " << timeStep << '\n';
+        *console << "Packets processed: " << stats.packetsProcessed
+                  << " (Legitimate: " << stats.legitimateProcessed
+                  << ", Attack: " << stats.attackProcessed << ")" << '\n';
+        *console << "Packets dropped: " << stats.packetsDropped
+                  << " (Legitimate: " << stats.legitimateDropped
+                  << ", Attack: " << stats.attackDropped << ")" << '\n';
+        if (routing) {
+            *console << "Dropped in transit: " << stats.transitDropped << '\n';
+        }
+        if (eventScheduling) {
+            *console << "Packets in flight: " << pendingPackets.size() << '\n';
+        }
+        if (ingressQueueing) {
+            *console << "Packets queued: " << queuedPackets() << '\n';
+        }
+        const LatencyHistogram& legitimate = delivered.step[kLegitimateClass];
+        if ((eventScheduling || ingressQueueing) && !legitimate.empty()) {
+            *console << "Legitimate latency: p50 " << legitimate.percentile(50) << " us, p99 "
+                     << legitimate.percentile(99) << " us, p999 " << legitimate.percentile(99.9) << " us" << '\n';
+        }
+        if (blocklisting()) {
+            *console << "Blocklist: " << blocklist().size() << " sources, "
+                     << stepBlocklist().legitimateDropped << " legitimate packets dropped (false positives)" << '\n';
+        }
+        if (trafficPatternAnalysis) {
+            *console << "Top sources:";
+            auto top = stage<PatternStage>().heavyHitters.top();
+            for (size_t i = 0; i < top.size() && i < 3; i++) {
+                *console << (i ? ", " : " ") << top[i].first << " (" << top[i].second << ")";
+            }
+            *console << '\n';
+        }
+        if (ownsNode(targetNode)) {
+            *console << "Target node load: " << nodes[localNode(targetNode)].currentLoad
+                      << "/" << nodes[localNode(targetNode)].capacity << '\n';
+        }
+        *console << "----------------------------------" << '\n';
+    }
+    
+public:
+    NetworkSimulator(int numNodes, int targetNodeId, int numAttackers,
+                     uint64_t seed = CounterRng::randomSeed()) :
+        NetworkSimulator(numNodes, targetNodeId, numAttackers, seed, NetworkConfig()) {}
+    
+    // With config.shard set, a simulator of one shard of a network: it
+    // holds only the shard's nodes, under local ids, and generates only the
+    // traffic they send, drawn independently of the other shards. Packets it
+    // processes must carry local destination ids; source ids stay those of
+    // the network, so state keyed by source covers every node. It generates
+    // through generateShardTraffic(); routing, aggregate mode and the
+    // single-target generators throw. Throws std::invalid_argument for a
+    // bad shard.
+    NetworkSimulator(int numNodes, int targetNodeId, int numAttackers, uint64_t seed, const NetworkConfig& config) :
+        targetNode(targetNodeId),
+        shard(config.shard),
+        networkNodes(numNodes),
+        routing(false),
+        traffic(&packets),
+        timeStep(0),
+        aggregateMode(false),
+        consoleOutput(true),
+        console(&std::cout),
+        metrics(nullptr),
+        traceRecorder(nullptr),
+        eventScheduling(false),
+        linkLatency(1000),
+        ingressQueueing(false),
+        nodeLatencyTracking(false),
+        rateLimit(false),
+        ipFiltering(false),
+        deepPacketInspection(false),
+        trafficPatternAnalysis(false),
+        sourceRate(kDefaultSourceRate),
+        sourceBurst(kDefaultSourceRate),
+        rng(seed),
+        streamOffset(uint64_t(config.shard.index) << 32),
+        trafficModeling(false),
+        blockScratch(kBlockSize) {
+        if (shard.count < 1 || shard.index < 0 || shard.index >= shard.count) {
+            throw std::invalid_argument("Shard index must be below a positive shard count");
+        }
+        resetStages(usesDenseCounters(config.counterStorage, uint64_t(std::max(0, numNodes))));
+        numAttackers = std::max(0, std::min(numAttackers, numNodes));
+        
+        // Initialize the shard's nodes; attackers are the first numAttackers
+        for (int i = shard.index; i < numNodes; i += shard.count) {
+            bool isAttacker = (i < numAttackers);
+            
+            // Set capacity - target node has higher capacity
+            int capacity = (i == targetNodeId) ? config.targetCapacity : config.nodeCapacity;
+            
+            nodes.push_back(Node(static_cast<int>(nodes.size()), capacity, isAttacker));
+            (isAttacker ? attackerNodes : legitimateSources).push_back(i);
+        }
+        int numLocal = static_cast<int>(nodes.size());
+        nodeLatency.resize(numLocal);
+        stage<SourceRateLimitStage>().buckets.resize(numNodes, sourceRate, sourceBurst);
+        TokenBucketArray& destinationBuckets = stage<DestinationRateLimitStage>().buckets;
+        destinationBuckets.resize(numLocal, 0, 0);
+        for (int i = 0; i < numLocal; i++) {
+            destinationBuckets.configure(i, nodes[i].capacity, nodes[i].capacity);
+        }
+        
+        // Legitimate sources of the shards before this one and of this one
+        auto congruentBelow = [&](int limit, int index) {
+            return limit > index ? (limit - index - 1) / shard.count + 1 : 0;
+        };
+        auto legitimateOf = [&](int index) {
+            return double(congruentBelow(numNodes, index) - congruentBelow(numAttackers, index));
+        };
+        legitimateShare.total = double(numNodes - numAttackers);
+        legitimateShare.before = 0;
+        for (int j = 0; j < shard.index; j++) legitimateShare.before += legitimateOf(j);
+        legitimateShare.through = legitimateShare.before + legitimateOf(shard.index);
+        
+        // Register signatures once so packets only carry an id. Attacker i
+        // signs "attack_<i>", the same id in every shard.
+        legitimateSignatureId = signatures.intern("legitimate");
+        uint32_t firstAttackSignatureId = signatures.internRange("attack_", static_cast<uint32_t>(numAttackers));
+        nodeSignatureIds.assign(numLocal, legitimateSignatureId);
+        for (int i = 0; i < numLocal; i++) {
+            if (nodes[i].isAttacker) {
+                nodeSignatureIds[i] = firstAttackSignatureId + uint32_t(i * shard.count + shard.index);
+            }
+        }
+        
+        // Every node reaches the target over a single link by default
+        setTopology(Topology::star(numLocal, ownsNode(targetNodeId) ? localNode(targetNodeId) : 0));
+    }
+    
+    // Replace the network topology, e.g. with one of the Topology generators
+    void setTopology(Topology newTopology) {
+        if (newTopology.numNodes() != static_cast<int>(nodes.size())) {
+            throw std::invalid_argument("Topology size does not match the number of nodes");
+        }
+        topology = std::move(newTopology);
+        routes.clear();
+        
+        // A link carries at most what the slower of its two endpoints can handle
+        linkCapacity.resize(topology.neighbors.size());
+        for (int u = 0; u < topology.numNodes(); u++) {
+            for (size_t e = topology.offsets[u]; e < topology.offsets[u + 1]; e++) {
+                linkCapacity[e] = std::min(nodes[u].capacity, nodes[topology.neighbors[e]].capacity);
+            }
+        }
+        linkLoad.assign(linkCapacity.size(), 0);
+    }
+    
+    // Give every link the same capacity, in packets per step
+    void setLinkCapacity(int capacity) {
+        std::fill(linkCapacity.begin(), linkCapacity.end(), capacity);
+    }
+    
+    const Topology& getTopology() const { return topology; }
+    
+    // Seed used for traffic generation; reuse it to reproduce a run
+    uint64_t seed() const { return rng.seed(); }
+    
+    // Capture the simulation state between steps: nodes and their ingress
+    // queues, topology and links, mitigation switches and state,
+    // signatures, the seed, the time step and packets still in flight. A
+    // simulator restored from it continues exactly as this one would.
+    // Console, metrics and trace recorder settings, worker and generator
+    // threads and stages added with addMitigationStage() are not part of
+    // the snapshot.
+    Snapshot snapshot() const {
+        SnapshotWriter writer;
+        const_cast<NetworkSimulator*>(this)->serialize(writer);
+        return writer.finish();
+    }
+    
+    void saveSnapshot(const std::string& path) const { snapshot().save(path); }
+    
+    // Replace the simulation state with a snapshot's, which may come from a
+    // simulator of any size. What snapshot() leaves out stays as it is
+    // here. Throws std::runtime_error if the snapshot is malformed, leaving
+    // the simulator only fit to be restored again or destroyed.
+    void restoreSnapshot(const Snapshot& snapshot) {
+        SnapshotReader reader(snapshot);
+        serialize(reader);
+        if (!reader.done()) {
+            throw std::runtime_error("Snapshot has data past the simulator state");
+        }
+        if (traceRecorder && (traceRecorder->numNodes() != static_cast<int>(nodes.size()) ||
+                              traceRecorder->numAttackers() != static_cast<int>(attackerNodes.size()))) {
+            traceRecorder = nullptr;
+        }
+    }
+    
+    // Map a file written by saveSnapshot() and restore from it
+    void restoreSnapshot(const std::string& path) { restoreSnapshot(Snapshot::load(path)); }
+    
+    // Whether worker or generator threads are set, which a forked copy of
+    // the simulator could not use
+    bool ownsThreads() const { return workers != nullptr || generators != nullptr; }
+    
+    // Generate and process traffic on numThreads workers; 1 keeps the
+    // serial path. Both paths produce identical results for the same seed.
+    void setWorkerThreads(int numThreads) {
+        workers.reset(numThreads > 1 ? new ThreadPool(numThreads) : nullptr);
+    }
+    
+    // Generate traffic on numThreads threads of its own, running ahead of
+    // processing so runSimulation() overlaps the two; 0 turns it off. Steps
+    // are identical to serial generation. Aggregate mode, traffic models,
+    // whose steps differ in size, and steps with packets already queued by
+    // generateTraffic() are not pipelined.
+    void setPipelinedGeneration(int numThreads, const PipelineOptions& options = PipelineOptions()) {
+        generators.reset(numThreads > 0 ? new TrafficPipeline(numThreads, options) : nullptr);
+    }
+    
+    // Forward packets hop by hop along shortest paths. Links and the
+    // routers in between have limited capacity, so traffic can be dropped
+    // before it ever reaches the target's mitigations.
+    void enableRouting(bool enable) {
+        if (enable) requireWholeNetwork("Routing");
+        routing = enable;
+    }
+    
+    // Give packets microsecond send times spread across each step and
+    // process them in arrival order through a discrete-event queue. With
+    // routing, every hop adds the link latency, so packets sent near the end
+    // of a step can arrive in the next one. Aggregate mode ignores this.
+    void enableEventScheduling(bool enable) { eventScheduling = enable; }
+    
+    // Per-hop latency in microseconds used with event scheduling
+    void setLinkLatency(int64_t micros) { linkLatency = micros; }
+    
+    // Put a bounded queue in front of every node instead of letting it
+    // take any number of packets per step. Packets that pass the
+    // mitigations join their destination's queue, which serves them at the
+    // node's drain rate; they count as processed as they leave, possibly in
+    // a later step, and as dropped with kIngressQueueSlot if the queue turns
+    // them away. Aggregate mode ignores this. Turning it off empties the queues.
+    void enableIngressQueueing(bool enable) {
+        ingressQueueing = enable;
+        if (!enable) resetIngressQueues();
+    }
+    
+    // Queue limit, drain rate and discipline; queued packets are discarded
+    void configureIngressQueues(const IngressQueueConfig& config) {
+        ingressConfig = config;
+        resetIngressQueues();
+    }
+    
+    // Packets waiting in every node's ingress queue
+    size_t queuedPackets() const {
+        size_t total = 0;
+        for (const auto& node : nodes) total += node.ingress.size();
+        return total;
+    }
+    
+    // Latency from send time to delivery, in microseconds, of the packets
+    // of a traffic class delivered in the most recent step. It covers
+    // link latency with event scheduling and routing, and time spent in
+    // ingress queues; without event scheduling packets arrive as they are
+    // sent.
+    const LatencyHistogram& lastStepLatency(TrafficClass trafficClass = kLegitimateClass) const {
+        return delivered.step[trafficClass];
+    }
+    
+    // The same over every step so far
+    const LatencyHistogram& totalLatency(TrafficClass trafficClass = kLegitimateClass) const {
+        return runLatency[trafficClass];
+    }
+    
+    // Keep delivery latency per destination node as well, about 18 KB for
+    // each node that receives traffic. Turning it off drops the histograms.
+    void enableNodeLatency(bool enable) {
+        nodeLatencyTracking = enable;
+        if (!enable) {
+            for (auto& node : nodeLatency) node.reset();
+        }
+    }
+    
+    // The same over every step so far for the packets delivered to nodeId,
+    // empty unless enableNodeLatency() is on
+    const LatencyHistogram& nodeDeliveryLatency(int nodeId, TrafficClass trafficClass = kLegitimateClass) const {
+        static const LatencyHistogram kEmpty;
+        const std::unique_ptr<LatencyByClass>& node = nodeLatency.at(nodeId);
+        return node ? (*node)[trafficClass] : kEmpty;
+    }
+    
+    // Simulate traffic as (source, destination, signature, count) flows
+    // instead of individual packets. Statistics match packet mode without
+    // event scheduling, but a step costs O(flows) regardless of attack intensity.
+    // A shard rejects it with std::invalid_argument: its flows would be
+    // addressed to a target that may belong to another shard.
+    void enableAggregateMode(bool enable) {
+        if (enable) requireWholeNetwork("Aggregate mode");
+        aggregateMode = enable;
+    }
+    
+    // Print each step's statistics (on by default). Benchmarks and batch
+    // runs turn this off and read lastStepStats() instead.
+    void enableConsoleOutput(bool enable) { consoleOutput = enable; }
+    
+    // Send the per-step report to out instead of std::cout. out must
+    // outlive the simulation.
+    void setConsoleStream(std::ostream& out) { console = &out; }
+    
+    const StepStats& lastStepStats() const { return lastStats; }
+    
+    // Send a StepRecord for every following step to exporter (nullptr stops).
+    // The exporter must outlive the simulation.
+    void setMetricsExporter(MetricsExporter* exporter) { metrics = exporter; }
+    
+    // Write the packets of every following step to recorder as they enter
+    // processing (nullptr stops). Steps in aggregate mode have no packets
+    // and are not recorded. The recorder must outlive the simulation.
+    void setTraceRecorder(TraceWriter* recorder) {
+        if (recorder && (recorder->numNodes() != static_cast<int>(nodes.size()) ||
+                         recorder->numAttackers() != static_cast<int>(attackerNodes.size()))) {
+            throw std::invalid_argument("Trace recorder was opened for a different network");
+        }
+        traceRecorder = recorder;
+    }
+    
+    // Shape generated traffic with a model instead of a constant flood and
+    // a fixed legitimate count, see traffic_model.h; the model's
+    // intensities and rates are relative to the attackIntensity and
+    // legitimateTraffic that generation is called with. Spoofed packets
+    // carry a forged source node id, which mitigations and routing treat
+    // as their source. Weights are given for the whole network; a shard
+    // takes its users' part of the legitimate traffic by weight. Throws
+    // std::invalid_argument for a bad model.
+    void configureTrafficModel(const TrafficModelConfig& config) {
+        std::vector<int> capacities;
+        for (int attackerId : attackerNodes) capacities.push_back(nodes[localNode(attackerId)].capacity);
+        TrafficModelConfig shardConfig = config;
+        modelShare = legitimateShare;
+        if (!config.legitimateWeights.empty()) {
+            // Users are the nodes after the attackers, in node order
+            size_t numUsers = static_cast<size_t>(legitimateShare.total);
+            if (config.legitimateWeights.size() != numUsers) {
+                throw std::invalid_argument("Legitimate weights do not match the number of legitimate users");
+            }
+            size_t firstUser = size_t(networkNodes) - numUsers;
+            std::vector<double> shardWeights(shard.count, 0.0);
+            shardConfig.legitimateWeights.clear();
+            for (size_t u = 0; u < numUsers; u++) {
+                int owner = int((firstUser + u) % size_t(shard.count));
+                shardWeights[owner] += config.legitimateWeights[u];
+                if (owner == shard.index) shardConfig.legitimateWeights.push_back(config.legitimateWeights[u]);
+            }
+            // Summed in shard order, so neighbouring shards agree on their boundary
+            modelShare = LegitimateShare{0, 0, 0};
+            for (int j = 0; j < shard.count; j++) {
+                if (j == shard.index) modelShare.before = modelShare.total;
+                modelShare.total += shardWeights[j];
+                if (j == shard.index) modelShare.through = modelShare.total;
+            }
+        }
+        arrivals.configure(shardConfig, legitimateSources.size(), capacities, size_t(networkNodes), rng, streamOffset);
+        trafficModeling = true;
+    }
+    
+    // Switch back to the constant flood, or to the configured model
+    void enableTrafficModel(bool enable) { trafficModeling = enable; }
+    
+    // Enable different mitigation strategies
+    void enableRateLimiting(bool enable) { rateLimit = enable; }
+    
+    // Token bucket applied to every source when rate limiting: packetsPerStep
+    // refill rate and burst size. A rate of 0 or less turns it off.
+    void configureSourceRateLimit(int packetsPerStep, int burst) {
+        sourceRate = packetsPerStep;
+        sourceBurst = burst;
+        stage<SourceRateLimitStage>().buckets.resize(networkNodes, sourceRate, sourceBurst);
+    }
+    void enableIPFiltering(bool enable) { ipFiltering = enable; }
+    
+    // Choose between ground-truth filtering and the blocklist, see
+    // IPFilterConfig; counts and blocked sources start over
+    void configureIPFilter(const IPFilterConfig& config) {
+        withStages([&](auto& stages) { stageOf<IPFilterStage>(stages).configure(config); });
+        blocklistTotal = BlocklistTally();
+    }
+    
+    // How the counts behind the IP filter's ground-truth mode and deep
+    // packet inspection age, see CounterDecay; both start over. By default
+    // they halve every ten steps.
+    void configureCounterDecay(const CounterDecay& decay) {
+        withStages([&](auto& stages) {
+            stageOf<IPFilterStage>(stages).setDecay(decay);
+            stageOf<InspectionStage>(stages).counts.setDecay(decay);
+        });
+    }
+    
+    // Sources currently on the IP filter's blocklist
+    const CuckooFilter& blocklist() const {
+        return *withStages([](const auto& stages) { return &stageOf<IPFilterStage>(stages).blocked; });
+    }
+    
+    // Blocklist activity in the most recent step and over every step so far
+    BlocklistTally lastStepBlocklist() const { return stepBlocklist(); }
+    const BlocklistTally& totalBlocklist() const { return blocklistTotal; }
+    void enableDeepPacketInspection(bool enable) { deepPacketInspection = enable; }
+    void enableTrafficPatternAnalysis(bool enable) { trafficPatternAnalysis = enable; }
+    
+    // Register signatures, such as those of a packet capture, and return
+    // their ids in this simulator
+    std::vector<uint32_t> internSignatures(const std::vector<std::string>& names) {
+        std::vector<uint32_t> ids;
+        ids.reserve(names.size());
+        for (const auto& name : names) {
+            ids.push_back(signatures.intern(name));
+        }
+        return ids;
+    }
+    
+    // Register an extra mitigation stage, applied after the built-in ones
+    // to the packets they let through. It is called through a virtual
+    // interface, so it suits experiments better than the built-in stages'
+    // compile-time pipeline. See MitigationStage for the contract.
+    void addMitigationStage(std::unique_ptr<MitigationStage> stage) {
+        this->stage<RuntimePipeline>().add(std::move(stage));
+    }
+    
+    // RNG counter for packet i of the current step
+    uint64_t packetKey(size_t i) const { return packetKey(timeStep, i); }
+    
+    // Send time of packet i: spread over the step with event scheduling,
+    // otherwise every packet leaves at the start of the step
+    int64_t sendTimeOf(size_t i) const { return sendTimeOf(timeStep, i); }
+    
+    // Generate traffic (both legitimate and attack). Packets are addressed
+    // by global node id, so a shard throws std::invalid_argument and
+    // generates through generateShardTraffic() instead.
+    void generateTraffic(int targetNodeId, double attackIntensity, int legitimateTraffic) {
+        DDOS_PROBE(kProbeGenerate);
+        requireWholeNetwork("Generating a step for one target");
+        // New packets go after anything already queued
+        size_t base = packets.size();
+        size_t total = layOutStep(base, attackIntensity, legitimateTraffic);
+        packets.resize(total);
+        
+        // Blocks are aligned to whole 64-packet legitimacy words
+        size_t numBlocks = (total + kGenerationBlock - 1) / kGenerationBlock - base / kGenerationBlock;
+        auto generateBlock = [&](size_t b) {
+            size_t begin = (base / kGenerationBlock + b) * kGenerationBlock;
+            fillPackets(packets, timeStep, targetNodeId, std::max(begin, base),
+                        std::min(total, begin + kGenerationBlock));
+        };
+        if (workers) {
+            workers->parallelFor(numBlocks, generateBlock);
+        } else {
+            for (size_t b = 0; b < numBlocks; b++) generateBlock(b);
+        }
+    }
+    
+    // Generate the shard's part of the step that generateTraffic() for each
+    // of targets in turn would build in the whole network, and pass every
+    // packet to emit(order, sourceId, destinationId, isLegitimate,
+    // sendTime, signatureId). Orders are unique across the shards and sort
+    // packets as the whole step lays them out: by target, legitimate before
+    // attack traffic, then by shard and position. The cost is that of the
+    // shard's own packets. Returns how many were generated.
+    template <typename Emit>
+    size_t generateShardTraffic(const std::vector<int>& targets, double attackIntensity, int legitimateTraffic,
+                                Emit emit) {
+        DDOS_PROBE(kProbeGenerate);
+        size_t base = 0;
+        for (size_t t = 0; t < targets.size(); t++) {
+            int targetNodeId = targets[t];
+            size_t total = layOutStep(base, attackIntensity, legitimateTraffic);
+            if (total - base > UINT32_MAX) {
+                throw std::length_error("A shard sends a target more than 2^32 packets in a step");
+            }
+            uint64_t first = uint64_t(t) << 48 | uint64_t(shard.index) << 32;
+            uint64_t attackFirst = first | uint64_t(1) << 47;
+            size_t legitimateEnd = attackOffsets.front();
+            emitPackets(timeStep, base, total,
+                        [&](size_t i, int sourceId, bool isLegitimate, int64_t sendTime, uint32_t signatureId) {
+                            uint64_t order = i < legitimateEnd ? first + (i - base) : attackFirst + (i - legitimateEnd);
+                            emit(order, sourceId, targetNodeId, isLegitimate, sendTime, signatureId);
+                        });
+            base = total;
+        }
+        return base;
+    }
+    
+    // Generate the step's traffic as flows. Legitimate sources are drawn
+    // exactly as in generateTraffic() and consecutive packets from the same
+    // source are merged, which keeps the packet order that shared links and
+    // buckets see. Each attacker becomes a single flow, so the cost no
+    // longer grows with intensity; under a traffic model, on-off users send
+    // a flow each and an attacker's spoofed packets, drawn one by one as
+    // in packet mode, come as flows ahead of its own. A shard throws
+    // std::invalid_argument, as for generateTraffic().
+    void generateFlows(int targetNodeId, double attackIntensity, int legitimateTraffic) {
+        DDOS_PROBE(kProbeGenerate);
+        requireWholeNetwork("Generating flows");
+        layOutStep(0, attackIntensity, legitimateTraffic);
+        size_t firstFlow = flows.size();
+        auto addPacket = [&](int sourceId, bool isLegitimate, uint32_t signatureId) {
+            if (flows.size() > firstFlow && flows.sourceIds.back() == sourceId &&
+                flows.signatureIds.back() == signatureId && bool(flows.legitimate.back()) == isLegitimate) {
+                flows.counts.back()++;
+            } else {
+                flows.push(sourceId, targetNodeId, isLegitimate, stepStartTime(), signatureId, 1);
+            }
+        };
+        if (userOffsets.empty()) {
+            for (size_t i = 0; i < attackOffsets.front(); i++) {
+                addPacket(legitimateSourceOf(timeStep, i), true, legitimateSignatureId);
+            }
+        }
+        for (size_t u = 0; u + 1 < userOffsets.size(); u++) {
+            int count = static_cast<int>(userOffsets[u + 1] - userOffsets[u]);
+            if (count > 0) {
+                flows.push(legitimateSources[u], targetNodeId, true, stepStartTime(), legitimateSignatureId, count);
+            }
+        }
+        for (size_t k = 0; k < attackerNodes.size(); k++) {
+            int attackerId = attackerNodes[k];
+            uint32_t signatureId = nodeSignatureIds[localNode(attackerId)];
+            size_t spoofedEnd = attackOffsets[k] + (trafficModeling ? arrivals.spoofedCount(k) : 0);
+            for (size_t i = attackOffsets[k]; i < spoofedEnd; i++) {
+                addPacket(arrivals.spoofedSourceOf(rng, packetKey(i)), false, signatureId);
+            }
+            int attackPackets = static_cast<int>(attackOffsets[k + 1] - spoofedEnd);
+            if (attackPackets > 0) {
+                flows.push(attackerId, targetNodeId, false, stepStartTime(), signatureId, attackPackets);
+            }
+        }
+    }
+    
+    // Process packets with mitigation techniques
+    void processTraffic() {
+        // Reset node loads
+        for (auto& node : nodes) {
+            node.resetLoad();
+        }
+        
+        StepStats stats = processStep();
+        
+        // Reset rather than free the buffers so the next step reuses their storage
+        packets.clear();
+        flows.clear();
+        traffic = &packets;
+        
+        lastStats = stats;
+        
+        // Report statistics
+        if (metrics) {
+            metrics->record(stepRecord(stats));
+        }
+        if (consoleOutput) {
+            printStepStats(stats);
+        }
+        
+        // Increment time
+        timeStep++;
+        DDOS_END_STEP();
+    }
+    
+    // Process one step of shared traffic, e.g. a step of a TrafficTrace,
+    // instead of generated packets. The packets are read in place and never
+    // modified, so any number of simulators may process the same buffer at
+    // once. stepTraffic must stay alive and unchanged during the call,
+    // belong to the current time step and come from a simulator with the
+    // same nodes and attackers, so that node and signature ids match.
+    // Aggregate mode does not apply to shared traffic.
+    void processTraffic(const PacketBuffer& stepTraffic) {
+        packets.clear();
+        traffic = &stepTraffic;
+        processTraffic();
+    }
+    
+    // Generate steps of traffic from the current time step on, exactly as
+    // runSimulation() would, and keep it as a trace instead of processing
+    // it. Only the traffic settings (seed, nodes, event scheduling) matter,
+    // so a simulator with no mitigations can serve as the generator. The
+    // time step moves past the recorded steps.
+    std::shared_ptr<const TrafficTrace> recordTrace(int steps, int targetNodeId, double attackIntensity,
+                                                     int legitimateTraffic) {
+        auto trace = std::make_shared<TrafficTrace>();
+        trace->numNodes = static_cast<int>(nodes.size());
+        trace->numAttackers = static_cast<int>(attackerNodes.size());
+        trace->firstStep = timeStep;
+        trace->seed = rng.seed();
+        trace->steps.resize(std::max(0, steps));
+        for (auto& step : trace->steps) {
+            packets.clear();
+            generateTraffic(targetNodeId, attackIntensity, legitimateTraffic);
+            step = packets;
+            timeStep++;
+        }
+        packets.clear();
+        return trace;
+    }
+    
+    // Process every step of a trace in order, starting at its first step.
+    // Simulators replaying the same trace see identical packets, so
+    // differences between their results come from the mitigations alone.
+    void replayTrace(const TrafficTrace& trace) {
+        if (trace.numNodes != static_cast<int>(nodes.size()) ||
+            trace.numAttackers != static_cast<int>(attackerNodes.size())) {
+            throw std::invalid_argument("Trace was recorded for a different network");
+        }
+        if (trace.firstStep != timeStep) {
+            throw std::invalid_argument("Trace starts at time step " + std::to_string(trace.firstStep) +
+                                        ", simulator is at " + std::to_string(timeStep));
+        }
+        for (const auto& step : trace.steps) {
+            processTraffic(step);
+        }
+    }
+    
+    // Process the steps of a trace file in order, decoding each one into
+    // the packet buffer in place of generated traffic. Each recorded step
+    // must fall on the simulator's current time step.
+    void replayTrace(const TraceReader& reader) {
+        if (reader.numNodes() != static_cast<int>(nodes.size()) ||
+            reader.numAttackers() != static_cast<int>(attackerNodes.size())) {
+            throw std::invalid_argument("Trace was recorded for a different network");
+        }
+        for (size_t s = 0; s < reader.numSteps(); s++) {
+            if (reader.stepTime(s) != timeStep) {
+                throw std::invalid_argument("Trace step " + std::to_string(reader.stepTime(s)) +
+                                            " does not match time step " + std::to_string(timeStep));
+            }
+            reader.readStep(s, packets);
+            processTraffic();
+        }
+    }
+    
+    // Run the simulation; a shard throws std::invalid_argument, see
+    // generateTraffic()
+    void runSimulation(int steps, int targetNodeId, double attackIntensity, int legitimateTraffic) {
+        requireWholeNetwork("Running a simulation for one target");
+        if (generators && !aggregateMode && !trafficModeling && packets.empty()) {
+            runPipelined(steps, targetNodeId, attackIntensity, legitimateTraffic);
+            return;
+        }
+        for (int i = 0; i < steps; i++) {
+            if (aggregateMode) {
+                generateFlows(targetNodeId, attackIntensity, legitimateTraffic);
+            } else {
+                generateTraffic(targetNodeId, attackIntensity, legitimateTraffic);
+            }
+            processTraffic();
+        }
+    }
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "partition.h"
+
+// Streaming per-source rate tracking in bounded memory.
+//
+// CountMinSketch estimates how often each key was seen using depth rows of
+// width counters; an estimate never undercounts and overcounts by a small
+// fraction of the total with high probability. Each row's columns are cut
+// into one slice per partition and a key only hashes within the slice of
+// partitionOf(key), so the parallel processing path can update the sketch
+// from every partition at once without sharing a counter.
+
+class CountMinSketch {
+public:
+    // width is rounded up to a multiple of kNumPartitions
+    explicit CountMinSketch(size_t depth = 4, size_t width = size_t(1) << 16) :
+        rows(depth),
+        sliceWidth(std::max<size_t>(1, (width + kNumPartitions - 1) / kNumPartitions)),
+        counters(depth * sliceWidth * kNumPartitions, 0) {}
+
+    // Add count occurrences of key and return its new estimate
+    uint32_t add(uint64_t key, uint32_t count = 1) {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t r = 0; r < rows; r++) {
+            uint32_t& counter = counters[index(r, key)];
+            counter += count;
+            estimate = std::min(estimate, counter);
+        }
+        return estimate;
+    }
+
+    uint32_t estimate(uint64_t key) const {
+        uint32_t estimate = UINT32_MAX;
+        for (size_t r = 0; r < rows; r++) {
+            estimate = std::min(estimate, counters[index(r, key)]);
+        }
+        return estimate;
+    }
+
+    // Remove everything other counted; other must have the same shape
+    void subtract(const CountMinSketch& other) {
+        for (size_t i = 0; i < counters.size(); i++) {
+            counters[i] -= other.counters[i];
+        }
+    }
+
+    void clear() { std::fill(counters.begin(), counters.end(), 0); }
+
+    size_t memoryBytes() const { return counters.size() * sizeof(uint32_t); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(rows, sliceWidth, counters); }
+
+private:
+    size_t index(size_t row, uint64_t key) const {
+        uint64_t h = (key ^ kRowSeeds[row % 8]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 31;
+        size_t column = partitionOf(key) * sliceWidth + (h >> 16) % sliceWidth;
+        return row * sliceWidth * kNumPartitions + column;
+    }
+
+    static constexpr uint64_t kRowSeeds[8] = {
+        0x243F6A8885A308D3ull, 0x13198A2E03707344ull, 0xA4093822299F31D0ull, 0x082EFA98EC4E6C89ull,
+        0x452821E638D01377ull, 0xBE5466CF34E90C6Cull, 0xC0AC29B7C97C50DDull, 0x3F84D5B5B5470917ull,
+    };
+
+    size_t rows;
+    size_t sliceWidth;
+    std::vector<uint32_t> counters;
+};
+
+// Count-min sketch over a sliding window of the last numWindows sub-windows.
+// A running total sketch answers queries in O(depth); advance() retires the
+// oldest sub-window by subtracting it from the total, so memory stays at
+// (numWindows + 1) sketches however many keys pass through.
+class SlidingWindowSketch {
+public:
+    SlidingWindowSketch(size_t numWindows = 5, size_t depth = 4, size_t width = size_t(1) << 16) :
+        windows(numWindows, CountMinSketch(depth, width)), total(depth, width), current(0) {}
+
+    // Add to the current sub-window and return the windowed estimate
+    uint32_t add(uint64_t key, uint32_t count = 1) {
+        windows[current].add(key, count);
+        return total.add(key, count);
+    }
+
+    uint32_t estimate(uint64_t key) const { return total.estimate(key); }
+
+    // Start a new sub-window, forgetting the oldest one
+    void advance() {
+        current = (current + 1) % windows.size();
+        total.subtract(windows[current]);
+        windows[current].clear();
+    }
+
+    size_t memoryBytes() const { return total.memoryBytes() * (windows.size() + 1); }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(windows, total, current); }
+
+private:
+    std::vector<CountMinSketch> windows;
+    CountMinSketch total;
+    size_t current;
+};
+
+// Top-k keys by estimated count. Candidates are kept per partition (so that
+// partitions can offer keys concurrently) and merged on request.
+class HeavyHitters {
+public:
+    explicit HeavyHitters(size_t k = 8) : k(k), candidates(kNumPartitions) {
+        for (auto& slot : candidates) {
+            slot.reserve(k);
+        }
+    }
+
+    // Report the latest estimate for key
+    void offer(uint64_t key, uint32_t estimate) {
+        std::vector<std::pair<uint64_t, uint32_t>>& slot = candidates[partitionOf(key)];
+        size_t smallest = 0;
+        for (size_t i = 0; i < slot.size(); i++) {
+            if (slot[i].first == key) {
+                slot[i].second = estimate;
+                return;
+            }
+            if (slot[i].second < slot[smallest].second) smallest = i;
+        }
+        if (slot.size() < k) {
+            slot.emplace_back(key, estimate);
+        } else if (estimate > slot[smallest].second) {
+            slot[smallest] = std::make_pair(key, estimate);
+        }
+    }
+
+    // The k keys with the highest estimates, largest first
+    std::vector<std::pair<uint64_t, uint32_t>> top() const {
+        std::vector<std::pair<uint64_t, uint32_t>> all;
+        for (const auto& slot : candidates) {
+            all.insert(all.end(), slot.begin(), slot.end());
+        }
+        std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (all.size() > k) all.resize(k);
+        return all;
+    }
+
+    void clear() {
+        for (auto& slot : candidates) {
+            slot.clear();
+        }
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(k, candidates); }
+
+private:
+    size_t k;
+    std::vector<std::vector<std::pair<uint64_t, uint32_t>>> candidates;
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Snapshots are read in place and assume a little-endian host"
+#endif
+
+// Binary snapshots of simulator state for warm starts.
+//
+// Layout, all integers little-endian:
+//   header   magic "DDOSSNP1", uint32 version, uint32 reserved,
+//            uint64 payload bytes
+//   payload  the state, field by field in a fixed order
+//
+// In the payload a plain value is its raw bytes. An array is a uint64
+// element count followed by the elements, as one raw block when they are
+// plain values. A string is an array of chars. Structs go in as raw bytes,
+// so a snapshot is read back by a build of the same code on the same kind
+// of host; kSnapshotVersion changes whenever the layout does.
+//
+// Classes with state take part through one member template used both ways:
+//
+//   template <typename Archive>
+//   void serialize(Archive& archive) { archive(first, second, ...); }
+//
+// SnapshotWriter appends the fields to a byte buffer and SnapshotReader
+// assigns them back from a Snapshot, a header-checked view of the bytes
+// that is either kept in memory or mapped from a file. A large array is
+// restored with a single copy from the mapped pages, so restoring costs
+// little more than touching the memory the state occupies.
+
+constexpr char kSnapshotMagic[8] = {'D', 'D', 'O', 'S', 'S', 'N', 'P', '1'};
+constexpr uint32_t kSnapshotVersion = 5;
+constexpr size_t kSnapshotHeaderBytes = 24;
+
+static_assert(sizeof(size_t) == 8, "Snapshots store sizes as 64-bit values");
+
+namespace detail {
+
+template <typename T, typename Archive, typename = void>
+struct HasSerialize : std::false_type {};
+
+template <typename T, typename Archive>
+struct HasSerialize<T, Archive, decltype(std::declval<T&>().serialize(std::declval<Archive&>()))> : std::true_type {};
+
+}  // namespace detail
+
+// A complete snapshot: its bytes, owned or mapped from a file
+class Snapshot {
+public:
+    // Take ownership of bytes written by SnapshotWriter::finish()
+    static Snapshot fromBytes(std::vector<unsigned char> bytes) {
+        Snapshot snapshot;
+        snapshot.owned = std::move(bytes);
+        snapshot.bytes = snapshot.owned.data();
+        snapshot.length = snapshot.owned.size();
+        snapshot.checkHeader("in-memory snapshot");
+        return snapshot;
+    }
+
+    // Map a file written by save(). Throws std::runtime_error if it cannot
+    // be read or is not a complete snapshot.
+    static Snapshot load(const std::string& path) {
+        Snapshot snapshot;
+        snapshot.file = std::make_shared<MappedFile>(path);
+        snapshot.bytes = snapshot.file->data();
+        snapshot.length = snapshot.file->size();
+        snapshot.checkHeader(path);
+        return snapshot;
+    }
+
+    void save(const std::string& path) const {
+        std::FILE* out = std::fopen(path.c_str(), "wb");
+        if (!out) {
+            throw std::runtime_error("Cannot open snapshot file " + path);
+        }
+        bool written = std::fwrite(bytes, 1, length, out) == length;
+        if (std::fclose(out) != 0 || !written) {
+            throw std::runtime_error("Cannot write snapshot file " + path);
+        }
+    }
+
+    const unsigned char* payload() const { return bytes + kSnapshotHeaderBytes; }
+    size_t payloadSize() const { return length - kSnapshotHeaderBytes; }
+
+    // Whole snapshot, header included
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    Snapshot() = default;
+
+    void checkHeader(const std::string& name) const {
+        if (length < kSnapshotHeaderBytes || std::memcmp(bytes, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0) {
+            throw std::runtime_error(name + " is not a simulator snapshot");
+        }
+        uint32_t version;
+        uint64_t payloadBytes;
+        std::memcpy(&version, bytes + 8, sizeof(version));
+        std::memcpy(&payloadBytes, bytes + 16, sizeof(payloadBytes));
+        if (version != kSnapshotVersion) {
+            throw std::runtime_error(name + " has unsupported snapshot version " + std::to_string(version));
+        }
+        if (payloadBytes != length - kSnapshotHeaderBytes) {
+            throw std::runtime_error(name + " is truncated");
+        }
+    }
+
+    std::vector<unsigned char> owned;
+    std::shared_ptr<MappedFile> file;   // Shared, so copies of a snapshot share one mapping
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+};
+
+class SnapshotWriter {
+public:
+    static constexpr bool kLoading = false;
+
+    SnapshotWriter() : bytes(kSnapshotHeaderBytes, 0) {}
+
+    template <typename... T>
+    void operator()(T&... values) {
+        (field(values), ...);
+    }
+
+    // count plain values stored without a length
+    template <typename T>
+    void raw(const T* values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "Raw blocks hold plain values only");
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(values);
+        bytes.insert(bytes.end(), data, data + count * sizeof(T));
+    }
+
+    // The snapshot of everything written so far
+    Snapshot finish() {
+        std::memcpy(bytes.data(), kSnapshotMagic, sizeof(kSnapshotMagic));
+        uint32_t version = kSnapshotVersion;
+        uint64_t payloadBytes = bytes.size() - kSnapshotHeaderBytes;
+        std::memcpy(bytes.data() + 8, &version, sizeof(version));
+        std::memcpy(bytes.data() + 16, &payloadBytes, sizeof(payloadBytes));
+        return Snapshot::fromBytes(std::move(bytes));
+    }
+
+private:
+    template <typename T>
+    void field(T& value) {
+        if constexpr (detail::HasSerialize<T, SnapshotWriter>::value) {
+            value.serialize(*this);
+        } else {
+            static_assert(std::is_trivially_copyable<T>::value, "Field needs a serialize() member");
+            raw(&value, 1);
+        }
+    }
+
+    template <typename T, typename Allocator>
+    void field(std::vector<T, Allocator>& values) {
+        uint64_t count = values.size();
+        raw(&count, 1);
+        if constexpr (std::is_trivially_copyable<T>::value && !detail::HasSerialize<T, SnapshotWriter>::value) {
+            raw(values.data(), values.size());
+        } else {
+            for (auto& value : values) field(value);
+        }
+    }
+
+    void field(std::string& text) {
+        uint64_t count = text.size();
+        raw(&count, 1);
+        raw(text.data(), text.size());
+    }
+
+    template <typename A, typename B>
+    void field(std::pair<A, B>& pair) {
+        field(pair.first);
+        field(pair.second);
+    }
+
+    template <typename T>
+    void field(std::unique_ptr<T>& pointer) {
+        uint8_t present = pointer != nullptr;
+        raw(&present, 1);
+        if (pointer) field(*pointer);
+    }
+
+    std::vector<unsigned char> bytes;
+};
+
+class SnapshotReader {
+public:
+    static constexpr bool kLoading = true;
+
+    explicit SnapshotReader(const Snapshot& snapshot) :
+        next(snapshot.payload()), end(snapshot.payload() + snapshot.payloadSize()) {}
+
+    template <typename... T>
+    void operator()(T&... values) {
+        (field(values), ...);
+    }
+
+    template <typename T>
+    void raw(T* values, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "Raw blocks hold plain values only");
+        size_t size = count * sizeof(T);
+        need(size);
+        if (size > 0) std::memcpy(static_cast<void*>(values), next, size);
+        next += size;
+    }
+
+    // Whether every byte of the payload has been read
+    bool done() const { return next == end; }
+
+private:
+    void need(size_t size) const {
+        if (size > size_t(end - next)) {
+            throw std::runtime_error("Snapshot ends in the middle of a field");
+        }
+    }
+
+    // Element count of an array whose elements take at least elementBytes each
+    size_t count(size_t elementBytes) {
+        uint64_t n;
+        raw(&n, 1);
+        if (elementBytes > 0 && n > uint64_t(end - next) / elementBytes) {
+            throw std::runtime_error("Snapshot array is longer than the snapshot");
+        }
+        return size_t(n);
+    }
+
+    template <typename T>
+    void field(T& value) {
+        if constexpr (detail::HasSerialize<T, SnapshotReader>::value) {
+            value.serialize(*this);
+        } else {
+            static_assert(std::is_trivially_copyable<T>::value, "Field needs a serialize() member");
+            raw(&value, 1);
+        }
+    }
+
+    template <typename T, typename Allocator>
+    void field(std::vector<T, Allocator>& values) {
+        if constexpr (std::is_trivially_copyable<T>::value && !detail::HasSerialize<T, SnapshotReader>::value) {
+            values.resize(count(sizeof(T)));
+            raw(values.data(), values.size());
+        } else {
+            values.resize(count(1));
+            for (auto& value : values) field(value);
+        }
+    }
+
+    void field(std::string& text) {
+        text.resize(count(1));
+        raw(&text[0], text.size());
+    }
+
+    template <typename A, typename B>
+    void field(std::pair<A, B>& pair) {
+        field(pair.first);
+        field(pair.second);
+    }
+
+    template <typename T>
+    void field(std::unique_ptr<T>& pointer) {
+        uint8_t present;
+        raw(&present, 1);
+        if (!present) {
+            pointer.reset();
+            return;
+        }
+        if (!pointer) pointer.reset(new T());
+        field(*pointer);
+    }
+
+    const unsigned char* next;
+    const unsigned char* end;
+};
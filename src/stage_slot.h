@@ -0,0 +1,23 @@
+#pragma once
+
+// Per-stage drop tallies, one slot per built-in stage. Stages registered at
+// run time share kCustomSlot, and the last slot counts packets that passed
+// every stage but found their node's ingress queue full.
+enum StageSlot : int {
+    kIPFilterSlot,
+    kInspectionSlot,
+    kSourceRateLimitSlot,
+    kDestinationRateLimitSlot,
+    kPatternSlot,
+    kCustomSlot,
+    kIngressQueueSlot,
+    kNumStageSlots
+};
+
+inline const char* stageSlotName(int slot) {
+    static const char* const kNames[kNumStageSlots] = {
+        "ip_filter", "deep_packet_inspection", "source_rate_limit",
+        "destination_rate_limit", "traffic_pattern_analysis", "custom", "ingress_queue",
+    };
+    return kNames[slot];
+}
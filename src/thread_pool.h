@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool for fork/join loops.
+// parallelFor() hands out task indices from a shared counter and blocks until
+// every task has finished; the calling thread works alongside the pool, so a
+// pool of size 1 simply runs the loop inline. The task is called through a
+// plain function pointer rather than a std::function, so handing out a loop
+// never allocates.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t numThreads) : taskCount(0), nextTask(0), pending(0), generation(0), stopping(false) {
+        for (size_t i = 1; i < numThreads; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads taking part in parallelFor, including the caller
+    size_t size() const { return workers.size() + 1; }
+
+    // Run task(i) for every i in [0, numTasks) and wait for completion
+    template <typename Task>
+    void parallelFor(size_t numTasks, const Task& task) {
+        if (workers.empty() || numTasks <= 1) {
+            for (size_t i = 0; i < numTasks; i++) {
+                task(i);
+            }
+            return;
+        }
+        run(numTasks, &task, [](const void* context, size_t i) { (*static_cast<const Task*>(context))(i); });
+    }
+
+private:
+    void run(size_t numTasks, const void* context, void (*invoke)(const void*, size_t)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentTask = context;
+            invokeTask = invoke;
+            taskCount = numTasks;
+            nextTask = 0;
+            pending = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        runTasks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        currentTask = nullptr;
+    }
+
+    void workerLoop() {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runTasks();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) done.notify_one();
+            }
+        }
+    }
+
+    void runTasks() {
+        for (size_t i = nextTask.fetch_add(1); i < taskCount; i = nextTask.fetch_add(1)) {
+            invokeTask(currentTask, i);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const void* currentTask = nullptr;     // Task of the running loop, called through invokeTask
+    void (*invokeTask)(const void*, size_t) = nullptr;
+    size_t taskCount;
+    std::atomic<size_t> nextTask;
+    size_t pending;
+    size_t generation;
+    bool stopping;
+};
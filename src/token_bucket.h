@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "event_queue.h"
+
+// Token buckets for a dense key space (one per source or destination node).
+// Each bucket refills at `rate` tokens per step up to `burst` tokens. Refill
+// is lazy: a bucket is only updated when a packet touches it, from the time
+// elapsed since its last update, so a step costs O(active keys) however
+// many buckets exist. Tokens are kept in fixed point (one token is
+// kMicrosPerStep units), which makes refill exact integer arithmetic.
+class TokenBucketArray {
+public:
+    // Size to numKeys buckets, all with the same rate and burst, starting full
+    void resize(size_t numKeys, int rate, int burst) {
+        tokens.assign(numKeys, int64_t(burst) * kTokenUnit);
+        lastRefill.assign(numKeys, 0);
+        rates.assign(numKeys, rate);
+        bursts.assign(numKeys, burst);
+    }
+
+    // Change one bucket's rate and burst; it restarts full
+    void configure(size_t key, int rate, int burst) {
+        rates[key] = rate;
+        bursts[key] = burst;
+        tokens[key] = int64_t(burst) * kTokenUnit;
+    }
+
+    size_t size() const { return tokens.size(); }
+
+    // Take one token at time now if the bucket has one
+    bool tryConsume(size_t key, int64_t now) {
+        refill(key, now);
+        if (tokens[key] < kTokenUnit) return false;
+        tokens[key] -= kTokenUnit;
+        return true;
+    }
+
+    // Take up to count tokens at time now and return how many were taken
+    int consumeUpTo(size_t key, int64_t now, int count) {
+        refill(key, now);
+        int taken = static_cast<int>(std::min<int64_t>(count, tokens[key] / kTokenUnit));
+        tokens[key] -= taken * kTokenUnit;
+        return taken;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(tokens, lastRefill, rates, bursts); }
+
+private:
+    static constexpr int64_t kTokenUnit = kMicrosPerStep;
+
+    void refill(size_t key, int64_t now) {
+        int64_t elapsed = now - lastRefill[key];
+        if (elapsed <= 0) return;
+        lastRefill[key] = now;
+        int64_t full = int64_t(bursts[key]) * kTokenUnit;
+        int64_t room = full - tokens[key];
+        if (room <= 0 || rates[key] <= 0) return;
+        // Elapsed microseconds add `rate` fixed-point units each
+        tokens[key] = elapsed >= room / rates[key] + 1 ? full : tokens[key] + elapsed * rates[key];
+    }
+
+    std::vector<int64_t> tokens;
+    std::vector<int64_t> lastRefill;    // Microseconds of simulated time
+    std::vector<int> rates;             // Tokens per step
+    std::vector<int> bursts;
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "random.h"
+
+// Undirected network topology in compressed sparse row (CSR) form.
+// The neighbours of node i are neighbors[offsets[i], offsets[i + 1]), so the
+// whole graph takes O(nodes + links) memory and is built in O(links) by a
+// counting sort over the edge list. Each undirected link is stored once per
+// direction; the position of an entry in `neighbors` identifies that
+// directed link.
+class Topology {
+public:
+    std::vector<size_t> offsets;
+    std::vector<int> neighbors;
+
+    Topology() : offsets(1, 0) {}
+
+    int numNodes() const { return static_cast<int>(offsets.size()) - 1; }
+    size_t numLinks() const { return neighbors.size() / 2; }
+    size_t degree(int node) const { return offsets[node + 1] - offsets[node]; }
+    const int* neighborsBegin(int node) const { return neighbors.data() + offsets[node]; }
+    const int* neighborsEnd(int node) const { return neighbors.data() + offsets[node + 1]; }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(offsets, neighbors); }
+
+    // Build from undirected edges. Self-loops and duplicate edges are dropped.
+    static Topology fromEdges(int numNodes, const std::vector<std::pair<int, int>>& edges) {
+        Topology topology;
+        topology.offsets.assign(numNodes + 1, 0);
+        for (const auto& edge : edges) {
+            if (edge.first < 0 || edge.second < 0 || edge.first >= numNodes || edge.second >= numNodes) {
+                throw std::out_of_range("Topology edge references a node outside the network");
+            }
+            if (edge.first == edge.second) continue;
+            topology.offsets[edge.first + 1]++;
+            topology.offsets[edge.second + 1]++;
+        }
+        for (int i = 0; i < numNodes; i++) {
+            topology.offsets[i + 1] += topology.offsets[i];
+        }
+        topology.neighbors.resize(topology.offsets[numNodes]);
+        std::vector<size_t> next(topology.offsets.begin(), topology.offsets.end() - 1);
+        for (const auto& edge : edges) {
+            if (edge.first == edge.second) continue;
+            topology.neighbors[next[edge.first]++] = edge.second;
+            topology.neighbors[next[edge.second]++] = edge.first;
+        }
+        topology.removeDuplicateLinks();
+        return topology;
+    }
+
+    // Every node linked to every other node: O(nodes^2), small networks only
+    static Topology fullMesh(int numNodes) {
+        std::vector<std::pair<int, int>> edges;
+        for (int i = 0; i < numNodes; i++) {
+            for (int j = i + 1; j < numNodes; j++) {
+                edges.emplace_back(i, j);
+            }
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+    // Every node linked to a single hub
+    static Topology star(int numNodes, int hub) {
+        std::vector<std::pair<int, int>> edges;
+        for (int i = 0; i < numNodes; i++) {
+            if (i != hub) edges.emplace_back(hub, i);
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+    // Complete tree rooted at node 0 in which node i's parent is (i - 1) / fanout.
+    // Throws std::invalid_argument unless fanout is positive.
+    static Topology tree(int numNodes, int fanout) {
+        if (fanout <= 0) {
+            throw std::invalid_argument("Tree fanout must be positive");
+        }
+        std::vector<std::pair<int, int>> edges;
+        for (int i = 1; i < numNodes; i++) {
+            edges.emplace_back((i - 1) / fanout, i);
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+    // Barabasi-Albert preferential attachment: each new node links to
+    // linksPerNode existing nodes chosen with probability proportional to degree
+    static Topology scaleFree(int numNodes, int linksPerNode, uint64_t seed) {
+        CounterRng rng(seed);
+        uint64_t draw = 0;
+        std::vector<std::pair<int, int>> edges;
+        std::vector<int> endpoints;     // Every node appears once per link it has
+        int core = std::min(numNodes, linksPerNode + 1);
+        for (int i = 0; i < core; i++) {
+            for (int j = i + 1; j < core; j++) {
+                edges.emplace_back(i, j);
+                endpoints.push_back(i);
+                endpoints.push_back(j);
+            }
+        }
+        std::vector<int> targets;
+        for (int i = core; i < numNodes; i++) {
+            targets.clear();
+            while (static_cast<int>(targets.size()) < linksPerNode) {
+                int target = endpoints[rng.below(kTopologyStream, draw++, endpoints.size())];
+                if (std::find(targets.begin(), targets.end(), target) == targets.end()) {
+                    targets.push_back(target);
+                }
+            }
+            for (int target : targets) {
+                edges.emplace_back(i, target);
+                endpoints.push_back(i);
+                endpoints.push_back(target);
+            }
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+    // Configuration-model random graph where every node has the given degree.
+    // Self-loops and repeated pairings are discarded, so a few nodes can end
+    // up slightly below the requested degree.
+    static Topology randomRegular(int numNodes, int nodeDegree, uint64_t seed) {
+        CounterRng rng(seed);
+        std::vector<int> stubs;
+        stubs.reserve(size_t(numNodes) * nodeDegree);
+        for (int i = 0; i < numNodes; i++) {
+            stubs.insert(stubs.end(), nodeDegree, i);
+        }
+        for (size_t i = stubs.size(); i > 1; i--) {
+            std::swap(stubs[i - 1], stubs[rng.below(kTopologyStream, i, i)]);
+        }
+        std::vector<std::pair<int, int>> edges;
+        edges.reserve(stubs.size() / 2);
+        for (size_t i = 0; i + 1 < stubs.size(); i += 2) {
+            edges.emplace_back(stubs[i], stubs[i + 1]);
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+    // Load "u v" pairs, one link per line; '#' starts a comment.
+    // The network has max(id) + 1 nodes unless numNodes is larger.
+    static Topology fromEdgeListFile(const std::string& path, int numNodes = 0) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Cannot open edge list " + path);
+        }
+        std::vector<std::pair<int, int>> edges;
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            int u, v;
+            if (fields >> u >> v) {
+                edges.emplace_back(u, v);
+                numNodes = std::max(numNodes, std::max(u, v) + 1);
+            }
+        }
+        return fromEdges(numNodes, edges);
+    }
+
+private:
+    static constexpr uint64_t kTopologyStream = 0x70706f6c;
+
+    // Sort each adjacency list and drop repeated neighbours, compacting in place
+    void removeDuplicateLinks() {
+        size_t write = 0;
+        size_t begin = offsets[0];
+        for (size_t i = 0; i + 1 < offsets.size(); i++) {
+            size_t end = offsets[i + 1];
+            std::sort(neighbors.begin() + begin, neighbors.begin() + end);
+            offsets[i] = write;
+            for (size_t j = begin; j < end; j++) {
+                if (j == begin || neighbors[j] != neighbors[j - 1]) {
+                    neighbors[write++] = neighbors[j];
+                }
+            }
+            begin = end;
+        }
+        offsets.back() = write;
+        neighbors.resize(write);
+    }
+};
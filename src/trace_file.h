@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "packet_buffer.h"
+#include "traffic_trace.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Trace files are read in place and assume a little-endian host"
+#endif
+
+// Binary packet traces for record and replay.
+//
+// Layout, all integers little-endian:
+//   header  magic "DDOSTRC1", uint32 version, int32 numNodes,
+//           int32 numAttackers, uint32 blockPackets, uint64 seed,
+//           uint64 numSteps, uint64 indexOffset, uint64 numPackets
+//   blocks  every step's packets, in blocks of at most blockPackets
+//   index   per step: int64 timeStep, uint64 offset of its first block,
+//           uint64 packet count, in increasing time step order
+//
+// A block is a uint32 packet count followed by the PacketBuffer columns,
+// sourceIds, destinationIds, timestamps, arrivalTimes and signatureIds, as
+// fixed-width values, and then its legitimacy words. Each value column
+// starts with a one-byte encoding: raw values, runs of (value, uint32
+// length), or for arrivalTimes a copy of the timestamps. Runs suit
+// simulated traffic, where an attacker's flood is one long run of equal
+// ids. Signature ids are the recording simulator's interned ids, so a
+// trace replays into a simulator with the same nodes and attackers.
+//
+// TraceWriter streams steps to disk as they are recorded. TraceReader maps
+// the file and decodes a step straight into a reused PacketBuffer: raw
+// columns are single memcpys and runs are fills, so replay does no parsing
+// and no per-packet allocation.
+
+enum TraceEncoding : uint8_t {
+    kTraceRaw,
+    kTraceRuns,
+    kTraceSameAsTimestamps,
+};
+
+constexpr char kTraceMagic[8] = {'D', 'D', 'O', 'S', 'T', 'R', 'C', '1'};
+constexpr uint32_t kTraceVersion = 1;
+constexpr size_t kTraceHeaderBytes = 56;
+constexpr size_t kTraceIndexEntryBytes = 24;
+
+class TraceWriter {
+public:
+    static constexpr size_t kDefaultBlockPackets = size_t(1) << 16;
+
+    // Throws std::runtime_error if path cannot be opened. blockPackets is
+    // rounded down to a multiple of 64, so legitimacy words never straddle
+    // blocks.
+    TraceWriter(const std::string& path, int numNodes, int numAttackers, uint64_t seed = 0,
+                size_t blockPackets = kDefaultBlockPackets) :
+        path(path), nodes(numNodes), attackers(numAttackers), traceSeed(seed),
+        blockPackets(std::max<size_t>(64, blockPackets / 64 * 64)), offset(kTraceHeaderBytes), packetCount(0) {
+        out = std::fopen(path.c_str(), "wb");
+        if (!out) {
+            throw std::runtime_error("Cannot open trace file " + path);
+        }
+        writeHeader();
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Finishes the file if finish() was not called; errors are lost then
+    ~TraceWriter() {
+        if (!out) return;
+        try {
+            finish();
+        } catch (const std::exception&) {
+            if (out) std::fclose(out);
+        }
+    }
+
+    int numNodes() const { return nodes; }
+    int numAttackers() const { return attackers; }
+    size_t stepsWritten() const { return index.size(); }
+    uint64_t packetsWritten() const { return packetCount; }
+
+    // Append the packets of timeStep, which must be later than any step
+    // written before
+    void writeStep(int64_t timeStep, const PacketBuffer& packets) {
+        if (!out) {
+            throw std::logic_error("Trace file " + path + " is already finished");
+        }
+        if (!index.empty() && timeStep <= index.back().timeStep) {
+            throw std::invalid_argument("Trace steps must be written in increasing time step order");
+        }
+        index.push_back(IndexEntry{timeStep, offset, packets.size()});
+        for (size_t begin = 0; begin < packets.size(); begin += blockPackets) {
+            writeBlock(packets, begin, std::min(blockPackets, packets.size() - begin));
+        }
+        packetCount += packets.size();
+    }
+
+    // Append every step of a trace
+    void write(const TrafficTrace& trace) {
+        for (size_t s = 0; s < trace.numSteps(); s++) {
+            writeStep(trace.firstStep + static_cast<int64_t>(s), trace.steps[s]);
+        }
+    }
+
+    // Write the index, complete the header and close the file. Throws
+    // std::runtime_error if the file cannot be written.
+    void finish() {
+        if (!out) return;
+        uint64_t indexOffset = offset;
+        for (const auto& entry : index) {
+            append(entry.timeStep);
+            append(entry.offset);
+            append(uint64_t(entry.packets));
+        }
+        flushBuffer();
+        bool ok = std::fseek(out, 0, SEEK_SET) == 0;
+        if (ok) {
+            writeHeader(indexOffset);
+            ok = std::fflush(out) == 0;
+        }
+        ok = std::fclose(out) == 0 && ok;
+        out = nullptr;
+        if (!ok) {
+            throw std::runtime_error("Cannot write trace file " + path);
+        }
+    }
+
+private:
+    struct IndexEntry {
+        int64_t timeStep;
+        uint64_t offset;
+        size_t packets;
+    };
+
+    template <typename T>
+    void append(T value) {
+        size_t at = buffer.size();
+        buffer.resize(at + sizeof(T));
+        std::memcpy(&buffer[at], &value, sizeof(T));
+    }
+
+    void appendBytes(const void* data, size_t bytes) {
+        size_t at = buffer.size();
+        buffer.resize(at + bytes);
+        if (bytes > 0) std::memcpy(&buffer[at], data, bytes);
+    }
+
+    // Runs when they take less space than the raw values
+    template <typename T>
+    void appendColumn(const T* values, size_t n) {
+        size_t runs = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (i == 0 || values[i] != values[i - 1]) runs++;
+        }
+        if (runs * (sizeof(T) + sizeof(uint32_t)) >= n * sizeof(T)) {
+            append(uint8_t(kTraceRaw));
+            appendBytes(values, n * sizeof(T));
+            return;
+        }
+        append(uint8_t(kTraceRuns));
+        append(uint32_t(runs));
+        for (size_t i = 0; i < n;) {
+            size_t j = i + 1;
+            while (j < n && values[j] == values[i]) j++;
+            append(values[i]);
+            append(uint32_t(j - i));
+            i = j;
+        }
+    }
+
+    void writeBlock(const PacketBuffer& packets, size_t begin, size_t count) {
+        append(uint32_t(count));
+        appendColumn(&packets.sourceIds[begin], count);
+        appendColumn(&packets.destinationIds[begin], count);
+        appendColumn(&packets.timestamps[begin], count);
+        if (std::equal(&packets.arrivalTimes[begin], &packets.arrivalTimes[begin] + count,
+                       &packets.timestamps[begin])) {
+            append(uint8_t(kTraceSameAsTimestamps));
+        } else {
+            appendColumn(&packets.arrivalTimes[begin], count);
+        }
+        appendColumn(&packets.signatureIds[begin], count);
+        appendBytes(&packets.legitimateBits[begin / 64], (count + 63) / 64 * sizeof(uint64_t));
+        flushBuffer();
+    }
+
+    void flushBuffer() {
+        if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) {
+            throw std::runtime_error("Cannot write trace file " + path);
+        }
+        offset += buffer.size();
+        buffer.clear();
+    }
+
+    void writeHeader(uint64_t indexOffset = 0) {
+        std::vector<unsigned char> saved;
+        saved.swap(buffer);
+        appendBytes(kTraceMagic, sizeof(kTraceMagic));
+        append(kTraceVersion);
+        append(int32_t(nodes));
+        append(int32_t(attackers));
+        append(uint32_t(blockPackets));
+        append(traceSeed);
+        append(uint64_t(index.size()));
+        append(indexOffset);
+        append(packetCount);
+        bool ok = std::fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+        buffer.swap(saved);
+        if (!ok) {
+            throw std::runtime_error("Cannot write trace file " + path);
+        }
+    }
+
+    std::string path;
+    std::FILE* out;
+    int nodes;
+    int attackers;
+    uint64_t traceSeed;
+    size_t blockPackets;
+    uint64_t offset;        // File size once buffer is written
+    uint64_t packetCount;
+    std::vector<IndexEntry> index;
+    std::vector<unsigned char> buffer;      // Encoded block waiting to be written
+};
+
+class TraceReader {
+public:
+    // Maps path and reads its index. Throws std::runtime_error if the file
+    // is not a trace this version understands.
+    explicit TraceReader(const std::string& path) : file(path) {
+        const unsigned char* data = file.data();
+        if (file.size() < kTraceHeaderBytes || std::memcmp(data, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+            throw std::runtime_error(path + " is not a trace file");
+        }
+        uint32_t version = load<uint32_t>(data + 8);
+        if (version != kTraceVersion) {
+            throw std::runtime_error(path + " has unsupported trace version " + std::to_string(version));
+        }
+        nodes = load<int32_t>(data + 12);
+        attackers = load<int32_t>(data + 16);
+        traceSeed = load<uint64_t>(data + 24);
+        uint64_t numSteps = load<uint64_t>(data + 32);
+        uint64_t indexOffset = load<uint64_t>(data + 40);
+        packetCount = load<uint64_t>(data + 48);
+        if (indexOffset < kTraceHeaderBytes || indexOffset > file.size() ||
+            numSteps > (file.size() - indexOffset) / kTraceIndexEntryBytes) {
+            throw std::runtime_error(path + " has a damaged index; was the recording finished?");
+        }
+        index.resize(numSteps);
+        for (size_t s = 0; s < numSteps; s++) {
+            const unsigned char* entry = data + indexOffset + s * kTraceIndexEntryBytes;
+            index[s] = IndexEntry{load<int64_t>(entry), load<uint64_t>(entry + 8), load<uint64_t>(entry + 16)};
+            if (index[s].offset > indexOffset) {
+                throw std::runtime_error(path + " has a damaged index");
+            }
+        }
+        blocksEnd = data + indexOffset;
+        file.adviseSequential();
+    }
+
+    int numNodes() const { return nodes; }
+    int numAttackers() const { return attackers; }
+    uint64_t seed() const { return traceSeed; }
+    size_t numSteps() const { return index.size(); }
+    uint64_t numPackets() const { return packetCount; }
+    int64_t stepTime(size_t step) const { return index[step].timeStep; }
+    size_t stepPackets(size_t step) const { return index[step].packets; }
+
+    // Index of the step recorded at timeStep, or numSteps() if there is none
+    size_t findStep(int64_t timeStep) const {
+        auto it = std::lower_bound(index.begin(), index.end(), timeStep,
+                                   [](const IndexEntry& entry, int64_t t) { return entry.timeStep < t; });
+        return it != index.end() && it->timeStep == timeStep ? it - index.begin() : index.size();
+    }
+
+    // Replace the contents of out with the packets of a step. Once out has
+    // grown to the largest step it no longer allocates. Throws
+    // std::runtime_error if the step's blocks are damaged.
+    void readStep(size_t step, PacketBuffer& out) const {
+        size_t count = index[step].packets;
+        out.clear();
+        out.resize(count);
+        const unsigned char* p = file.data() + index[step].offset;
+        for (size_t begin = 0; begin < count;) {
+            need(p, sizeof(uint32_t));
+            size_t n = load<uint32_t>(p);
+            p += sizeof(uint32_t);
+            if (n == 0 || n > count - begin || (begin % 64 != 0)) corrupt();
+            p = readColumn(p, n, &out.sourceIds[begin]);
+            p = readColumn(p, n, &out.destinationIds[begin]);
+            p = readColumn(p, n, &out.timestamps[begin]);
+            need(p, 1);
+            if (*p == kTraceSameAsTimestamps) {
+                std::memcpy(&out.arrivalTimes[begin], &out.timestamps[begin], n * sizeof(int64_t));
+                p++;
+            } else {
+                p = readColumn(p, n, &out.arrivalTimes[begin]);
+            }
+            p = readColumn(p, n, &out.signatureIds[begin]);
+            size_t words = (n + 63) / 64;
+            need(p, words * sizeof(uint64_t));
+            std::memcpy(&out.legitimateBits[begin / 64], p, words * sizeof(uint64_t));
+            p += words * sizeof(uint64_t);
+            begin += n;
+        }
+    }
+
+    // Decode the whole file into memory, e.g. to share it with
+    // ScenarioMatrix-style replays. The steps must be consecutive.
+    std::shared_ptr<const TrafficTrace> toTrafficTrace() const {
+        auto trace = std::make_shared<TrafficTrace>();
+        trace->numNodes = nodes;
+        trace->numAttackers = attackers;
+        trace->firstStep = index.empty() ? 0 : static_cast<int>(index[0].timeStep);
+        trace->seed = traceSeed;
+        trace->steps.resize(index.size());
+        for (size_t s = 0; s < index.size(); s++) {
+            if (index[s].timeStep != trace->firstStep + static_cast<int64_t>(s)) {
+                throw std::runtime_error("Trace steps are not consecutive");
+            }
+            readStep(s, trace->steps[s]);
+        }
+        return trace;
+    }
+
+private:
+    struct IndexEntry {
+        int64_t timeStep;
+        uint64_t offset;
+        uint64_t packets;
+    };
+
+    template <typename T>
+    static T load(const unsigned char* p) {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        return value;
+    }
+
+    [[noreturn]] static void corrupt() {
+        throw std::runtime_error("Trace file is damaged");
+    }
+
+    void need(const unsigned char* p, size_t bytes) const {
+        if (bytes > size_t(blocksEnd - p)) corrupt();
+    }
+
+    template <typename T>
+    const unsigned char* readColumn(const unsigned char* p, size_t n, T* values) const {
+        need(p, 1);
+        uint8_t encoding = *p++;
+        if (encoding == kTraceRaw) {
+            need(p, n * sizeof(T));
+            std::memcpy(values, p, n * sizeof(T));
+            return p + n * sizeof(T);
+        }
+        if (encoding != kTraceRuns) corrupt();
+        need(p, sizeof(uint32_t));
+        size_t runs = load<uint32_t>(p);
+        p += sizeof(uint32_t);
+        need(p, runs * (sizeof(T) + sizeof(uint32_t)));
+        size_t filled = 0;
+        for (size_t r = 0; r < runs; r++) {
+            T value = load<T>(p);
+            size_t length = load<uint32_t>(p + sizeof(T));
+            p += sizeof(T) + sizeof(uint32_t);
+            if (length > n - filled) corrupt();
+            std::fill_n(values + filled, length, value);
+            filled += length;
+        }
+        if (filled != n) corrupt();
+        return p;
+    }
+
+    MappedFile file;
+    int nodes;
+    int attackers;
+    uint64_t traceSeed;
+    uint64_t packetCount;
+    std::vector<IndexEntry> index;
+    const unsigned char* blocksEnd;     // Start of the index
+};
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "random.h"
+
+// Traffic models: how many packets each source sends in a step.
+//
+// Without a model every attacker floods at attackIntensity times its
+// capacity and legitimateTraffic packets come from uniformly drawn users.
+// A model shapes both over time and across sources. Attackers follow
+// AttackModels, dealt round robin, which give pulsing and low-and-slow
+// attacks, ramp-up floods, heterogeneous bot rates and spoofed sources.
+// Legitimate users either share a fixed rate by weight or alternate
+// between on and off periods of heavy-tailed length.
+//
+// Counts are sampled in batch, one draw per source per step rather than
+// one per packet. A step's packets are then laid out as one run per source,
+// so emitting them costs no draws and no branches on the source. Only a
+// source that is picked per packet costs a draw per packet: a weighted
+// legitimate user, or a spoofed address. Those picks use alias tables,
+// which do it in O(1) with one lookup. Every draw is keyed by the step and
+// the source or packet index, as the rest of the generator is, so modeled
+// traffic is the same however the work is split.
+
+// Walker's alias method: an index drawn with probability proportional to
+// its weight from 64 random bits, in O(1) with one table read
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    // Throws std::invalid_argument unless the weights are finite, not
+    // negative and not all zero
+    explicit AliasTable(const std::vector<double>& weights) {
+        double total = 0;
+        for (double weight : weights) {
+            if (!(weight >= 0) || !std::isfinite(weight)) {
+                throw std::invalid_argument("Alias table weights must be finite and not negative");
+            }
+            total += weight;
+        }
+        if (weights.empty() || !(total > 0)) {
+            throw std::invalid_argument("Alias table needs a positive weight");
+        }
+
+        // Vose's construction: pair each under-full column with an
+        // over-full one that tops it up
+        size_t n = weights.size();
+        columns.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+        for (size_t i = 0; i < n; i++) {
+            scaled[i] = weights[i] * double(n) / total;
+            (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t under = small.back();
+            uint32_t over = large.back();
+            small.pop_back();
+            columns[under] = Column{toThreshold(scaled[under]), over};
+            scaled[over] -= 1.0 - scaled[under];
+            if (scaled[over] < 1.0) {
+                large.pop_back();
+                small.push_back(over);
+            }
+        }
+        // What is left is full up to rounding and always picks itself
+        for (uint32_t i : large) columns[i] = Column{UINT32_MAX, i};
+        for (uint32_t i : small) columns[i] = Column{UINT32_MAX, i};
+    }
+
+    size_t size() const { return columns.size(); }
+    bool empty() const { return columns.empty(); }
+
+    // The top 32 bits pick a column, the low 32 bits choose between the
+    // column and its alias
+    uint32_t sample(uint64_t bits) const {
+        uint32_t column = uint32_t(((bits >> 32) * columns.size()) >> 32);
+        const Column& entry = columns[column];
+        return uint32_t(bits) < entry.threshold ? column : entry.alias;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) { archive(columns); }
+
+private:
+    struct Column {
+        uint32_t threshold;     // Keeps the column when the low bits fall below it
+        uint32_t alias;
+    };
+
+    static uint32_t toThreshold(double share) {
+        return uint32_t(std::min(double(UINT32_MAX), share * 0x1.0p32));
+    }
+
+    std::vector<Column> columns;
+};
+
+// Poisson count with the given mean from 64 random bits: inversion for
+// small means, a rounded normal approximation from a Box-Muller pair for
+// large ones, where the two differ by a fraction of a packet
+inline uint32_t poissonCount(double mean, uint64_t bits) {
+    constexpr double kInversionMean = 12.0;
+    if (mean <= 0) return 0;
+    if (mean < kInversionMean) {
+        double u = double(bits >> 11) * 0x1.0p-53;
+        double p = std::exp(-mean);
+        double cumulative = p;
+        uint32_t k = 0;
+        while (u > cumulative && k < 100) {
+            k++;
+            p *= mean / k;
+            cumulative += p;
+        }
+        return k;
+    }
+    double u1 = (double(bits >> 32) + 0.5) * 0x1.0p-32;
+    double u2 = double(uint32_t(bits)) * 0x1.0p-32;
+    double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+    return uint32_t(std::max(0.0, std::floor(mean + std::sqrt(mean) * z + 0.5)));
+}
+
+// Rounds mean up with probability equal to its fraction, so the expected
+// count is exactly the mean
+inline uint32_t roundedCount(double mean, uint64_t bits) {
+    return uint32_t(std::max(0.0, mean + double(bits >> 11) * 0x1.0p-53));
+}
+
+// Pareto draw with the given shape (> 1) and mean, from 64 random bits
+inline double paretoDraw(double shape, double mean, uint64_t bits) {
+    double u = (double(bits >> 11) + 1.0) * 0x1.0p-53;     // (0, 1]
+    return mean * (shape - 1.0) / shape * std::pow(u, -1.0 / shape);
+}
+
+// How an attacker's rate evolves over the steps
+enum class AttackPattern {
+    Constant,   // The full rate every step
+    Pulsing,    // onSteps at the full rate, then offSteps at lowShare of it
+    Ramp,       // From lowShare of the rate up to all of it over rampSteps
+};
+
+// One kind of attacker. Its full rate is scale * attackIntensity times the
+// attacker's capacity per step. A low-and-slow attack is any pattern at a
+// small scale, typically spread over many bots.
+struct AttackModel {
+    AttackPattern pattern = AttackPattern::Constant;
+    double scale = 1.0;
+    int startStep = 0;          // Time step the attack starts at; silent before
+    int onSteps = 5;            // Pulsing: steps at the full rate per period
+    int offSteps = 15;          // Pulsing: steps at lowShare per period
+    int rampSteps = 20;         // Ramp: steps to reach the full rate
+    double lowShare = 0;        // Rate between pulses or at the start of a ramp, as a share of the full rate
+    bool staggered = false;     // Pulsing: every bot starts its period at a random offset
+    bool poisson = false;       // Poisson counts around the rate instead of the rate itself
+    double rateSpread = 0;      // Pareto shape of the bots' rate multipliers, mean 1; 0 gives every bot the same rate
+    double spoofedShare = 0;    // Share of packets sent with a forged source address
+};
+
+// How legitimate users send
+enum class LegitimatePattern {
+    Uniform,    // legitimateTraffic packets a step, each from a user drawn by weight
+    OnOff,      // Users alternate between on and off periods, sending Poisson counts while on
+};
+
+struct LegitimateModel {
+    LegitimatePattern pattern = LegitimatePattern::Uniform;
+    double meanOnSteps = 4;
+    double meanOffSteps = 12;
+    double paretoShape = 1.5;   // Heavy-tailed period lengths; must exceed 1
+};
+
+struct TrafficModelConfig {
+    LegitimateModel legitimate;
+    std::vector<AttackModel> attacks;   // Dealt to the attackers round robin; empty keeps the constant flood
+
+    // Relative send rates of the legitimate users, in node order, and the
+    // chance of each node's address being forged. Empty weighs them equally.
+    std::vector<double> legitimateWeights;
+    std::vector<double> spoofWeights;
+};
+
+// Per-step arrival counts of a TrafficModelConfig for one network.
+//
+// prepare() samples a step: attacker counts and their spoofed shares, and
+// with on-off users each user's count, advancing the users' periods. Calls
+// for the step already prepared reuse its counts, so several targets or
+// generation calls within a step see the same counts.
+class ArrivalSampler {
+public:
+    static constexpr double kMaxRateMultiplier = 100.0;    // Cap on a bot's Pareto rate multiplier
+    static constexpr double kMaxPeriodSteps = 1e6;
+
+    // Set up for legitimate users and attackers with the given capacities
+    // in a network of numNodes. Bot multipliers and pulse offsets are drawn
+    // from rng here. Samplers with different stream offsets, such as those
+    // of a network's shards, draw independently. Throws
+    // std::invalid_argument for a bad model.
+    void configure(const TrafficModelConfig& config, size_t numUsers, const std::vector<int>& attackerCapacities,
+                   size_t numNodes, const CounterRng& rng, uint64_t streamOffset = 0) {
+        streams = streamOffset;
+        legitimate = config.legitimate;
+        attacks = config.attacks.empty() ? std::vector<AttackModel>{AttackModel()} : config.attacks;
+        for (const auto& model : attacks) {
+            if (model.onSteps < 0 || model.offSteps < 0 || model.onSteps + model.offSteps == 0 || model.rampSteps < 0 ||
+                model.spoofedShare < 0 || model.spoofedShare > 1 || (model.rateSpread != 0 && model.rateSpread <= 1)) {
+                throw std::invalid_argument("Attack model has a bad period, spoofed share or rate spread");
+            }
+        }
+        if (legitimate.pattern == LegitimatePattern::OnOff &&
+            (!(legitimate.paretoShape > 1) || !(legitimate.meanOnSteps >= 1) || !(legitimate.meanOffSteps >= 1))) {
+            throw std::invalid_argument("On-off periods need a Pareto shape above 1 and means of at least a step");
+        }
+        if (!config.legitimateWeights.empty() && config.legitimateWeights.size() != numUsers) {
+            throw std::invalid_argument("Legitimate weights do not match the number of legitimate users");
+        }
+        if (!config.spoofWeights.empty() && config.spoofWeights.size() != numNodes) {
+            throw std::invalid_argument("Spoof weights do not match the number of nodes");
+        }
+
+        userWeights = config.legitimateWeights.empty() ? std::vector<double>(numUsers, 1.0)
+                                                       : config.legitimateWeights;
+        users = numUsers > 0 ? AliasTable(userWeights) : AliasTable();
+        spoofed = AliasTable(config.spoofWeights.empty() ? std::vector<double>(numNodes, 1.0) : config.spoofWeights);
+
+        size_t numBots = attackerCapacities.size();
+        rates.resize(numBots);
+        phases.resize(numBots);
+        std::vector<uint64_t> bits(numBots);
+        rng.fill(kBotStream + streams, 0, bits.data(), numBots);
+        for (size_t k = 0; k < numBots; k++) {
+            const AttackModel& model = attacks[k % attacks.size()];
+            double multiplier = model.rateSpread > 1
+                              ? std::min(kMaxRateMultiplier, paretoDraw(model.rateSpread, 1.0, bits[k])) : 1.0;
+            rates[k] = model.scale * attackerCapacities[k] * multiplier;
+            uint32_t period = uint32_t(model.onSteps + model.offSteps);
+            phases[k] = model.staggered ? uint32_t((uint32_t(bits[k]) * uint64_t(period)) >> 32) : 0;
+        }
+        attackCounts.assign(numBots, 0);
+        spoofedCounts.assign(numBots, 0);
+        userOn.assign(numUsers, 0);
+        userRemaining.assign(numUsers, 0);
+        userCounts.assign(numUsers, 0);
+        stateStep = -1;
+        preparedStep = -1;
+    }
+
+    bool onOff() const { return legitimate.pattern == LegitimatePattern::OnOff; }
+
+    void prepare(const CounterRng& rng, int step, double attackIntensity, int legitimateTraffic) {
+        if (step == preparedStep && attackIntensity == preparedIntensity && legitimateTraffic == preparedTraffic) {
+            return;
+        }
+        preparedStep = step;
+        preparedIntensity = attackIntensity;
+        preparedTraffic = legitimateTraffic;
+        uint64_t firstKey = uint64_t(uint32_t(step)) << 32;
+
+        // Attack rates, then counts and spoofed shares, one draw each
+        size_t numBots = rates.size();
+        means.resize(std::max(numBots, userOn.size()));
+        bits.resize(means.size());
+        for (size_t k = 0; k < numBots; k++) {
+            means[k] = attackIntensity * rates[k] * profile(attacks[k % attacks.size()], step, phases[k]);
+        }
+        rng.fill(kCountStream + streams, firstKey, bits.data(), numBots);
+        for (size_t k = 0; k < numBots; k++) {
+            bool poisson = attacks[k % attacks.size()].poisson;
+            attackCounts[k] = poisson ? poissonCount(means[k], bits[k]) : roundedCount(means[k], bits[k]);
+        }
+        rng.fill(kSpoofCountStream + streams, firstKey, bits.data(), numBots);
+        for (size_t k = 0; k < numBots; k++) {
+            double share = attacks[k % attacks.size()].spoofedShare;
+            spoofedCounts[k] = std::min(attackCounts[k], roundedCount(attackCounts[k] * share, bits[k]));
+        }
+
+        if (!onOff()) return;
+        advanceUsers(rng, step);
+        size_t numUsers = userOn.size();
+        double onShare = legitimate.meanOnSteps / (legitimate.meanOnSteps + legitimate.meanOffSteps);
+        double totalWeight = 0;
+        for (double weight : userWeights) totalWeight += weight;
+        double perWeight = totalWeight > 0 ? legitimateTraffic / (totalWeight * onShare) : 0;
+        for (size_t u = 0; u < numUsers; u++) {
+            means[u] = userOn[u] ? perWeight * userWeights[u] : 0.0;
+        }
+        rng.fill(kUserCountStream + streams, firstKey, bits.data(), numUsers);
+        for (size_t u = 0; u < numUsers; u++) {
+            userCounts[u] = poissonCount(means[u], bits[u]);
+        }
+    }
+
+    // Counts of the prepared step
+    uint32_t attackCount(size_t attacker) const { return attackCounts[attacker]; }
+    uint32_t spoofedCount(size_t attacker) const { return spoofedCounts[attacker]; }
+    uint32_t userCount(size_t user) const { return userCounts[user]; }
+
+    // Legitimate user, by weight, and forged source node of the packet
+    // with the given RNG counter
+    uint32_t userOf(const CounterRng& rng, uint64_t packetKey) const {
+        return users.sample(rng.at(kUserStream + streams, packetKey));
+    }
+    int spoofedSourceOf(const CounterRng& rng, uint64_t packetKey) const {
+        return int(spoofed.sample(rng.at(kSpoofSourceStream + streams, packetKey)));
+    }
+
+    template <typename Archive>
+    void serialize(Archive& archive) {
+        archive(legitimate, attacks, userWeights, users, spoofed, rates, phases);
+        archive(attackCounts, spoofedCounts, userOn, userRemaining, userCounts, stateStep);
+        archive(preparedStep, preparedIntensity, preparedTraffic, streams);
+    }
+
+private:
+    // Streams of the simulator's CounterRng, clear of the generator's own
+    static constexpr uint64_t kBotStream = 16;
+    static constexpr uint64_t kCountStream = 17;
+    static constexpr uint64_t kSpoofCountStream = 18;
+    static constexpr uint64_t kSpoofSourceStream = 19;
+    static constexpr uint64_t kUserStream = 20;
+    static constexpr uint64_t kUserCountStream = 21;
+    static constexpr uint64_t kPeriodStream = 1 << 20;     // Plus the number of earlier flips in the same step
+
+    // Share of an attacker's full rate sent in step
+    static double profile(const AttackModel& model, int step, uint32_t phase) {
+        if (step < model.startStep) return 0.0;
+        int64_t elapsed = int64_t(step) - model.startStep;
+        switch (model.pattern) {
+            case AttackPattern::Constant:
+                return 1.0;
+            case AttackPattern::Pulsing: {
+                int64_t period = model.onSteps + model.offSteps;
+                return (elapsed + phase) % period < model.onSteps ? 1.0 : model.lowShare;
+            }
+            case AttackPattern::Ramp:
+                if (elapsed >= model.rampSteps) return 1.0;
+                return model.lowShare + (1.0 - model.lowShare) * double(elapsed) / double(model.rampSteps);
+        }
+        return 1.0;
+    }
+
+    int32_t period(bool on, uint64_t bits) const {
+        double mean = on ? legitimate.meanOnSteps : legitimate.meanOffSteps;
+        double steps = std::min(kMaxPeriodSteps, paretoDraw(legitimate.paretoShape, mean, bits));
+        return std::max(1, int32_t(steps + 0.5));
+    }
+
+    // Bring every user's period up to step. Users start on with the
+    // long-run share of time on, the first time a step is prepared.
+    void advanceUsers(const CounterRng& rng, int step) {
+        size_t numUsers = userOn.size();
+        uint64_t firstKey = uint64_t(uint32_t(step)) << 32;
+        if (stateStep < 0) {
+            double onShare = legitimate.meanOnSteps / (legitimate.meanOnSteps + legitimate.meanOffSteps);
+            rng.fill(kPeriodStream + streams, firstKey, bits.data(), numUsers);
+            for (size_t u = 0; u < numUsers; u++) {
+                userOn[u] = double(bits[u] >> 11) * 0x1.0p-53 < onShare;
+                userRemaining[u] = period(userOn[u], rng.at(kPeriodStream + streams + 1, firstKey + u));
+            }
+            stateStep = step;
+            return;
+        }
+        if (step <= stateStep) return;
+        int32_t elapsed = int32_t(std::min<int64_t>(INT32_MAX, int64_t(step) - stateStep));
+        stateStep = step;
+        for (size_t u = 0; u < numUsers; u++) {
+            userRemaining[u] -= elapsed;
+            for (uint64_t flip = 0; userRemaining[u] <= 0; flip++) {
+                userOn[u] = !userOn[u];
+                userRemaining[u] += period(userOn[u], rng.at(kPeriodStream + streams + flip, firstKey + u));
+            }
+        }
+    }
+
+    LegitimateModel legitimate;
+    std::vector<AttackModel> attacks;
+    std::vector<double> userWeights;
+    AliasTable users;
+    AliasTable spoofed;
+    std::vector<double> rates;          // Full rate of every attacker, before the intensity
+    std::vector<uint32_t> phases;       // Pulse offset of every attacker
+
+    std::vector<uint32_t> attackCounts;
+    std::vector<uint32_t> spoofedCounts;    // Of each attacker's count, packets with a forged source
+    std::vector<uint8_t> userOn;
+    std::vector<int32_t> userRemaining;     // Steps left in the user's current period
+    std::vector<uint32_t> userCounts;
+    int stateStep = -1;                 // Step the user periods are at, -1 before the first
+    int preparedStep = -1;
+    double preparedIntensity = 0;
+    int preparedTraffic = 0;
+
+    uint64_t streams = 0;               // Offset of every stream
+    std::vector<double> means;          // Scratch for prepare()
+    std::vector<uint64_t> bits;
+};
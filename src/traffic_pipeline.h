@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "packet_buffer.h"
+#include "ring_buffer.h"
+
+// Tuning of a TrafficPipeline
+struct PipelineOptions {
+    size_t batchPackets = 1 << 16;  // Packets per generation task, rounded up to whole 64-packet words
+    size_t stepsAhead = 1;          // Steps generated ahead of the one being processed, at most
+    WaitPolicy wait = WaitPolicy::Yield;
+};
+
+// Traffic generation running ahead of processing on threads of its own.
+//
+// A run of steps is cut into batches of batchPackets packets. Generator
+// threads claim batches in order from a shared counter and write them
+// straight into the step's buffer in a BatchRing; a step is handed to the
+// consumer once all of its batches are in. The consumer processes steps in
+// order while the generators fill up to stepsAhead later ones, and a
+// generator that gets that far ahead waits, so memory stays bounded
+// however much faster generation is than processing.
+//
+// Every batch draws its random numbers from its packets' step and index,
+// so the steps come out exactly as serial generation produces them.
+class TrafficPipeline {
+public:
+    TrafficPipeline(int numThreads, const PipelineOptions& options) :
+        settings(options), ring(options.stepsAhead + 1), stopping(false), nextTicket(0),
+        generation(0), nextItem(0), consumed(0) {
+        settings.batchPackets = std::max<size_t>(64, (options.batchPackets + 63) / 64 * 64);
+        for (int i = 0; i < std::max(1, numThreads); i++) {
+            threads.emplace_back([this] { generatorLoop(); });
+        }
+    }
+
+    ~TrafficPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping.store(true);
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    TrafficPipeline(const TrafficPipeline&) = delete;
+    TrafficPipeline& operator=(const TrafficPipeline&) = delete;
+
+    int numThreads() const { return static_cast<int>(threads.size()); }
+    const PipelineOptions& options() const { return settings; }
+
+    // Start generating numSteps steps of stepPackets packets each, time
+    // steps firstStep on, where fill(step, begin, end, out) writes packets
+    // [begin, end) of a step into out, already sized to the whole step.
+    // fill runs on the generator threads and must stay valid until the
+    // last step has been taken with next(). The previous run must have
+    // been consumed completely.
+    template <typename Fill>
+    void start(int firstStep, int numSteps, size_t stepPackets, const Fill& fill) {
+        ring.forEachValue([&](PacketBuffer& buffer) {
+            if (buffer.size() != stepPackets) {
+                buffer.clear();
+                buffer.resize(stepPackets);
+            }
+        });
+        Job job;
+        job.firstStep = firstStep;
+        job.firstItem = nextItem;
+        job.stepPackets = stepPackets;
+        job.batchesPerStep = std::max<size_t>(1, (stepPackets + settings.batchPackets - 1) / settings.batchPackets);
+        job.firstTicket = nextTicket.load(std::memory_order_relaxed);
+        job.endTicket = job.firstTicket + uint64_t(std::max(0, numSteps)) * job.batchesPerStep;
+        job.context = &fill;
+        job.invoke = [](const void* context, int step, size_t begin, size_t end, PacketBuffer& out) {
+            (*static_cast<const Fill*>(context))(step, begin, end, out);
+        };
+        ring.setPartsPerItem(job.batchesPerStep);
+        nextItem += std::max(0, numSteps);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = job;
+            generation++;
+        }
+        wake.notify_all();
+    }
+
+    // Wait for the next step of the run, in order
+    const PacketBuffer& next() {
+        return *ring.waitReady(consumed, stopping, settings.wait);
+    }
+
+    // Done with the step returned by next(); its buffer goes back to the generators
+    void release() {
+        PacketBuffer& buffer = *ring.waitReady(consumed, stopping, settings.wait);
+        std::fill(buffer.legitimateBits.begin(), buffer.legitimateBits.end(), 0);  // set() only adds bits
+        ring.release(consumed++);
+    }
+
+private:
+    struct Job {
+        int firstStep = 0;
+        uint64_t firstItem = 0;     // Ring item of firstStep
+        size_t stepPackets = 0;
+        size_t batchesPerStep = 1;
+        uint64_t firstTicket = 0;   // Batches [firstTicket, endTicket) make up the run
+        uint64_t endTicket = 0;
+        const void* context = nullptr;
+        void (*invoke)(const void*, int, size_t, size_t, PacketBuffer&) = nullptr;
+    };
+
+    void generatorLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping.load() || generation != seen; });
+                if (stopping.load()) return;
+                seen = generation;
+                job = current;
+            }
+            for (;;) {
+                // Claim the next batch, never past the end of the run
+                uint64_t ticket = nextTicket.load(std::memory_order_relaxed);
+                do {
+                    if (ticket >= job.endTicket) break;
+                } while (!nextTicket.compare_exchange_weak(ticket, ticket + 1, std::memory_order_relaxed));
+                if (ticket >= job.endTicket) break;
+
+                uint64_t batch = ticket - job.firstTicket;
+                uint64_t step = batch / job.batchesPerStep;
+                size_t begin = (batch % job.batchesPerStep) * settings.batchPackets;
+                PacketBuffer* out = ring.acquire(job.firstItem + step, stopping, settings.wait);
+                if (!out) return;
+                job.invoke(job.context, job.firstStep + static_cast<int>(step), std::min(begin, job.stepPackets),
+                           std::min(job.stepPackets, begin + settings.batchPackets), *out);
+                ring.commit(job.firstItem + step);
+            }
+        }
+    }
+
+    PipelineOptions settings;
+    BatchRing<PacketBuffer> ring;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> nextTicket;
+    Job current;                // Run being generated, guarded by mutex
+    uint64_t generation;        // Bumped for every run, guarded by mutex
+    uint64_t nextItem;          // Ring item of the next run's first step
+    uint64_t consumed;          // Ring item next() returns
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "packet_buffer.h"
+
+// Traffic generated once and replayed, unchanged, to any number of
+// simulators. Each step's packets sit in a PacketBuffer that is not
+// modified after recording, so simulators on different threads can read
+// the same trace at once without copying it. Traces are handed around as
+// std::shared_ptr<const TrafficTrace>; see NetworkSimulator::recordTrace().
+class TrafficTrace {
+public:
+    int numNodes = 0;       // Network the trace was generated for
+    int numAttackers = 0;
+    int firstStep = 0;      // Time step of steps[0]
+    uint64_t seed = 0;      // Seed of the generating simulator
+    std::vector<PacketBuffer> steps;
+
+    size_t numSteps() const { return steps.size(); }
+
+    size_t numPackets() const {
+        size_t total = 0;
+        for (const auto& step : steps) total += step.size();
+        return total;
+    }
+
+    // Replace every signature id s with ids[s], e.g. once the signatures of
+    // a capture have been interned in the simulator that replays it
+    void remapSignatures(const std::vector<uint32_t>& ids) {
+        for (auto& step : steps) {
+            for (uint32_t& id : step.signatureIds) id = ids[id];
+        }
+    }
+};